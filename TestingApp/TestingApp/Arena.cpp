@@ -0,0 +1,83 @@
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include "Arena.h"
+
+// The blocks grow up to that size (below the mmap threshold of malloc, so the blocks of a finished stage are reused by the next one).
+static const size_t MAX_ARENA_BLOCK_SIZE = 1 << 16;
+// The bigger allocations are not in the blocks.
+static const size_t MIN_LARGE_ALLOCATION = MAX_ARENA_BLOCK_SIZE / 8;
+
+MonotonicArena::MonotonicArena(size_t firstBlockSize)
+	: Current(nullptr)
+	, End(nullptr)
+	, NextBlockSize(std::max<size_t>(firstBlockSize, 64))
+	, Stats{ 0, 0, 0, 0 }
+{
+}
+
+MonotonicArena::~MonotonicArena()
+{
+	for (auto block : Blocks)
+	{
+		delete[] block;
+	}
+	for (auto block : LargeBlocks)
+	{
+		::operator delete(block);
+	}
+}
+
+void* MonotonicArena::Allocate(size_t bytes, size_t alignment)
+{
+	++Stats.allocationsCount;
+	Stats.allocatedBytes += bytes;
+
+	if (bytes > MIN_LARGE_ALLOCATION)
+	{
+		// A big one (e.g. the buckets of a big hash table or a growing vector) is taken from the heap,
+		// so the free part of the current block is not lost and it can be freed by Deallocate.
+		assert(alignment <= alignof(std::max_align_t));
+		auto block = ::operator new(bytes);
+		LargeBlocks.insert(block);
+		++Stats.blocksCount;
+		Stats.reservedBytes += bytes;
+		return block;
+	}
+
+	auto padding = (alignment - (uintptr_t) Current % alignment) % alignment;
+	if (Current == nullptr || bytes + padding > (size_t) (End - Current))
+	{
+		AddBlock(bytes + alignment);
+		padding = (alignment - (uintptr_t) Current % alignment) % alignment;
+	}
+
+	auto result = Current + padding;
+	Current = result + bytes;
+	return result;
+}
+
+void MonotonicArena::Deallocate(void* p, size_t bytes)
+{
+	if (bytes > MIN_LARGE_ALLOCATION && LargeBlocks.erase(p) > 0)
+	{
+		::operator delete(p);
+	}
+}
+
+void MonotonicArena::AddBlock(size_t bytes)
+{
+	const auto blockSize = std::max(NextBlockSize, bytes);
+	Blocks.push_back(new char[blockSize]);
+	Current = Blocks.back();
+	End = Current + blockSize;
+	NextBlockSize = std::min(NextBlockSize * 2, MAX_ARENA_BLOCK_SIZE);
+
+	++Stats.blocksCount;
+	Stats.reservedBytes += blockSize;
+}
+
+ArenaStats MonotonicArena::GetStats() const
+{
+	return Stats;
+}
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <unordered_set>
+#include <functional>
+
+/*
+	The short-lived containers of one stage of the construction (MakeRealTime, TestForFunctionality, MakeSubsequential, ...)
+	are allocated from a monotonic arena: the memory is taken from blocks (each one twice bigger than the previous one, up to 64KB)
+	and nothing is freed one by one, all blocks are freed together when the arena is destroyed, i.e. at the end of the stage.
+	Only the big allocations (e.g. of a growing vector) are separate and are freed when they are deallocated.
+	So a container in an arena must not outlive it. An arena is not thread-safe, it is used by one thread (the workers of a stage have their own).
+	What the transducer keeps (e.g. the new transitions of MakeRealTime) and the relations of ClosureEpsilon (SetOfTransitionsWithOutputs)
+	are still on the heap.
+*/
+
+// What an arena has given so far.
+struct ArenaStats
+{
+	size_t allocationsCount; // The Allocate calls (each one was a heap allocation without the arena).
+	size_t allocatedBytes;
+	size_t blocksCount; // The heap allocations of the arena (the blocks and the big allocations).
+	size_t reservedBytes; // Their bytes.
+};
+
+class MonotonicArena
+{
+public:
+	explicit MonotonicArena(size_t firstBlockSize = 4096);
+	~MonotonicArena();
+
+	MonotonicArena(const MonotonicArena&) = delete;
+	MonotonicArena& operator=(const MonotonicArena&) = delete;
+
+	// @alignment is a power of 2.
+	void* Allocate(size_t bytes, size_t alignment);
+	// Frees only a big allocation, the others are freed with the arena.
+	void Deallocate(void* p, size_t bytes);
+
+	ArenaStats GetStats() const;
+private:
+	// Makes a block with at least @bytes free bytes the current one.
+	void AddBlock(size_t bytes);
+
+	std::vector<char*> Blocks;
+	std::unordered_set<void*> LargeBlocks;
+	char* Current; // The free part of the last block is [Current, End).
+	char* End;
+	size_t NextBlockSize;
+	ArenaStats Stats;
+};
+
+// An STL allocator which takes the memory from a MonotonicArena.
+template<typename T>
+class ArenaAllocator
+{
+public:
+	typedef T value_type;
+
+	ArenaAllocator(MonotonicArena& arena) noexcept : arena(&arena) {}
+
+	template<typename U>
+	ArenaAllocator(const ArenaAllocator<U>& other) noexcept : arena(other.arena) {}
+
+	T* allocate(size_t n)
+	{
+		return static_cast<T*>(arena->Allocate(n * sizeof(T), alignof(T)));
+	}
+
+	void deallocate(T* p, size_t n) noexcept
+	{
+		arena->Deallocate(p, n * sizeof(T));
+	}
+
+	template<typename U>
+	bool operator==(const ArenaAllocator<U>& right) const noexcept
+	{
+		return arena == right.arena;
+	}
+
+	template<typename U>
+	bool operator!=(const ArenaAllocator<U>& right) const noexcept
+	{
+		return arena != right.arena;
+	}
+private:
+	template<typename U> friend class ArenaAllocator;
+
+	MonotonicArena* arena;
+};
+
+// The containers in an arena are constructed with it, e.g. ArenaVector<unsigned> v(arena).
+// Note: the nested ones need an arena too, e.g. ArenaVector<ArenaVector<unsigned>> v(n, ArenaVector<unsigned>(arena), arena).
+template<typename T>
+using ArenaVector = std::vector<T, ArenaAllocator<T>>;
+
+template<typename T, typename Hash = std::hash<T>>
+using ArenaUnorderedSet = std::unordered_set<T, Hash, std::equal_to<T>, ArenaAllocator<T>>;
+
+template<typename Key, typename Value, typename Hash = std::hash<Key>>
+using ArenaUnorderedMap = std::unordered_map<Key, Value, Hash, std::equal_to<Key>, ArenaAllocator<std::pair<const Key, Value>>>;
+
+template<typename Key, typename Value>
+using ArenaMap = std::map<Key, Value, std::less<Key>, ArenaAllocator<std::pair<const Key, Value>>>;
@@ -0,0 +1,449 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <thread>
+
+#include "Benchmarks.h"
+#include "CustomTestExecuter.h"
+#include "RegularFinalStateTransducerBuilder.h"
+#include "TestCaseGenerator.h"
+
+typedef std::chrono::steady_clock BenchmarkClock;
+
+enum BenchmarkPhase
+{
+	BUILD_PHASE,
+	REAL_TIME_PHASE,
+	FUNCTIONALITY_PHASE,
+	FREEZE_PHASE,
+	TRAVERSE_PHASE,
+	PHASES_COUNT,
+};
+
+static const char* const PHASE_NAMES[PHASES_COUNT] = { "build", "makeRealTime", "testForFunctionality", "freeze", "traverse" };
+
+// The phases which run with each of BenchmarkOptions::threadsCounts.
+enum BenchmarkScalingPhase
+{
+	TRAVERSE_PARALLEL_PHASE,
+	TWINS_PHASE,
+	SCALING_PHASES_COUNT,
+};
+
+static const char* const SCALING_PHASE_NAMES[SCALING_PHASES_COUNT] = { "traverseBatchParallel", "testForTwinsProperty" };
+
+static const unsigned BENCHMARK_MAX_TWINS_PAIR_STATES = 1000000; // As MakeSubsequential by default.
+
+// The words of the generated batch input, enough for many chunks of TraverseBatchParallel (the other inputs have a few words).
+static const unsigned BENCHMARK_BATCH_WORDS_COUNT = 20000;
+
+struct BenchmarkInput
+{
+	std::string name;
+	std::string regex;
+	std::vector<std::string> words;
+	std::vector<std::vector<Output>> expectedOutputs; // Empty if they are not known.
+};
+
+// What the last repetition found, the same for all repetitions of an input unless something is wrong.
+struct BenchmarkFacts
+{
+	bool realTime;
+	bool infinite;
+	bool functional;
+	unsigned statesCount; // Of the frozen transducer, 0 if it is not real-time.
+	unsigned transitionsCount;
+	size_t outputsCount; // Of all words.
+	size_t unexpectedOutputsCount; // The words which do not have the expected outputs.
+	TwinsPropertyResult twins; // With the first thread count (DoesNotHold if the twins test is not run).
+	size_t differentScalingResultsCount; // The runs of the scaling phases which did not find the same as the first thread count (or TraverseBatch).
+};
+
+struct BenchmarkResult
+{
+	BenchmarkInput input;
+	BenchmarkFacts facts;
+	bool sameFacts; // All repetitions found the same facts.
+	unsigned measuredRepetitions;
+	std::vector<double> seconds[PHASES_COUNT]; // The measured repetitions, a phase which was not run has none.
+	std::vector<std::vector<double>> scalingSeconds[SCALING_PHASES_COUNT]; // [i] has the measured repetitions with threadsCounts[i].
+};
+
+BenchmarkOptions GetDefaultBenchmarkOptions()
+{
+	BenchmarkOptions options;
+	options.warmups = 1;
+	options.repetitions = 5;
+	options.maxSecondsPerInput = 60;
+	options.withGeneratedInputs = true;
+	options.threadsCounts = { 1, 2, 4, 8 };
+	return options;
+}
+
+std::vector<std::string> GetBundledBenchmarkInputs()
+{
+	return {
+		"test1.txt",
+		"test100UnionWordsWithIncrOuts.txt",
+		"test250UnionWordsWithIncrOuts.txt",
+		"test500UnionWordsWithIncrOuts.txt",
+		"test2000ConcatWordsWithIncrOuts.txt",
+		"N.txt",
+		"N1.txt",
+		"N2.txt",
+		"N3.txt",
+	};
+}
+
+template<typename F>
+static double MeasureSeconds(F f)
+{
+	const auto start = BenchmarkClock::now();
+	f();
+	const auto end = BenchmarkClock::now();
+	return std::chrono::duration<double>(end - start).count();
+}
+
+// Runs all phases on a new transducer, @seconds[phase] (@scalingSeconds[phase][i] with @threadsCounts[i]) is negative for a phase which is not run.
+static void RunPhases(const BenchmarkInput& input, const std::vector<unsigned>& threadsCounts, double seconds[PHASES_COUNT],
+	std::vector<double> scalingSeconds[SCALING_PHASES_COUNT], BenchmarkFacts& facts)
+{
+	std::fill(seconds, seconds + PHASES_COUNT, -1.0);
+	for (auto phase = 0; phase < SCALING_PHASES_COUNT; ++phase)
+	{
+		scalingSeconds[phase].assign(threadsCounts.size(), -1.0);
+	}
+
+	// The builder owns the transducer, so it is created outside of the measured lambda and built in it.
+	std::unique_ptr<RegularFinalStateTransducerBuilder> builder;
+	seconds[BUILD_PHASE] = MeasureSeconds([&]() { builder.reset(new RegularFinalStateTransducerBuilder(input.regex.c_str())); });
+	auto transducer = builder->GetBuildedTransducer();
+
+	seconds[REAL_TIME_PHASE] = MeasureSeconds([&]()
+	{
+		facts.infinite = transducer->MakeRealTime();
+		transducer->UpdateRecognizingEmptyWord();
+	});
+	facts.realTime = transducer->IsRealTime();
+
+	seconds[FUNCTIONALITY_PHASE] = MeasureSeconds([&]() { facts.functional = transducer->TestForFunctionality(); });
+
+	facts.statesCount = facts.transitionsCount = 0;
+	if (facts.realTime)
+	{
+		seconds[FREEZE_PHASE] = MeasureSeconds([&]() { transducer->Freeze(); });
+		const auto info = transducer->GetFrozenInfo();
+		facts.statesCount = info.statesCount;
+		facts.transitionsCount = info.transitionsCount;
+	}
+
+	TraverseBatchResult result;
+	seconds[TRAVERSE_PHASE] = MeasureSeconds([&]() { transducer->TraverseBatch(input.words, result); });
+	facts.outputsCount = result.Outputs.size();
+	facts.unexpectedOutputsCount = 0;
+	for (size_t i = 0; i < input.expectedOutputs.size(); ++i)
+	{
+		facts.unexpectedOutputsCount += !HasExpectedOutputs(result, i, input.expectedOutputs[i]);
+	}
+
+	facts.differentScalingResultsCount = 0;
+	TraverseBatchResult parallelResult;
+	for (size_t i = 0; i < threadsCounts.size(); ++i)
+	{
+		scalingSeconds[TRAVERSE_PARALLEL_PHASE][i] = MeasureSeconds([&]() { transducer->TraverseBatchParallel(input.words, parallelResult, threadsCounts[i]); });
+		facts.differentScalingResultsCount += parallelResult.Offsets != result.Offsets || parallelResult.Outputs != result.Outputs;
+	}
+
+	facts.twins = TwinsPropertyResult::DoesNotHold;
+	for (size_t i = 0; i < threadsCounts.size() && facts.realTime && !facts.infinite; ++i)
+	{
+		TwinsPropertyResult twins;
+		scalingSeconds[TWINS_PHASE][i] = MeasureSeconds([&]() { twins = transducer->TestForTwinsProperty(BENCHMARK_MAX_TWINS_PAIR_STATES, threadsCounts[i]); });
+		if (i == 0)
+		{
+			facts.twins = twins;
+		}
+		facts.differentScalingResultsCount += twins != facts.twins;
+	}
+}
+
+static bool operator==(const BenchmarkFacts& l, const BenchmarkFacts& r)
+{
+	return l.realTime == r.realTime && l.infinite == r.infinite && l.functional == r.functional &&
+		l.statesCount == r.statesCount && l.transitionsCount == r.transitionsCount && l.outputsCount == r.outputsCount &&
+		l.unexpectedOutputsCount == r.unexpectedOutputsCount && l.twins == r.twins && l.differentScalingResultsCount == r.differentScalingResultsCount;
+}
+
+static BenchmarkResult RunBenchmark(const BenchmarkInput& input, const BenchmarkOptions& options)
+{
+	BenchmarkResult result;
+	result.input = input;
+	result.sameFacts = true;
+	result.measuredRepetitions = 0;
+	for (auto phase = 0; phase < SCALING_PHASES_COUNT; ++phase)
+	{
+		result.scalingSeconds[phase].resize(options.threadsCounts.size());
+	}
+
+	double seconds[PHASES_COUNT];
+	std::vector<double> scalingSeconds[SCALING_PHASES_COUNT];
+	BenchmarkFacts facts;
+	for (auto i = 0u; i < options.warmups; ++i)
+	{
+		RunPhases(input, options.threadsCounts, seconds, scalingSeconds, facts);
+	}
+
+	const auto start = BenchmarkClock::now();
+	while (result.measuredRepetitions < options.repetitions && (result.measuredRepetitions == 0 ||
+		std::chrono::duration<double>(BenchmarkClock::now() - start).count() < options.maxSecondsPerInput))
+	{
+		RunPhases(input, options.threadsCounts, seconds, scalingSeconds, facts);
+		if (result.measuredRepetitions != 0 && !(facts == result.facts))
+		{
+			result.sameFacts = false;
+		}
+		result.facts = facts;
+		++result.measuredRepetitions;
+
+		for (auto phase = 0; phase < PHASES_COUNT; ++phase)
+		{
+			if (seconds[phase] >= 0)
+			{
+				result.seconds[phase].push_back(seconds[phase]);
+			}
+		}
+		for (auto phase = 0; phase < SCALING_PHASES_COUNT; ++phase)
+		{
+			for (size_t i = 0; i < scalingSeconds[phase].size(); ++i)
+			{
+				if (scalingSeconds[phase][i] >= 0)
+				{
+					result.scalingSeconds[phase][i].push_back(scalingSeconds[phase][i]);
+				}
+			}
+		}
+	}
+	return result;
+}
+
+// The nearest-rank percentile of the sorted @samples.
+static double GetPercentile(const std::vector<double>& samples, double percent)
+{
+	const auto rank = (size_t) std::ceil(percent / 100 * samples.size());
+	return samples[std::max<size_t>(rank, 1) - 1];
+}
+
+struct PhaseStatistics
+{
+	double min, mean, median, p90, max;
+};
+
+static PhaseStatistics GetStatistics(std::vector<double> samples)
+{
+	std::sort(samples.begin(), samples.end());
+	PhaseStatistics statistics;
+	statistics.min = samples.front();
+	statistics.max = samples.back();
+	statistics.median = GetPercentile(samples, 50);
+	statistics.p90 = GetPercentile(samples, 90);
+	double sum = 0;
+	for (auto s : samples)
+	{
+		sum += s;
+	}
+	statistics.mean = sum / samples.size();
+	return statistics;
+}
+
+static const char* GetTwinsName(TwinsPropertyResult twins)
+{
+	return twins == TwinsPropertyResult::Holds ? "holds" : twins == TwinsPropertyResult::DoesNotHold ? "doesNotHold" : "tooManyStates";
+}
+
+static void PrintPhase(const std::string& name, const std::vector<double>& samples)
+{
+	const auto statistics = GetStatistics(samples);
+	std::cout << "\t" << std::left << std::setw(26) << name << std::right << std::fixed << std::setprecision(1);
+	for (auto value : { statistics.min, statistics.mean, statistics.median, statistics.p90, statistics.max })
+	{
+		std::cout << std::setw(14) << value * 1e6;
+	}
+	std::cout << std::defaultfloat << "\n";
+}
+
+static void PrintResult(const BenchmarkResult& result, const BenchmarkOptions& options)
+{
+	const auto& facts = result.facts;
+	std::cout << "\t" << result.measuredRepetitions << " repetitions, " << (facts.realTime ? "real-time" : "not real-time") << ", "
+		<< (facts.infinite ? "infinite" : "not infinite") << ", " << (facts.functional ? "functional" : "not functional")
+		<< ", " << facts.statesCount << " states, " << facts.transitionsCount << " transitions, " << facts.outputsCount << " outputs"
+		<< ", twins property " << GetTwinsName(facts.twins) << ".\n";
+	if (facts.unexpectedOutputsCount != 0)
+	{
+		std::cout << "\t***" << facts.unexpectedOutputsCount << " of the words do not have the expected outputs.\n";
+	}
+	if (facts.differentScalingResultsCount != 0)
+	{
+		std::cout << "\t***" << facts.differentScalingResultsCount << " of the runs with more threads did not find the same.\n";
+	}
+	if (!result.sameFacts)
+	{
+		std::cout << "\t***The repetitions did not find the same.\n";
+	}
+
+	std::cout << "\t" << std::left << std::setw(26) << "phase (us)" << std::right;
+	for (auto column : { "min", "mean", "median", "p90", "max" })
+	{
+		std::cout << std::setw(14) << column;
+	}
+	std::cout << "\n";
+	for (auto phase = 0; phase < PHASES_COUNT; ++phase)
+	{
+		if (!result.seconds[phase].empty())
+		{
+			PrintPhase(PHASE_NAMES[phase], result.seconds[phase]);
+		}
+	}
+	for (auto phase = 0; phase < SCALING_PHASES_COUNT; ++phase)
+	{
+		for (size_t i = 0; i < result.scalingSeconds[phase].size(); ++i)
+		{
+			if (!result.scalingSeconds[phase][i].empty())
+			{
+				PrintPhase(std::string(SCALING_PHASE_NAMES[phase]) + " x" + std::to_string(options.threadsCounts[i]), result.scalingSeconds[phase][i]);
+			}
+		}
+	}
+}
+
+// Writes the entry of a phase of @result which ran on @threadsCount threads.
+static void WriteJsonEntry(std::ostream& f, const BenchmarkResult& result, const char* phase, unsigned threadsCount, const std::vector<double>& samples)
+{
+	const auto& facts = result.facts;
+	const auto statistics = GetStatistics(samples);
+	f << "    {\"input\": \"" << EscapeJson(result.input.name) << "\", \"phase\": \"" << phase << "\", \"threads\": " << threadsCount
+		<< ", \"regexLength\": " << result.input.regex.size() << ", \"wordsCount\": " << result.input.words.size()
+		<< ", \"realTime\": " << (facts.realTime ? "true" : "false") << ", \"infinite\": " << (facts.infinite ? "true" : "false")
+		<< ", \"functional\": " << (facts.functional ? "true" : "false") << ", \"statesCount\": " << facts.statesCount
+		<< ", \"transitionsCount\": " << facts.transitionsCount << ", \"outputsCount\": " << facts.outputsCount
+		<< ", \"checkedWordsCount\": " << result.input.expectedOutputs.size() << ", \"unexpectedOutputsCount\": " << facts.unexpectedOutputsCount
+		<< ", \"twinsProperty\": \"" << GetTwinsName(facts.twins) << "\", \"differentScalingResultsCount\": " << facts.differentScalingResultsCount
+		<< ", \"sameFacts\": " << (result.sameFacts ? "true" : "false") << ", \"repetitions\": " << samples.size()
+		<< ", \"min\": " << statistics.min << ", \"mean\": " << statistics.mean << ", \"median\": " << statistics.median
+		<< ", \"p90\": " << statistics.p90 << ", \"max\": " << statistics.max << ", \"samples\": [";
+	for (size_t i = 0; i < samples.size(); ++i)
+	{
+		f << (i ? ", " : "") << samples[i];
+	}
+	f << "]}";
+}
+
+static bool WriteJson(const std::vector<BenchmarkResult>& results, const BenchmarkOptions& options)
+{
+	std::ofstream f(options.jsonFileName);
+	if (!f)
+	{
+		return false;
+	}
+
+	f << std::setprecision(9);
+	f << "{\n";
+	f << "  \"context\": {\n";
+	f << "    \"clock\": \"steady_clock\",\n";
+	f << "    \"timeUnit\": \"s\",\n";
+#if defined(NDEBUG)
+	f << "    \"build\": \"release\",\n";
+#else
+	f << "    \"build\": \"debug\",\n";
+#endif
+	f << "    \"outputBits\": " << sizeof(Output) * 8 << ",\n";
+	f << "    \"hardwareThreads\": " << std::thread::hardware_concurrency() << ",\n";
+	f << "    \"warmups\": " << options.warmups << ",\n";
+	f << "    \"repetitions\": " << options.repetitions << ",\n";
+	f << "    \"maxSecondsPerInput\": " << options.maxSecondsPerInput << ",\n";
+	f << "    \"threadsCounts\": [";
+	for (size_t i = 0; i < options.threadsCounts.size(); ++i)
+	{
+		f << (i ? ", " : "") << options.threadsCounts[i];
+	}
+	f << "]\n";
+	f << "  },\n";
+	f << "  \"benchmarks\": [";
+	bool first = true;
+	for (const auto& result : results)
+	{
+		for (auto phase = 0; phase < PHASES_COUNT; ++phase)
+		{
+			if (!result.seconds[phase].empty())
+			{
+				f << (first ? "\n" : ",\n");
+				first = false;
+				WriteJsonEntry(f, result, PHASE_NAMES[phase], 1, result.seconds[phase]);
+			}
+		}
+		for (auto phase = 0; phase < SCALING_PHASES_COUNT; ++phase)
+		{
+			for (size_t i = 0; i < result.scalingSeconds[phase].size(); ++i)
+			{
+				if (!result.scalingSeconds[phase][i].empty())
+				{
+					f << (first ? "\n" : ",\n");
+					first = false;
+					WriteJsonEntry(f, result, SCALING_PHASE_NAMES[phase], options.threadsCounts[i], result.scalingSeconds[phase][i]);
+				}
+			}
+		}
+	}
+	f << "\n  ]\n";
+	f << "}\n";
+	return (bool) f;
+}
+
+bool RunBenchmarks(const std::vector<std::string>& fileNames, const BenchmarkOptions& options)
+{
+	bool succeeded = true;
+	std::vector<BenchmarkInput> inputs;
+	for (const auto& fileName : fileNames)
+	{
+		BenchmarkInput input;
+		input.name = fileName;
+		if (!ReadCustomTestFile(fileName, input.regex, input.words, &input.expectedOutputs))
+		{
+			std::cout << "***Can not read \"" << fileName << "\".\n";
+			succeeded = false;
+			continue;
+		}
+		inputs.push_back(input);
+	}
+	if (options.withGeneratedInputs)
+	{
+		for (const auto& test : GenerateScalingSuite())
+		{
+			inputs.push_back(BenchmarkInput{ "generated " + test.name, test.regex, test.words, test.expectedOutputs });
+		}
+		const auto batch = GenerateLargeAlphabet(64, 500, 6, BENCHMARK_BATCH_WORDS_COUNT, 64); // A star, so the words can be different.
+		inputs.push_back(BenchmarkInput{ "generated " + batch.name + "_batch", batch.regex, batch.words, batch.expectedOutputs });
+	}
+
+	std::vector<BenchmarkResult> results;
+	for (const auto& input : inputs)
+	{
+		std::cout << "Benchmarking " << input.name << " (" << options.warmups << " warmups, " << options.repetitions << " repetitions)...\n";
+		results.push_back(RunBenchmark(input, options));
+		PrintResult(results.back(), options);
+		succeeded = succeeded && results.back().facts.unexpectedOutputsCount == 0 && results.back().facts.differentScalingResultsCount == 0;
+	}
+
+	if (!options.jsonFileName.empty())
+	{
+		const bool written = WriteJson(results, options);
+		std::cout << (written ? "---Written " : "***Can not write ") << "\"" << options.jsonFileName << "\".\n";
+		succeeded = succeeded && written;
+	}
+	return succeeded;
+}
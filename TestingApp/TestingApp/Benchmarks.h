@@ -0,0 +1,40 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+/*
+	Benchmarks of the phases of ExecuteCustomTestFromFile: building the transducer from the regex, MakeRealTime (with
+	UpdateRecognizingEmptyWord), TestForFunctionality, Freeze and traversing the words of the input in one batch.
+	Each repetition runs all phases on a new transducer (they change it), each phase is timed with steady_clock.
+	The warmup repetitions are not measured. For each phase the min, mean, median, 90th percentile and max are printed
+	and optionally written as JSON, so two runs (e.g. before and after a change) can be compared by a script.
+
+	The scaling phases run after them with each of the thread counts, so the speedup of the parallel code can be checked:
+	TraverseBatchParallel of the same words (it has to find the same outputs as TraverseBatch, the generated inputs
+	have a batch of many words for it, the others have too few words for more than one thread) and
+	TestForTwinsProperty (on the real-time transducers which are not infinite, BuildPairStatesGraph is the parallel part).
+	Each thread count has to find the same as the first one.
+
+	The inputs are files in the CustomTestExecuter format and, if asked, the tests of GenerateScalingSuite.
+	The outputs of the words with expected outputs are checked.
+*/
+
+struct BenchmarkOptions
+{
+	unsigned warmups;
+	unsigned repetitions;
+	double maxSecondsPerInput; // No more repetitions of an input after that much time (but at least one is measured).
+	bool withGeneratedInputs;
+	std::string jsonFileName; // Empty for no JSON.
+	std::vector<unsigned> threadsCounts; // Of the scaling phases (0 means as many as the hardware supports), empty for none.
+};
+
+BenchmarkOptions GetDefaultBenchmarkOptions();
+
+// The test*.txt and N*.txt files next to the sources.
+std::vector<std::string> GetBundledBenchmarkInputs();
+
+// Returns false if some of the files could not be read (the others are still measured), some of the words do not have
+// the expected outputs or the JSON could not be written.
+bool RunBenchmarks(const std::vector<std::string>& fileNames, const BenchmarkOptions& options);
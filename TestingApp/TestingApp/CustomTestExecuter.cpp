@@ -1,28 +1,174 @@
 #include <fstream>
 #include <streambuf>
-#include <stdlib.h> // atoi
+#include <stdlib.h> // atoi, strtoull
+#include <algorithm>
 #include <unordered_set>
+#include <vector>
 
 #include <chrono>
+#include <cstdio>
 #include <ctime>
 
 #include "CustomTestExecuter.h"
 #include "RegularFinalStateTransducerBuilder.h"
+#include "MappedTransducer.h"
+#include "Trace.h"
 
 void PrintTime(std::chrono::duration<double> d)
 {
 	std::cout << "\t\t(elapsed time: " << d.count() << "s)\n";
 }
 
-void ExecuteCustomTestFromFile(std::string& fileName)
+bool ReadCustomTestFile(const std::string& fileName, std::string& regex, std::vector<std::string>& words,
+	std::vector<std::vector<Output>>* expectedOutputs)
 {
-	std::string regex;
-
 	std::ifstream f(fileName);
+	if (!f)
+	{
+		return false;
+	}
 
 	getline(f, regex);
 
+	std::string numberOfWordsForTraversingFileLine;
+	getline(f, numberOfWordsForTraversingFileLine);
+	unsigned numberOfWordsForTraversing = atoi(numberOfWordsForTraversingFileLine.c_str());
+
+	words.assign(numberOfWordsForTraversing, std::string{});
+	for (auto& word : words)
+	{
+		getline(f, word);
+	}
+
+	std::string expectedOutputsLine;
+	if (expectedOutputs && getline(f, expectedOutputsLine) && expectedOutputsLine == "Expected outputs:")
+	{
+		expectedOutputs->assign(words.size(), std::vector<Output>{});
+		for (auto& outputs : *expectedOutputs)
+		{
+			getline(f, expectedOutputsLine);
+			for (auto p = expectedOutputsLine.c_str(); *p; )
+			{
+				char* end;
+				const auto output = (Output) strtoull(p, &end, 10);
+				if (end == p)
+				{
+					break;
+				}
+				outputs.push_back(output);
+				p = end;
+			}
+		}
+	}
+	else if (expectedOutputs)
+	{
+		expectedOutputs->clear();
+	}
+	return true;
+}
+
+bool HasExpectedOutputs(const TraverseBatchResult& result, size_t i, const std::vector<Output>& expected)
+{
+	return result.Offsets[i + 1] - result.Offsets[i] == expected.size() &&
+		std::equal(expected.begin(), expected.end(), result.Outputs.begin() + result.Offsets[i]);
+}
+
+std::string EscapeJson(const std::string& s)
+{
+	std::string escaped;
+	for (auto c : s)
+	{
+		if (c == '"' || c == '\\')
+		{
+			escaped += '\\';
+			escaped += c;
+		}
+		else if ((unsigned char) c < 0x20)
+		{
+			char code[8];
+			snprintf(code, sizeof(code), "\\u%04x", (unsigned) c);
+			escaped += code;
+		}
+		else
+		{
+			escaped += c;
+		}
+	}
+	return escaped;
+}
+
+static void WriteStageSizesJson(std::ostream& f, const char* name, const StageSizes& sizes)
+{
+	f << "  \"" << name << "\": {\"states\": " << sizes.statesCount << ", \"transitions\": " << sizes.transitionsCount
+		<< ", \"epsilonTransitions\": " << sizes.epsilonTransitionsCount << ", \"upperEpsilonTransitions\": " << sizes.upperEpsilonTransitionsCount
+		<< ", \"labels\": " << sizes.labelsCount << "},\n";
+}
+
+static void WriteClosureStatsJson(std::ostream& f, const char* name, const ClosureStats& stats)
+{
+	f << "  \"" << name << "\": {\"states\": " << stats.statesCount << ", \"pairs\": " << stats.pairsCount
+		<< ", \"maxPairsOfState\": " << stats.maxPairsOfState << "},\n";
+}
+
+static void WriteArenaStatsJson(std::ostream& f, const char* name, const ArenaStats& stats)
+{
+	f << "  \"" << name << "\": {\"allocations\": " << stats.allocationsCount << ", \"allocatedBytes\": " << stats.allocatedBytes
+		<< ", \"blocks\": " << stats.blocksCount << ", \"reservedBytes\": " << stats.reservedBytes << "},\n";
+}
+
+bool WriteStatsJson(const std::string& fileName, const TransducerStats& stats)
+{
+	std::ofstream f(fileName);
+	if (!f)
+	{
+		return false;
+	}
+
+	f << "{\n";
+	WriteStageSizesJson(f, "built", stats.built);
+	WriteStageSizesJson(f, "afterRemoveEpsilon", stats.afterRemoveEpsilon);
+	WriteStageSizesJson(f, "afterExpand", stats.afterExpand);
+	WriteStageSizesJson(f, "afterRemoveUpperEpsilon", stats.afterRemoveUpperEpsilon);
+	f << "  \"builtTransitionsPerLabel\": {";
+	bool first = true;
+	for (const auto& label : stats.builtTransitionsPerLabel)
+	{
+		f << (first ? "" : ", ") << "\"" << EscapeJson(label.first) << "\": " << label.second;
+		first = false;
+	}
+	f << "},\n";
+	WriteClosureStatsJson(f, "epsilonClosure", stats.epsilonClosure);
+	WriteClosureStatsJson(f, "upperEpsilonClosure", stats.upperEpsilonClosure);
+	WriteArenaStatsJson(f, "realTimeAllocations", stats.realTimeAllocations);
+	f << "  \"functionalityPairStates\": " << stats.functionalityPairStatesCount << ",\n";
+	f << "  \"functionalityPairTransitions\": " << stats.functionalityPairTransitionsCount << ",\n";
+	f << "  \"coReachabilitySearches\": " << stats.coReachabilitySearchesCount << ",\n";
+	f << "  \"coReachabilityPairStates\": " << stats.coReachabilityPairStatesCount << ",\n";
+	WriteArenaStatsJson(f, "functionalityAllocations", stats.functionalityAllocations);
+	f << "  \"twinsPairStates\": " << stats.twinsPairStatesCount << ",\n";
+	f << "  \"traversedWords\": " << stats.traversedWordsCount << ",\n";
+	f << "  \"frontierSizes\": [";
+	for (size_t d = 0; d < stats.frontierSizes.size(); ++d)
+	{
+		f << (d ? ", " : "") << stats.frontierSizes[d];
+	}
+	f << "],\n";
+	f << "  \"maxFrontierSize\": " << stats.maxFrontierSize << "\n";
+	f << "}\n";
+	return !!f;
+}
+
+void ExecuteCustomTestFromFile(std::string& fileName)
+{
+	std::string regex;
+	std::vector<std::string> words;
+	std::vector<std::vector<Output>> expectedOutputs;
+	ReadCustomTestFile(fileName, regex, words, &expectedOutputs);
+
 	std::cout << "Regex is: \"" << regex << "\"\n";
+#if defined(TRACE)
+	StartTrace();
+#endif
 
 	std::cout << "Building the transducer...\n";
 
@@ -60,35 +206,102 @@ void ExecuteCustomTestFromFile(std::string& fileName)
 	
 	std::cout << "\tFST is " << (functional ? "functional" : "not functional") << ".\n";
 
-	std::string numberOfWordsForTraversingFileLine;
-	getline(f, numberOfWordsForTraversingFileLine);
-	unsigned numberOfWordsForTraversing = atoi(numberOfWordsForTraversingFileLine.c_str());
+	if (functional)
+	{
+		std::cout << "Making it subsequential...\n";
 
-	std::cout << "Traversing the following " << numberOfWordsForTraversing << " words:\n";
+		auto startSubsequential = std::chrono::system_clock::now();
+		bool subsequential = transducer->MakeSubsequential();
+		auto endSubsequential = std::chrono::system_clock::now();
+		std::chrono::duration<double> subsequentialTime = endSubsequential - startSubsequential;
+		totalTimeTaken += subsequentialTime;
+		PrintTime(subsequentialTime);
 
-	for (auto i = 1u; i <= numberOfWordsForTraversing; ++i)
+		std::cout << "\tFST is " << (subsequential ? "subsequential" : "not subsequential") << ".\n";
+	}
+
+	if (transducer->IsRealTime())
 	{
-		std::string word;
+		std::cout << "Freezing the real-time transducer...\n";
 
-		getline(f, word);
-		std::cout << "\t\"" << word << "\"";
+		auto startFreezing = std::chrono::system_clock::now();
+		transducer->Freeze();
+		auto endFreezing = std::chrono::system_clock::now();
+		std::chrono::duration<double> freezingTime = endFreezing - startFreezing;
+		totalTimeTaken += freezingTime;
+		PrintTime(freezingTime);
+
+		const auto info = transducer->GetFrozenInfo();
+		std::cout << "\tFrozen FST has " << info.statesCount << " states and " << info.transitionsCount << " transitions ("
+			<< info.transitionsBytes << " bytes).\n";
+		std::cout << "\tSymbol index: " << info.denseStatesCount << " dense and " << info.compressedStatesCount << " compressed states ("
+			<< info.symbolIndexBytes << " bytes, all dense would be " << info.allDenseSymbolIndexBytes << " bytes).\n";
+
+		// What a process which uses the saved file does instead of all of the above.
+		const auto mappedFileName = fileName + ".fst";
+		std::cout << "Saving it to \"" << mappedFileName << "\" and mapping it...\n";
+
+		auto startMapping = std::chrono::system_clock::now();
+		MappedTransducer mapped;
+		const bool isMapped = transducer->SaveFrozen(mappedFileName.c_str()) && mapped.Open(mappedFileName.c_str());
+		auto endMapping = std::chrono::system_clock::now();
+		PrintTime(endMapping - startMapping);
+
+		std::cout << "\tFST is " << (isMapped ? "mapped" : "not mapped") << ".\n";
+	}
 
-		std::unordered_set<unsigned> outputs;
+	std::cout << "Traversing the following " << words.size() << " words (in one batch):\n";
 
-		auto start = std::chrono::system_clock::now();
-		transducer->TraverseWithWord(word.c_str(), outputs);
-		auto end = std::chrono::system_clock::now();
-		std::chrono::duration<double> elapsedTraversingTime = end - start;
-		totalTimeTaken += elapsedTraversingTime;
+	TraverseBatchResult result;
+	auto start = std::chrono::system_clock::now();
+	transducer->TraverseBatch(words, result);
+	auto end = std::chrono::system_clock::now();
+	std::chrono::duration<double> elapsedTraversingTime = end - start;
+	totalTimeTaken += elapsedTraversingTime;
+	PrintTime(elapsedTraversingTime);
 
-		std::cout << " : ";
-		for (const auto& expectedOutput : outputs)
+	size_t unexpectedOutputsCount = 0;
+	for (size_t i = 0; i < words.size(); ++i)
+	{
+		std::cout << "\t\"" << words[i] << "\" : ";
+		for (auto k = result.Offsets[i]; k < result.Offsets[i + 1]; ++k)
+		{
+			std::cout << result.Outputs[k] << " ";
+		}
+		if (!expectedOutputs.empty() && !HasExpectedOutputs(result, i, expectedOutputs[i]))
 		{
-			std::cout << expectedOutput << " ";
+			++unexpectedOutputsCount;
+			std::cout << "***expected: ";
+			for (auto output : expectedOutputs[i])
+			{
+				std::cout << output << " ";
+			}
 		}
-		PrintTime(elapsedTraversingTime);
 		std::cout << "\n";
 	}
+	if (!expectedOutputs.empty())
+	{
+		if (unexpectedOutputsCount == 0)
+		{
+			std::cout << "---All outputs are as expected.\n";
+		}
+		else
+		{
+			std::cout << "***" << unexpectedOutputsCount << " of the words do not have the expected outputs.\n";
+		}
+	}
+
+#if defined(TRACE)
+	StopTrace();
+	const auto traceFileName = fileName + ".trace.json";
+	const bool traceWritten = WriteTrace(traceFileName);
+	std::cout << (traceWritten ? "---Written the trace to " : "***Can not write the trace to ") << "\"" << traceFileName << "\".\n";
+#endif
+#if defined(COLLECT_STATS)
+	const auto statsFileName = fileName + ".stats.json";
+	const bool statsWritten = WriteStatsJson(statsFileName, transducer->GetStats());
+	std::cout << (statsWritten ? "---Written the stats to " : "***Can not write the stats to ") << "\"" << statsFileName << "\".\n";
+#endif
 
 	std::cout << "Total time taken: " << totalTimeTaken.count() << "s.\n";
 }
@@ -2,6 +2,8 @@
 
 #include <iostream>
 #include <string>
+#include <vector>
+#include "FinalStateTransducer.h"
 
 /* Reads the regex and the words for traversing from the passed file.
    Prints formated output with stats.
@@ -22,6 +24,32 @@
 	aaa
 
    (note that there is an empty line for the empty word)
+
+   The words might be followed by their expected outputs (as written by WriteCustomTestFile):
+   Expected outputs:
+   outputs_of_word1
+   ...
+   outputs_of_wordN
+   where each line has the sorted outputs separated by spaces (an empty line if the word is not recognized).
+   Then the outputs of the traversal are checked.
+
+   With COLLECT_STATS the stats of the transducer are written to fileName.stats.json and with TRACE
+   the timeline of all phases is written to fileName.trace.json (see Trace.h).
  */
 
-void ExecuteCustomTestFromFile(std::string& fileName);
\ No newline at end of file
+void ExecuteCustomTestFromFile(std::string& fileName);
+
+/*
+	Reads the regex and the words of a file in the format above. Returns false if the file can not be read.
+	@expectedOutputs (if passed) is empty if the file has no expected outputs.
+*/
+bool ReadCustomTestFile(const std::string& fileName, std::string& regex, std::vector<std::string>& words,
+	std::vector<std::vector<Output>>* expectedOutputs = nullptr);
+
+// Whether the outputs of the @i-th word of @result are @expected.
+bool HasExpectedOutputs(const TraverseBatchResult& result, size_t i, const std::vector<Output>& expected);
+
+std::string EscapeJson(const std::string& s);
+
+// Writes @stats (see TransducerStats) as JSON. Returns false if the file can not be written.
+bool WriteStatsJson(const std::string& fileName, const TransducerStats& stats);
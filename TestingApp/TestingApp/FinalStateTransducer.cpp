@@ -1,77 +1,176 @@
-#include <stdlib.h> // atoi
+#include <stdlib.h> // strtoull
 #include <iostream>
+#include <fstream>
+#include <cstring>
+#include <cstdint>
+#include <cstddef> // offsetof
 #include <deque>
 #include <unordered_set>
 #include <queue>
+#include <algorithm>
+#include <tuple>
+#include <bitset>
+#include <atomic>
+#include <thread>
+#include <map>
+#include <functional>
+#include <mutex>
 #include <boost/functional/hash.hpp>
 #include "FinalStateTransducer.h"
+#include "MappedTransducer.h"
 #include "AssertLog.h"
+#include "Trace.h"
 
-FinalStateTransducer::FinalStateTransducer(char* regExpr, int separator, int length) // The regular expression should be of type: 'word:number'
-	: RecognizingEmptyWord(false)
+FinalStateTransducer::FinalStateTransducer(char* regExpr, int separator, int length, std::shared_ptr<LabelTable> labels) // The regular expression should be of type: 'word:number'
+	: FinalStateTransducer(std::move(labels))
+{
+	auto word = AddWord(regExpr, separator, length);
+	SetStates(word);
+}
+
+FinalStateTransducer::FinalStateTransducer(std::shared_ptr<LabelTable> labels)
+	: Labels(labels ? std::move(labels) : std::make_shared<LabelTable>())
+	, RecognizingEmptyWord(false)
 	, Infinite(false)
 	, RealTime(false)
 	, Functional(false)
+	, IsFrozenDelta(false)
+	, IsSubsequentialDelta(false)
+	, Stats()
+{
+}
+
+TransducerFragment FinalStateTransducer::AddWord(char* regExpr, int separator, int length) // The regular expression should be of type: 'word:number'
 {
 	char* word = regExpr;
 	*(regExpr + separator) = '\0';
 	*(regExpr + length) = '\0';
 	const char* pOutputNumber = regExpr + separator + 1; // + ':'.
-	unsigned outputNumber = atoi(pOutputNumber);
+	Output outputNumber = (Output) strtoull(pOutputNumber, nullptr, 10);
 #if defined(INFO)
 		std::cout << "Creating a transducer for word \"" << word << "\" with output number " << outputNumber << std::endl; // Only info purposes.
 #endif
 	// Creating a transducer which accepts only the given word.
-	Delta.resize(2);
+	const auto startState = (unsigned) Delta.size();
+	Delta.resize(startState + 2);
 
-	Delta[0][word].insert(Transition{ 1, outputNumber }); // One transition: 0 -> 1 via word @word and output @outputNumber.
-	FinalStates.insert(1); // 1 is a final state.
-	InitialStates.insert(0); // q0 which is 0 is the initial state
+	Delta[startState][Labels->Intern(word, separator)].insert(Transition{ startState + 1, outputNumber }); // One transition: start -> start + 1 via word @word and output @outputNumber.
+
+	TransducerFragment fragment;
+	fragment.FinalStates.insert(startState + 1); // start + 1 is a final state.
+	fragment.InitialStates.insert(startState); // start is the initial state
+	return fragment;
 }
 
 void FinalStateTransducer::CloseStar()
 {
-	ClosePlus();
-	FinalStates.clear();
-	FinalStates.insert((unsigned) Delta.size() - 1); // Add the new state as a final,
+	auto whole = TakeStates();
+	CloseStar(whole);
+	SetStates(whole);
 }
 
 void FinalStateTransducer::ClosePlus()
 {
-	// Make a new state with no transitions.
-	Delta.push_back(StateTransitions());
-	unsigned newStateIndex = (unsigned) Delta.size() - 1;
-
-	for (const auto& finalStateIndex : FinalStates)
-	{
-		Delta[finalStateIndex][""].insert(Transition{ newStateIndex, 0 }); // Add "finalState --e:0--> newState" transition
-	}
-
-	MakeSingleInitialState(newStateIndex);
+	auto whole = TakeStates();
+	ClosePlus(whole);
+	SetStates(whole);
 }
 
 void FinalStateTransducer::Concat(FinalStateTransducer& right)
 {
+	right.UseLabels(Labels);
 	right.Remap((unsigned) Delta.size());
 
 	Delta.insert(Delta.end(),
 		std::make_move_iterator(right.Delta.begin()),
 		std::make_move_iterator(right.Delta.end()));
 
-	for (auto& leftFinalStateIndex : FinalStates)
+	auto whole = TakeStates();
+	auto rightWhole = right.TakeStates();
+	Concat(whole, rightWhole);
+	SetStates(whole);
+}
+
+void FinalStateTransducer::CloseStar(TransducerFragment& fragment)
+{
+	ClosePlus(fragment);
+	fragment.FinalStates.clear();
+	fragment.FinalStates.insert((unsigned) Delta.size() - 1); // Add the new state as a final,
+}
+
+void FinalStateTransducer::ClosePlus(TransducerFragment& fragment)
+{
+	// Make a new state with no transitions.
+	Delta.push_back(StateTransitions());
+	unsigned newStateIndex = (unsigned) Delta.size() - 1;
+
+	for (const auto& finalStateIndex : fragment.FinalStates)
+	{
+		Delta[finalStateIndex][EPSILON_LABEL].insert(Transition{ newStateIndex, 0 }); // Add "finalState --e:0--> newState" transition
+	}
+
+	// Make the new state to be the only initial one.
+	for (const auto& initialStateIndex : fragment.InitialStates)
+	{
+		Delta[newStateIndex][EPSILON_LABEL].insert(Transition{ initialStateIndex, 0 }); // Add "newState --e:0--> initialState" transition
+	}
+
+	fragment.InitialStates.clear();
+	fragment.InitialStates.insert(newStateIndex);
+}
+
+void FinalStateTransducer::Concat(TransducerFragment& left, TransducerFragment& right)
+{
+	for (auto& leftFinalStateIndex : left.FinalStates)
 	{
 		for (auto& rightInitialStateIndex : right.InitialStates)
 		{
-			Delta[leftFinalStateIndex][""].insert(Transition{ rightInitialStateIndex, 0 });
+			Delta[leftFinalStateIndex][EPSILON_LABEL].insert(Transition{ rightInitialStateIndex, 0 });
 		}
 	}
 
+	left.FinalStates.clear();
+	left.FinalStates.swap(right.FinalStates);
+	right.InitialStates.clear();
+}
+
+void FinalStateTransducer::Union(TransducerFragment& left, TransducerFragment& right)
+{
+	// Moves the smaller set into the bigger one, so a long chain of unions (in any order) is not quadratic.
+	if (left.InitialStates.size() < right.InitialStates.size())
+	{
+		left.InitialStates.swap(right.InitialStates);
+	}
+	left.InitialStates.insert(right.InitialStates.begin(), right.InitialStates.end());
+	right.InitialStates.clear();
+
+	if (left.FinalStates.size() < right.FinalStates.size())
+	{
+		left.FinalStates.swap(right.FinalStates);
+	}
+	left.FinalStates.insert(right.FinalStates.begin(), right.FinalStates.end());
+	right.FinalStates.clear();
+}
+
+void FinalStateTransducer::SetStates(TransducerFragment& fragment)
+{
+	InitialStates = std::move(fragment.InitialStates);
+	FinalStates = std::move(fragment.FinalStates);
+}
+
+TransducerFragment FinalStateTransducer::TakeStates()
+{
+	TransducerFragment whole;
+	whole.InitialStates = std::move(InitialStates);
+	whole.FinalStates = std::move(FinalStates);
+	InitialStates.clear(); // A moved-from set is valid but unspecified.
 	FinalStates.clear();
-	FinalStates.swap(right.FinalStates);
+	return whole;
 }
 
 void FinalStateTransducer::Union(FinalStateTransducer& right)
 {
+	right.UseLabels(Labels);
 	unsigned offset = (unsigned) Delta.size();
 	right.RemapDelta(offset);
 
@@ -148,7 +247,7 @@ void FinalStateTransducer::MakeSingleInitialState(unsigned newInitialStateIndex)
 {
 	for (const auto& initialStateIndex : InitialStates)
 	{
-		Delta[newInitialStateIndex][""].insert(Transition{ initialStateIndex, 0 }); // Add "newState --e:0--> initialState" transition
+		Delta[newInitialStateIndex][EPSILON_LABEL].insert(Transition{ initialStateIndex, 0 }); // Add "newState --e:0--> initialState" transition
 	}
 
 	// Make the new state to be the initial one.
@@ -156,10 +255,94 @@ void FinalStateTransducer::MakeSingleInitialState(unsigned newInitialStateIndex)
 	InitialStates.insert(newInitialStateIndex);
 }
 
-void FinalStateTransducer::Expand()
+void FinalStateTransducer::UseLabels(const std::shared_ptr<LabelTable>& labels)
+{
+	if (Labels == labels)
+	{
+		return;
+	}
+
+	for (auto& state : Delta)
+	{
+		StateTransitions relabeled;
+		for (auto& transitions : state)
+		{
+			const auto label = labels->Intern(Labels->Word(transitions.first), Labels->Length(transitions.first));
+			relabeled[label] = std::move(transitions.second);
+		}
+		state = std::move(relabeled);
+	}
+	Labels = labels;
+}
+
+const TransducerStats& FinalStateTransducer::GetStats() const
+{
+	return Stats;
+}
+
+void FinalStateTransducer::ResetStats()
+{
+	Stats = TransducerStats();
+}
+
+StageSizes FinalStateTransducer::GetStageSizes() const
+{
+	StageSizes sizes = StageSizes();
+	sizes.statesCount = Delta.size();
+	std::unordered_set<unsigned> labels;
+	for (const auto& state : Delta)
+	{
+		for (const auto& transitions : state)
+		{
+			sizes.transitionsCount += transitions.second.size();
+			if (transitions.first == EPSILON_LABEL)
+			{
+				sizes.epsilonTransitionsCount += transitions.second.size();
+				for (const auto& transition : transitions.second)
+				{
+					if (transition.output != 0)
+					{
+						++sizes.upperEpsilonTransitionsCount;
+					}
+				}
+			}
+			labels.insert(transitions.first);
+		}
+	}
+	sizes.labelsCount = labels.size();
+	return sizes;
+}
+
+static std::mutex StatsMutex; // For the traversal counters, the batches are traversed by many threads.
+
+void FinalStateTransducer::AddFrontierSizes(const std::vector<size_t>& frontierSizes, size_t wordsCount, size_t maxFrontierSize) const
+{
+	std::lock_guard<std::mutex> lock(StatsMutex);
+	Stats.traversedWordsCount += wordsCount;
+	if (Stats.frontierSizes.size() < frontierSizes.size())
+	{
+		Stats.frontierSizes.resize(frontierSizes.size(), 0);
+	}
+	for (size_t d = 0; d < frontierSizes.size(); ++d)
+	{
+		Stats.frontierSizes[d] += frontierSizes[d];
+	}
+	Stats.maxFrontierSize = std::max(Stats.maxFrontierSize, maxFrontierSize);
+}
+
+#if defined(COLLECT_STATS)
+static void AddArenaStats(ArenaStats& sum, const ArenaStats& stats)
 {
-	std::string tmpWord = "x"; // TODO: make the transitions const char* or something better than std::string...
+	sum.allocationsCount += stats.allocationsCount;
+	sum.allocatedBytes += stats.allocatedBytes;
+	sum.blocksCount += stats.blocksCount;
+	sum.reservedBytes += stats.reservedBytes;
+}
+#endif
 
+void FinalStateTransducer::Expand()
+{
+	TRACE_SCOPE("Expand");
 	for (size_t stateIndex = 0, bound = Delta.size(); stateIndex < bound; ++stateIndex)
 	{
 		StateTransitions transitionsExpanded;
@@ -167,8 +350,7 @@ void FinalStateTransducer::Expand()
 		for (auto& transition : transitions)
 		{
 			// q --word--> [<r0, out0>, <r1, out1>, ... , <rk, ok>]
-			const auto& transitionWord = transition.first;
-			const auto transitionWordLen = transitionWord.length();
+			const auto transitionWordLen = Labels->Length(transition.first);
 			if (transitionWordLen > 1)
 			{
 				auto& transitionDestinations = transition.second;
@@ -182,26 +364,21 @@ void FinalStateTransducer::Expand()
 					unsigned newStateIndex = (unsigned) currStatesCount;
 
 					// q --word[0]--> <r00, out0>
-					const char* pWord = transitionWord.c_str();
-					tmpWord[0] = *pWord++;
-					transitionsExpanded[tmpWord].insert(Transition{ newStateIndex, transitionDestination.output });
+					const char* pWord = Labels->Word(transition.first); // Not invalidated, no new labels are added here.
+					transitionsExpanded[SymbolLabel(*pWord++)].insert(Transition{ newStateIndex, transitionDestination.output });
 
 					for (auto bound = currStatesCount + newStatesCount - 1; newStateIndex < bound; ++newStateIndex)
 					{
-						assert(*pWord);
-						tmpWord[0] = *pWord++;
-						Delta[newStateIndex][tmpWord].insert(Transition{ newStateIndex + 1, 0 }); // rk --word[k]--> <rk+1, 0>
+						Delta[newStateIndex][SymbolLabel(*pWord++)].insert(Transition{ newStateIndex + 1, 0 }); // rk --word[k]--> <rk+1, 0>
 					}
 
-					assert(*pWord);
-					tmpWord[0] = *pWord++;
-					Delta[newStateIndex][tmpWord].insert(Transition{ transitionDestination.state, 0 });
+					Delta[newStateIndex][SymbolLabel(*pWord++)].insert(Transition{ transitionDestination.state, 0 });
 				}
 
 			}
 			else
 			{
-				transitionsExpanded[transitionWord] = std::move(transition.second);
+				transitionsExpanded[transition.first] = std::move(transition.second);
 			}
 		}
 
@@ -209,15 +386,15 @@ void FinalStateTransducer::Expand()
 	}
 }
 
-// Separates the epsilon transitions in @v (those with @output 0) to the set @s
-void SeparateEpsilonTransitions(std::unordered_set<Transition>& v, unsigned output, std::unordered_set<unsigned>& s)
+// Separates the epsilon transitions in @v (those with @output 0) to the list @s
+void SeparateEpsilonTransitions(std::unordered_set<Transition>& v, unsigned output, ArenaVector<unsigned>& s)
 {
 	auto it = v.begin();
 	while (it != v.end())
 	{
 		if (it->output == 0)
 		{
-			s.insert(it->state);
+			s.push_back(it->state);
 			it = v.erase(it);
 		}
 		else
@@ -227,9 +404,10 @@ void SeparateEpsilonTransitions(std::unordered_set<Transition>& v, unsigned outp
 	}
 }
 
-void FinalStateTransducer::RemoveEpsilon()
+void FinalStateTransducer::RemoveEpsilon(MonotonicArena& arena)
 {
-	SetOfTransitions Ce;
+	TRACE_SCOPE("RemoveEpsilon");
+	ArenaVector<ArenaVector<unsigned>> Ce(Delta.size(), ArenaVector<unsigned>(arena), arena);
 
 	// Add only the states which has (e,0) transition (i.e. transition with empty word and 0 output to another state)
 	// and in the same time remove them from Delta.
@@ -237,29 +415,32 @@ void FinalStateTransducer::RemoveEpsilon()
 	{
 		auto& state = Delta[i];
 
-		auto it = state.find("");
+		auto it = state.find(EPSILON_LABEL);
 		if (it != state.end())
 		{
 			SeparateEpsilonTransitions(it->second, 0, Ce[i]);
 			if (it->second.size() == 0)
 			{
-				Delta[i].erase("");
+				Delta[i].erase(EPSILON_LABEL);
 			}
 		}
 	}
 
-	TransitiveClosure(Ce);
+	TransitiveClosure(Ce, ClosureAlgorithm::Auto, arena);
+#if defined(COLLECT_STATS)
+	Stats.epsilonClosure = GetClosureStats(Ce);
+#endif
 	// Add identity
 	//for (unsigned i = 0u; i < Delta.size(); ++i)
 	//	Ce[i].insert(i);
 
 	// New Delta
+	ArenaVector<Transition> destinationsCopy(arena);
 	for (auto& state : Delta)
 	{
 		for (auto& transitionWordAndDestinations : state)
 		{
-			// TODO: change to set??
-			auto destinationsCopy = transitionWordAndDestinations.second;
+			destinationsCopy.assign(transitionWordAndDestinations.second.begin(), transitionWordAndDestinations.second.end());
 			for (auto& transition : destinationsCopy)
 			{
 				for (auto newDest : Ce[transition.state])
@@ -281,8 +462,12 @@ void FinalStateTransducer::RemoveEpsilon()
 	InitialStates = std::move(newInitialStates);
 }
 
-void FinalStateTransducer::RemoveUpperEpsilon(bool& infinite)
+// The states are processed in chunks of that many states when RemoveUpperEpsilon runs on more threads.
+static const size_t PARALLEL_STATES_CHUNK_SIZE = 64;
+
+void FinalStateTransducer::RemoveUpperEpsilon(bool& infinite, unsigned threadsCount, MonotonicArena& arena)
 {
+	TRACE_SCOPE("RemoveUpperEpsilon");
 	InitialEpsilonOutputs.clear();
 	CloseEpsilonOnStates.clear();
 
@@ -291,13 +476,16 @@ void FinalStateTransducer::RemoveUpperEpsilon(bool& infinite)
 	{
 		auto& state = Delta[i];
 
-		auto it = state.find("");
+		auto it = state.find(EPSILON_LABEL);
 		if (it != state.end())
 		{
 			Ce[i].insert(it->second.begin(), it->second.end());
 		}
 	}
-	ClosureEpsilon(Ce, infinite, StatesWithEpsilonCycleWithPositiveOutput);
+	ClosureEpsilon(Ce, infinite, StatesWithEpsilonCycleWithPositiveOutput, arena);
+#if defined(COLLECT_STATS)
+	Stats.upperEpsilonClosure = GetClosureStats(Ce);
+#endif
 	if (infinite)
 	{
 		return;
@@ -306,731 +494,1490 @@ void FinalStateTransducer::RemoveUpperEpsilon(bool& infinite)
 	// Remove the epsilon transitions
 	for (auto& state : Delta)
 	{
-		state.erase("");
+		state.erase(EPSILON_LABEL);
 	}
 
-	AddIdentity(Ce, Delta.size());
-
 	// Keep the initial outputs with the empty word on the inpute line.
 	// <q, <r, o>> belings to Ce & q belongs to InitialStates & r belongs to FinalStates Then keep the output 'o'.
 	for (const auto& initialState : InitialStates)
 	{
+		auto& destinations = Ce[initialState];
+		destinations.insert(Transition{ initialState, 0 }); // The identity, the one of the other states is added only to @closure below.
 		bool addedAsFinal = false;
-		auto it = Ce.find(initialState);
-		if (it != Ce.end())
+		// Search the destinations for a FinalState
+		for (const auto& transition : destinations)
 		{
-			// Search the destinations for a FinalState
-			for (const auto& transition : it->second)
+			if (FinalStates.find(transition.state) != FinalStates.end())
 			{
-				if (FinalStates.find(transition.state) != FinalStates.end())
+				InitialEpsilonOutputs.insert(transition.output);
+				// If there is a epsilon path from the initial state to a final one then the initial state should(and can be) final.
+				if (!addedAsFinal)
 				{
-					InitialEpsilonOutputs.insert(transition.output);
-					// If there is a epsilon path from the initial state to a final one then the initial state should(and can be) final.
-					if (!addedAsFinal)
-					{
-						FinalStates.insert(initialState);
-						addedAsFinal = true;
-					}
+					FinalStates.insert(initialState);
+					addedAsFinal = true;
 				}
 			}
 		}
 	}
 
-	// ReversedCe: { <r , <q, o>> | <q, <r, o> belongs to Ce }
-	SetOfTransitionsWithOutputs ReversedCe;
+	// The closure with the identity, i.e. <q, 0> is in the destinations of each q. Only read by the threads.
+	ArenaVector<ArenaVector<Transition>> closure(Delta.size(), ArenaVector<Transition>(arena), arena);
 	for (const auto& transitionsFromState : Ce)
 	{
-		const auto& state = transitionsFromState.first;
-		for (const auto& transition : transitionsFromState.second)
+		closure[transitionsFromState.first].assign(transitionsFromState.second.begin(), transitionsFromState.second.end());
+	}
+	for (unsigned q = 0, bound = (unsigned) Delta.size(); q < bound; ++q)
+	{
+		const auto identity = Transition{ q, 0 };
+		if (std::find(closure[q].begin(), closure[q].end(), identity) == closure[q].end())
 		{
-			ReversedCe[transition.state].insert(Transition{ state, transition.output });
+			closure[q].push_back(identity);
 		}
 	}
 
 	/* newDelta = { <q, <word, u+v+w>, r> |
-											<q', <word, v>, r'> belongs to Delta & 
+											<q, <q', u>> belongs to Ce &
+											<q', <word, v>, r'> belongs to Delta &
 											word != epsilon &
-											<q, u> belongs to Ce(r') &
-											<r, w> belongs to ReversedCe(q') }
+											<r', <r, w>> belongs to Ce }
+		For each q it is a product of sparse matrices: (Ce(q) x Delta) x Ce. The tuples of each product are sorted and deduplicated,
+		so the work depends on the number of different tuples and not on the number of paths. The states are independent (@threadsCount).
 	*/
+	struct LabeledTransition
+	{
+		unsigned label;
+		unsigned state;
+		Output output;
+
+		bool operator<(const LabeledTransition& right) const
+		{
+			return std::tie(label, state, output) < std::tie(right.label, right.state, right.output);
+		}
+		bool operator==(const LabeledTransition& right) const
+		{
+			return label == right.label && state == right.state && output == right.output;
+		}
+	};
+	auto sortAndUnique = [](ArenaVector<LabeledTransition>& v)
+	{
+		std::sort(v.begin(), v.end());
+		v.erase(std::unique(v.begin(), v.end()), v.end());
+	};
+
 	DeltaType newDelta(Delta.size());
-	for (unsigned qPrim = 0, bound = (unsigned) Delta.size(); qPrim < bound; ++qPrim)
+	const size_t chunksCount = (Delta.size() + PARALLEL_STATES_CHUNK_SIZE - 1) / PARALLEL_STATES_CHUNK_SIZE;
+	std::atomic<size_t> nextChunk(0);
+	auto worker = [&]()
 	{
-		// TODO: use directly Delta!!!
-		for (const auto& transitionsWithWord : Delta[qPrim])
+		MonotonicArena workerArena; // The shared @arena is not thread-safe.
+		ArenaVector<LabeledTransition> through(workerArena); // <word, r', u+v>
+		ArenaVector<LabeledTransition> product(workerArena); // <word, r, u+v+w>
+		for (auto chunk = nextChunk++; chunk < chunksCount; chunk = nextChunk++)
 		{
-			const auto& word = transitionsWithWord.first; // Note: there are no epsilon words (already removed)
-			for (const auto& transition : transitionsWithWord.second)
+			for (size_t q = chunk * PARALLEL_STATES_CHUNK_SIZE, bound = std::min(Delta.size(), (chunk + 1) * PARALLEL_STATES_CHUNK_SIZE); q < bound; ++q)
 			{
-				// transition.state is r';
-				for (const auto& backwardTransition : ReversedCe[qPrim])
+				through.clear();
+				for (const auto& forwardEpsilon : closure[q])
+				{
+					// forwardEpsilon.state is q'. Note: there are no epsilon words in Delta (already removed)
+					for (const auto& transitionsWithWord : Delta[forwardEpsilon.state])
+					{
+						for (const auto& transition : transitionsWithWord.second)
+						{
+							through.push_back(LabeledTransition{ transitionsWithWord.first, transition.state, AddOutputs(forwardEpsilon.output, transition.output) });
+						}
+					}
+				}
+				sortAndUnique(through);
+
+				product.clear();
+				for (const auto& t : through)
 				{
-					// backwardTransition.state is "q"
-					for (const auto& forwardTransition : Ce[transition.state])
+					// t.state is r'
+					for (const auto& forwardTransition : closure[t.state])
 					{
-						// forwardTransition.state is "r"
-						// Can there be multiple transitions inserted???
-						newDelta[backwardTransition.state][word].insert(Transition {
-							forwardTransition.state,
-							backwardTransition.output + transition.output + forwardTransition.output
-						});
+						product.push_back(LabeledTransition{ t.label, forwardTransition.state, AddOutputs(t.output, forwardTransition.output) });
+					}
+				}
+				sortAndUnique(product);
+
+				auto& state = newDelta[q];
+				for (size_t i = 0; i < product.size();)
+				{
+					auto& transitions = state[product[i].label];
+					auto labelEnd = i;
+					while (labelEnd < product.size() && product[labelEnd].label == product[i].label)
+					{
+						++labelEnd;
+					}
+					transitions.reserve(labelEnd - i);
+					for (; i < labelEnd; ++i)
+					{
+						transitions.insert(Transition{ product[i].state, product[i].output });
 					}
 				}
 			}
 		}
+	};
+
+	if (threadsCount == 0)
+	{
+		threadsCount = std::max(1u, std::thread::hardware_concurrency());
+	}
+	threadsCount = (unsigned) std::min<size_t>(threadsCount, chunksCount);
+	std::vector<std::thread> threads;
+	for (unsigned thread = 1; thread < threadsCount; ++thread)
+	{
+		threads.emplace_back(worker);
+	}
+	worker();
+	for (auto& thread : threads)
+	{
+		thread.join();
 	}
 
 	Delta = std::move(newDelta);
 }
 
-bool FinalStateTransducer::MakeRealTime()
+bool FinalStateTransducer::MakeRealTime(unsigned threadsCount)
 {
-	RemoveEpsilon();
+	TRACE_SCOPE("MakeRealTime");
+	Frozen.Clear();
+	IsFrozenDelta = false;
+	Subsequential.Clear();
+	IsSubsequentialDelta = false;
+	MonotonicArena arena;
+	TRACE_COUNTER("states", Delta.size());
+#if defined(COLLECT_STATS)
+	Stats.built = GetStageSizes();
+	Stats.builtTransitionsPerLabel.clear();
+	for (const auto& state : Delta)
+	{
+		for (const auto& transitions : state)
+		{
+			Stats.builtTransitionsPerLabel[std::string(Labels->Word(transitions.first), Labels->Length(transitions.first))] += transitions.second.size();
+		}
+	}
+#endif
+	RemoveEpsilon(arena);
+	TRACE_COUNTER("MakeRealTime arena bytes", arena.GetStats().reservedBytes);
+#if defined(COLLECT_STATS)
+	Stats.afterRemoveEpsilon = GetStageSizes();
+#endif
 	Expand();
-	RemoveUpperEpsilon(Infinite);
+	TRACE_COUNTER("states", Delta.size());
+#if defined(COLLECT_STATS)
+	Stats.afterExpand = GetStageSizes();
+#endif
+	RemoveUpperEpsilon(Infinite, threadsCount, arena);
+	TRACE_COUNTER("MakeRealTime arena bytes", arena.GetStats().reservedBytes);
+#if defined(COLLECT_STATS)
+	Stats.afterRemoveUpperEpsilon = GetStageSizes();
+	Stats.realTimeAllocations = arena.GetStats();
+#endif
 	RealTime = !Infinite; // If it is not an infinite then the conversion to real-time transducer was successful
 	return Infinite;
 }
 
-void distance(const Outputs& l, const Outputs& r, Outputs& res)
-{
-	res.first = l.first + r.first;
-	res.second = l.second + r.second;
+// The states with at least that many different symbols get a dense symbol index when FrozenSymbolIndex::Auto is used.
+// Dense is 257 * 4 bytes and compressed is 32 + (symbols + 1) * 4 bytes, so the dense one is at most ~3 times bigger there.
+static const unsigned DENSE_SYMBOL_INDEX_MIN_SYMBOLS = 64;
 
-	auto common = 0u;
-	if (res.first > res.second)
+bool FinalStateTransducer::Freeze(FrozenSymbolIndex symbolIndex)
+{
+	TRACE_SCOPE("Freeze");
+	Frozen.Clear();
+	IsFrozenDelta = false;
+	if (!IsRealTime())
 	{
-		common = res.second;
+		return false;
 	}
-	else
+
+	const auto statesCount = Delta.size();
+	Frozen.StateOffsets.reserve(statesCount + 1);
+	Frozen.FinalStates.resize(statesCount, false);
+	for (const auto& finalStateIndex : FinalStates)
 	{
-		common = res.first;
+		if (finalStateIndex < statesCount)
+		{
+			Frozen.FinalStates[finalStateIndex] = true;
+		}
 	}
 
-	res.first -= common;
-	res.second -= common;
-}
-
-bool balancable(const Outputs& o)
-{
-	return o.first == 0 || o.second == 0;
-}
-
-bool zero(const Outputs& o)
-{
-	return o.first == 0 && o.second == 0;
-}
-
-bool FinalStateTransducer::TestForFunctionality()
-{
-	Functional = false;
-	if (IsInfinite() || !IsRealTime() || InitialEpsilonOutputs.size() > 1)
+	std::vector<std::pair<unsigned char, Transition>> stateTransitions; // <symbol, <r, o>>
+	for (const auto& state : Delta)
 	{
-		return false;
-	}
+		Frozen.StateOffsets.push_back((unsigned) Frozen.Transitions.size());
 
-	MakeSquaredOutputTransducer();
-	SOT.Trim();
+		stateTransitions.clear();
+		for (const auto& transitions : state)
+		{
+			assert(IsSymbolLabel(transitions.first)); // Only one symbol transitions in a real-time transducer.
+			const auto symbol = LabelSymbol(transitions.first);
+			for (const auto& transition : transitions.second)
+			{
+				stateTransitions.push_back({ symbol, transition });
+			}
+		}
+		std::sort(stateTransitions.begin(), stateTransitions.end(),
+			[](const std::pair<unsigned char, Transition>& l, const std::pair<unsigned char, Transition>& r)
+			{
+				return std::tie(l.first, l.second.state, l.second.output) < std::tie(r.first, r.second.state, r.second.output);
+			});
 
-	SetOfTransitionsWithPairedOutputs SOTDeltaO;
-	SOT.Proj1_23(SOTDeltaO);
+		for (const auto& symbolAndTransition : stateTransitions)
+		{
+			Frozen.Symbols.push_back(symbolAndTransition.first);
+			Frozen.Transitions.push_back(symbolAndTransition.second);
+		}
+	}
+	Frozen.StateOffsets.push_back((unsigned) Frozen.Transitions.size());
 
-	std::unordered_map<unsigned, Outputs> AdmForLookups(SOT.InitialStates.size()); // For a state it gives the holden outpus
-	std::vector<unsigned> AdmStatesForIteration; // For a state it gives the holden outpus
-	AdmStatesForIteration.reserve(SOT.InitialStates.size());
+	Frozen.Symbols.shrink_to_fit();
+	Frozen.Transitions.shrink_to_fit();
 
-	// Insert: I x {0, 0}
-	for (const auto& initialStateIndex : SOT.InitialStates)
+	if (symbolIndex != FrozenSymbolIndex::None)
 	{
-		AdmForLookups[initialStateIndex] = { 0, 0 };
-		AdmStatesForIteration.push_back(initialStateIndex);
+		BuildFrozenSymbolIndex(symbolIndex);
 	}
 
-	for (size_t i = 0; i < AdmStatesForIteration.size(); ++i)
-	{
-		auto curr = AdmForLookups.find(AdmStatesForIteration[i]);
-		assert(curr != AdmForLookups.end());
-
-		const auto& q = curr->first; // state
-		const auto& h = curr->second; // (o1, o2) holden output
+	return IsFrozenDelta = true;
+}
 
-		std::vector<StateAndOutputs> Dq;
+void FinalStateTransducer::BuildFrozenSymbolIndex(FrozenSymbolIndex symbolIndex)
+{
+	const auto statesCount = (unsigned) Frozen.StateOffsets.size() - 1;
+	Frozen.StateIndexes.resize(statesCount);
+	for (unsigned state = 0; state < statesCount; ++state)
+	{
+		const auto first = Frozen.StateOffsets[state];
+		const auto last = Frozen.StateOffsets[state + 1];
+		auto& stateIndex = Frozen.StateIndexes[state];
+		stateIndex = FrozenStateIndex{ FROZEN_NO_TRANSITIONS, 0, 0 };
+		if (first == last)
+		{
+			continue;
+		}
 
-		auto it = SOTDeltaO.find(q);
-		if (it != SOTDeltaO.end())
+		unsigned symbolsCount = 0;
+		for (auto k = first; k < last; ++k)
 		{
-			for (const auto& transition : it->second)
+			if (k == first || Frozen.Symbols[k] != Frozen.Symbols[k - 1])
 			{
-				// transition.first is state.
-				// transition.second is a pair of holded outputs.
-				Outputs newHoldenOutput;
-				distance(h, transition.second, newHoldenOutput);
-				StateAndOutputs newStateAndHoldenOutputs { transition.first, std::move(newHoldenOutput) };
-				if (newStateAndHoldenOutputs.first != q || newStateAndHoldenOutputs.second != h)
-				{
-					Dq.push_back(std::move(newStateAndHoldenOutputs));
-				}
+				++symbolsCount;
 			}
 		}
 
-		if (Dq.size() > 0)
+		stateIndex.at = (unsigned) Frozen.SymbolOffsets.size();
+		if (symbolIndex == FrozenSymbolIndex::Dense ||
+			(symbolIndex == FrozenSymbolIndex::Auto && symbolsCount >= DENSE_SYMBOL_INDEX_MIN_SYMBOLS))
 		{
-			for (const auto& qAndH : Dq)
+			stateIndex.kind = FROZEN_DENSE_INDEX;
+			// The slot for symbol 'c' is the first transition with symbol >= 'c'.
+			auto k = first;
+			for (unsigned c = 0; c <= 256; ++c)
 			{
-				const auto& qPrim = qAndH.first;
-				const auto& hPrim = qAndH.second;
-				if (!balancable(hPrim) ||
-					(SOT.FinalStates.find(qPrim) != SOT.FinalStates.end() && !zero(hPrim)))
-				{
-					return false;
-				}
-
-				auto it = AdmForLookups.find(qPrim);
-				if (it != AdmForLookups.end() && hPrim != it->second)
+				while (k < last && Frozen.Symbols[k] < c)
 				{
-					return false;
+					++k;
 				}
-				if (it == AdmForLookups.end())
+				Frozen.SymbolOffsets.push_back(k);
+			}
+		}
+		else
+		{
+			stateIndex.kind = FROZEN_COMPRESSED_INDEX;
+			stateIndex.bitmapAt = (unsigned) Frozen.Bitmaps.size();
+			Frozen.Bitmaps.resize(Frozen.Bitmaps.size() + 4, 0);
+			for (auto k = first; k < last; ++k)
+			{
+				const auto c = Frozen.Symbols[k];
+				if (k == first || c != Frozen.Symbols[k - 1])
 				{
-					AdmForLookups[qPrim] = std::move(hPrim);
-					AdmStatesForIteration.push_back(qPrim);
+					Frozen.Bitmaps[stateIndex.bitmapAt + c / 64] |= 1ull << (c % 64);
+					Frozen.SymbolOffsets.push_back(k);
 				}
 			}
+			Frozen.SymbolOffsets.push_back(last);
 		}
 	}
 
-	return Functional = true;
+	Frozen.SymbolOffsets.shrink_to_fit();
+	Frozen.Bitmaps.shrink_to_fit();
 }
 
-// Removes the states which are not connected to the a initial state or a final state.
-void FinalStateTransducer::SquaredOutputTransducer::Trim()
+FrozenInfo FinalStateTransducer::GetFrozenInfo() const
 {
-	// TODO: optimizations at few places
-	SetOfTransitions r;
-	Proj1_2(r);
-	SetOfTransitions reversedR;
-	for (const auto& trs : r)
+	FrozenInfo info{};
+	if (!IsFrozen())
+	{
+		return info;
+	}
+
+	info.statesCount = (unsigned) Frozen.StateOffsets.size() - 1;
+	info.transitionsCount = (unsigned) Frozen.Transitions.size();
+	info.transitionsBytes = Frozen.StateOffsets.size() * sizeof(unsigned) +
+		Frozen.Symbols.size() * sizeof(unsigned char) +
+		Frozen.Transitions.size() * sizeof(Transition) +
+		Frozen.FinalStates.size() / 8;
+	for (const auto& stateIndex : Frozen.StateIndexes)
 	{
-		const auto& a = trs.first;
-		for (const auto& tr : trs.second)
+		if (stateIndex.kind == FROZEN_DENSE_INDEX)
 		{
-			reversedR[tr].insert(a);
+			++info.denseStatesCount;
+		}
+		else if (stateIndex.kind == FROZEN_COMPRESSED_INDEX)
+		{
+			++info.compressedStatesCount;
 		}
 	}
+	info.symbolIndexBytes = Frozen.StateIndexes.size() * sizeof(FrozenStateIndex) +
+		Frozen.SymbolOffsets.size() * sizeof(unsigned) +
+		Frozen.Bitmaps.size() * sizeof(uint64_t);
+	info.allDenseSymbolIndexBytes = info.statesCount * (sizeof(FrozenStateIndex) + 257 * sizeof(unsigned));
 
-	/* Traverse to find the reachable states. */
+	return info;
+}
 
+bool FinalStateTransducer::IsFrozen() const
+{
+	return IsFrozenDelta;
+}
 
-	std::unordered_set<unsigned> visited;
-	std::queue<unsigned> q;
-	std::unordered_set<unsigned> reachableStates;
-	// Add the initial states.
-	for (const auto& initialStateIndex : InitialStates)
+bool FinalStateTransducer::SaveFrozen(const char* fileName) const
+{
+	if (!IsFrozen())
 	{
-		reachableStates.insert(initialStateIndex);
-		q.push(initialStateIndex);
-		visited.insert(initialStateIndex);
+		return false;
 	}
-	while (!q.empty())
-	{
-		auto curr = q.front();
-		q.pop();
 
-		for (auto& reachableState : r[curr])
+	const auto statesCount = (unsigned) Frozen.StateOffsets.size() - 1;
+	std::vector<uint64_t> finalStates((statesCount + 63) / 64, 0);
+	for (unsigned i = 0; i < statesCount; ++i)
+	{
+		if (Frozen.FinalStates[i])
 		{
-			if (visited.find(reachableState) == visited.end())
-			{
-				reachableStates.insert(reachableState);
-				q.push(reachableState);
-				visited.insert(reachableState);
-			}
+			finalStates[i / 64] |= 1ull << (i % 64);
 		}
 	}
-	
-	q = std::queue<unsigned>(); // not needed
-	visited.clear();
-
-	std::unordered_set<unsigned> coReachableStates;
-	// Add the final states.
-	for (const auto& finalStateIndex : FinalStates)
+	std::vector<uint32_t> initialStates(InitialStates.begin(), InitialStates.end());
+	std::sort(initialStates.begin(), initialStates.end());
+	std::vector<Output> initialEpsilonOutputs(InitialEpsilonOutputs.begin(), InitialEpsilonOutputs.end());
+	std::sort(initialEpsilonOutputs.begin(), initialEpsilonOutputs.end());
+	// The transitions are written field by field, so the padding before a 64-bit output is zeros and not whatever was in the memory.
+	std::vector<char> transitions(Frozen.Transitions.size() * sizeof(Transition), 0);
+	for (size_t i = 0; i < Frozen.Transitions.size(); ++i)
 	{
-		coReachableStates.insert(finalStateIndex);
-		q.push(finalStateIndex);
-		visited.insert(finalStateIndex);
+		const auto at = transitions.data() + i * sizeof(Transition);
+		const uint32_t state = Frozen.Transitions[i].state;
+		std::memcpy(at, &state, sizeof(state));
+		std::memcpy(at + offsetof(Transition, output), &Frozen.Transitions[i].output, sizeof(Output));
 	}
-	while (!q.empty())
+
+	MappedTransducerHeader header{};
+	std::memcpy(header.magic, MAPPED_TRANSDUCER_MAGIC, sizeof(MAPPED_TRANSDUCER_MAGIC));
+	header.version = MAPPED_TRANSDUCER_VERSION;
+	header.flags = (Functional ? MAPPED_FUNCTIONAL : 0) | (Infinite ? MAPPED_INFINITE : 0) |
+		(RecognizingEmptyWord ? MAPPED_RECOGNIZING_EMPTY_WORD : 0) | (Frozen.StateIndexes.empty() ? 0 : MAPPED_HAS_SYMBOL_INDEX) |
+		(sizeof(Output) == sizeof(uint64_t) ? MAPPED_64_BIT_OUTPUTS : 0);
+	header.statesCount = statesCount;
+	header.transitionsCount = (uint32_t) Frozen.Transitions.size();
+	header.initialStatesCount = (uint32_t) initialStates.size();
+	header.initialEpsilonOutputsCount = (uint32_t) initialEpsilonOutputs.size();
+	header.symbolOffsetsCount = (uint32_t) Frozen.SymbolOffsets.size();
+	header.bitmapsCount = (uint32_t) Frozen.Bitmaps.size();
+
+	// The arrays one after another (each one 8 bytes aligned) and the header is copied in front of them when their offsets are known.
+	std::vector<char> file(sizeof(MappedTransducerHeader), 0);
+	auto append = [&file](const void* data, size_t bytes) -> uint64_t
 	{
-		auto curr = q.front();
-		q.pop();
+		file.resize((file.size() + 7) / 8 * 8, 0);
+		const auto at = file.size();
+		file.insert(file.end(), static_cast<const char*>(data), static_cast<const char*>(data) + bytes);
+		return at;
+	};
+	header.stateOffsetsAt = append(Frozen.StateOffsets.data(), Frozen.StateOffsets.size() * sizeof(uint32_t));
+	header.symbolsAt = append(Frozen.Symbols.data(), Frozen.Symbols.size());
+	header.transitionsAt = append(transitions.data(), transitions.size());
+	header.finalStatesAt = append(finalStates.data(), finalStates.size() * sizeof(uint64_t));
+	header.initialStatesAt = append(initialStates.data(), initialStates.size() * sizeof(uint32_t));
+	header.initialEpsilonOutputsAt = append(initialEpsilonOutputs.data(), initialEpsilonOutputs.size() * sizeof(Output));
+	header.stateIndexesAt = append(Frozen.StateIndexes.data(), Frozen.StateIndexes.size() * sizeof(FrozenStateIndex));
+	header.symbolOffsetsAt = append(Frozen.SymbolOffsets.data(), Frozen.SymbolOffsets.size() * sizeof(uint32_t));
+	header.bitmapsAt = append(Frozen.Bitmaps.data(), Frozen.Bitmaps.size() * sizeof(uint64_t));
+	file.resize((file.size() + 7) / 8 * 8, 0);
+	header.fileSize = file.size();
+	std::memcpy(file.data(), &header, sizeof(header));
+
+	std::ofstream out(fileName, std::ios::binary | std::ios::trunc);
+	out.write(file.data(), (std::streamsize) file.size());
+	return (bool) out;
+}
 
-		for (auto& coReachableState : reversedR[curr])
-		{
-			if (visited.find(coReachableState) == visited.end())
-			{
-				coReachableStates.insert(coReachableState);
-				q.push(coReachableState);
-				visited.insert(coReachableState);
-			}
-		}
-	}
+void FinalStateTransducer::FrozenDelta::Clear()
+{
+	StateOffsets.clear();
+	Symbols.clear();
+	Transitions.clear();
+	FinalStates.clear();
+	StateIndexes.clear();
+	SymbolOffsets.clear();
+	Bitmaps.clear();
+}
 
-// END
-	//std::unordered_set<unsigned> reachableStates;
-	//// Add the initial states.
-	//for (const auto& initialStateIndex : InitialStates)
-	//{
-	//	reachableStates.insert(initialStateIndex);
-	//}
-
-	//TransitiveClosure(r);
-	//// Remove all states which are not connected to an initial one.
-	//for (const auto& initialStateIndex : InitialStates)
-	//{
-	//	auto it = r.find(initialStateIndex);
-	//	if (it != r.end())
-	//	{
-	//		for (const auto& reachableState : it->second)
-	//		{
-	//			reachableStates.insert(reachableState);
-	//		}
-	//	}
-	//}
-	//
-	//std::unordered_set<unsigned> coReachableStates;
-	//// Add the final states.
-	//for (const auto& finalStateIndex : FinalStates)
-	//{
-	//	coReachableStates.insert(finalStateIndex);
-	//}
-	
-	//// Remove all states which are not connected to a final one.
-	//for (unsigned i = 0, bound = (unsigned) Delta.size(); i < bound; ++i)
-	//{
-	//	auto it = r.find(i);
-	//	if (it != r.end())
-	//	{
-	//		for (const auto& finalStateIndex : FinalStates)
-	//		{
-	//			auto ifFinal = it->second.find(finalStateIndex);
-	//			if (ifFinal != it->second.end())
-	//			{
-	//				coReachableStates.insert(i);
-	//				break;
-	//			}
-	//		}
-	//	}
-	//}
-	//
-	const unsigned REMOVED_STATE = unsigned(-1);
-	std::unordered_map<unsigned, unsigned> remapingOfStateIndexes;
-	// Remove the non reachable or co-reachabe state transitions.
-	for (unsigned i = 0, bound = (unsigned) Delta.size(); i < bound; ++i)
+void distance(const Outputs& l, const Outputs& r, Outputs& res)
+{
+	res.first = l.first + r.first;
+	res.second = l.second + r.second;
+
+	Output common = 0;
+	if (res.first > res.second)
 	{
-		if (reachableStates.find(i) == reachableStates.end() || coReachableStates.find(i) == coReachableStates.end())
-		{
-			remapingOfStateIndexes[i] = REMOVED_STATE;
-		}
+		common = res.second;
 	}
-	
-	// Update the Initial and Final states.
-	for (auto it = InitialStates.begin(); it != InitialStates.end(); )
+	else
 	{
-		if (coReachableStates.find(*it) == coReachableStates.end())
-		{
-			remapingOfStateIndexes[*it] = REMOVED_STATE;
-			it = InitialStates.erase(it);
-		}
-		else
-		{
-			++it;
-		}
+		common = res.first;
 	}
-	for (auto it = FinalStates.begin(); it != FinalStates.end(); )
-	{
-		if (reachableStates.find(*it) == reachableStates.end())
-		{
-			remapingOfStateIndexes[*it] = REMOVED_STATE;
-			it = FinalStates.erase(it);
-		}
-		else
+
+	res.first -= common;
+	res.second -= common;
+}
+
+bool balancable(const Outputs& o)
+{
+	return o.first == 0 || o.second == 0;
+}
+
+bool zero(const Outputs& o)
+{
+	return o.first == 0 && o.second == 0;
+}
+
+template<typename Function>
+void FinalStateTransducer::ForEachPairTransition(const StatesPair& p, Function f) const
+{
+	if (p.first >= Delta.size() || p.second >= Delta.size())
+	{
+		return;
+	}
+
+	const auto& D1Map = Delta[p.first];
+	const auto& D2Map = Delta[p.second];
+	for (const auto& wordAndTransitions : D1Map)
+	{
+		// Only couple them by same transition word.
+		const auto it = D2Map.find(wordAndTransitions.first);
+		if (it != D2Map.end())
 		{
-			++it;
+			for (const auto& tr1 : wordAndTransitions.second)
+			{
+				for (const auto& tr2 : it->second)
+				{
+					f(Outputs{ tr1.output, tr2.output }, StatesPair{ tr1.state, tr2.state });
+				}
+			}
 		}
 	}
-	
-	// Remove the deleted states from the vector
-	unsigned newStateIndex = 0;
-	for (unsigned i = 0, bound = (unsigned) Delta.size(); i < bound; ++i)
+}
+
+bool FinalStateTransducer::IsPairCoReachable(const StatesPair& p, ArenaUnorderedMap<StatesPair, bool, boost::hash<StatesPair>>& coReachable) const
+{
+	TRACE_SCOPE("IsPairCoReachable");
+	auto cached = coReachable.find(p);
+	if (cached != coReachable.end())
+	{
+		return cached->second;
+	}
+
+	// BFS in the squared output transducer from @p untill a pair of final states (or an already known co-reachable pair) is found.
+	MonotonicArena arena;
+	ArenaVector<StatesPair> pForIteration(1, p, arena);
+	ArenaUnorderedSet<StatesPair, boost::hash<StatesPair>> visited(arena);
+	visited.insert(p);
+	bool found = false;
+	for (size_t i = 0; i < pForIteration.size() && !found; ++i)
 	{
-		auto it = remapingOfStateIndexes.find(i);
-		if (it != remapingOfStateIndexes.end())
+		const auto& curr = pForIteration[i];
+		if (FinalStates.find(curr.first) != FinalStates.end() &&
+			FinalStates.find(curr.second) != FinalStates.end())
 		{
-			assert(it->second == REMOVED_STATE);
-			Delta[i].clear();
+			found = true;
+			break;
 		}
-		else
+
+		cached = coReachable.find(curr);
+		if (cached != coReachable.end())
 		{
-			remapingOfStateIndexes[i] = newStateIndex;
-			++newStateIndex;
+			if (cached->second)
+			{
+				found = true;
+			}
+			continue; // A known non co-reachable pair, nothing to search after it.
 		}
+
+		ForEachPairTransition(curr, [&](const Outputs&, const StatesPair& next)
+		{
+			if (visited.insert(next).second)
+			{
+				pForIteration.push_back(next);
+			}
+		});
 	}
-	
-	// The final states might not have transitions from them, but they can be reachable.
-	for (const auto& finalStateIndex : FinalStates)
+
+#if defined(COLLECT_STATS)
+	++Stats.coReachabilitySearchesCount;
+	Stats.coReachabilityPairStatesCount += pForIteration.size();
+	AddArenaStats(Stats.functionalityAllocations, arena.GetStats());
+#endif
+	if (found)
 	{
-		if (remapingOfStateIndexes.find(finalStateIndex) == remapingOfStateIndexes.end())
-		{
-			remapingOfStateIndexes[finalStateIndex] = finalStateIndex;
-		}
+		coReachable[p] = true;
 	}
-	// Remap the initial and final states
-	std::unordered_set<unsigned> remapedInitialStates;
-	for (const auto& initialStateIndex : InitialStates)
+	else
 	{
-		assert(remapingOfStateIndexes.find(initialStateIndex) != remapingOfStateIndexes.end());
-		const auto mapedInitialStateIndex = remapingOfStateIndexes[initialStateIndex];
-		if (mapedInitialStateIndex != REMOVED_STATE)
+		// Nothing reachable from the visited pairs leads to a final pair, so none of them is co-reachable.
+		for (const auto& visitedPair : pForIteration)
 		{
-			remapedInitialStates.insert(mapedInitialStateIndex);
+			coReachable[visitedPair] = false;
 		}
 	}
-	InitialStates = std::move(remapedInitialStates);
-	
-	std::unordered_set<unsigned> remapedFinalStates;
-	for (const auto& finalStateIndex : FinalStates)
+	return found;
+}
+
+/*
+	The squared output transducer is not build. Its pair states <p1, p2> are explored on the fly from I x I,
+	each one with its holden output, and the test stops on the first conflict.
+	Only the pair states which are co-reachable count (as in the trimmed squared output transducer),
+	but the co-reachability is checked only for the pairs with a conflict.
+	Note: each predecessor of a co-reachable pair is co-reachable, so the holden outputs which reach it come only from co-reachable pairs.
+*/
+bool FinalStateTransducer::TestForFunctionality()
+{
+	TRACE_SCOPE("TestForFunctionality");
+	Functional = false;
+	if (IsInfinite() || !IsRealTime() || InitialEpsilonOutputs.size() > 1)
 	{
-		assert(remapingOfStateIndexes.find(finalStateIndex) != remapingOfStateIndexes.end());
-		const auto mapedFinalStateIndex = remapingOfStateIndexes[finalStateIndex];
-		if (mapedFinalStateIndex != REMOVED_STATE)
-		{
-			remapedFinalStates.insert(mapedFinalStateIndex);
-		}
+		return false;
 	}
-	FinalStates = std::move(remapedFinalStates);
-	
-	// "Squash" the elements in the vector.
-	for (unsigned i = 0, bound = (unsigned) Delta.size(); i < bound; ++i)
+
+#if defined(COLLECT_STATS)
+	Stats.functionalityPairTransitionsCount = Stats.coReachabilitySearchesCount = Stats.coReachabilityPairStatesCount = 0;
+	Stats.functionalityAllocations = ArenaStats();
+#endif
+	MonotonicArena arena;
+	size_t initialIxIElementsCount = InitialStates.size() * InitialStates.size();
+	ArenaUnorderedMap<StatesPair, Outputs, boost::hash<StatesPair>> AdmForLookups(initialIxIElementsCount, // For a pair state it gives the holden outpus
+		boost::hash<StatesPair>(), std::equal_to<StatesPair>(), arena);
+	ArenaVector<StatesPair> AdmStatesForIteration(arena);
+	AdmStatesForIteration.reserve(initialIxIElementsCount);
+	ArenaUnorderedMap<StatesPair, bool, boost::hash<StatesPair>> coReachable(arena);
+
+	// Insert: I x I x {0, 0}
+	for (const auto& initialStateIndex1 : InitialStates)
 	{
-		assert(remapingOfStateIndexes.find(i) != remapingOfStateIndexes.end());
-		const auto& newStateIndex = remapingOfStateIndexes[i];
-		if (newStateIndex != REMOVED_STATE)
+		for (const auto& initialStateIndex2 : InitialStates)
 		{
-			Delta[newStateIndex] = std::move(Delta[i]);
+			const StatesPair p{ initialStateIndex1, initialStateIndex2 };
+			AdmForLookups[p] = { 0, 0 };
+			AdmStatesForIteration.push_back(p);
 		}
 	}
-	
-	// Now the @newStateIndex is the new vector size.
-	Delta.resize(newStateIndex);
-	
-	std::unordered_set<Transition> updatedTransitions;
-	// Update the transitions.
-	for (auto& state : Delta)
+
+	bool conflict = false;
+	for (size_t i = 0; i < AdmStatesForIteration.size() && !conflict; ++i)
 	{
-		for (auto& transitionsWithWord : state)
+		const auto q = AdmStatesForIteration[i]; // state
+		const auto h = AdmForLookups[q]; // (o1, o2) holden output
+
+		ForEachPairTransition(q, [&](const Outputs& o, const StatesPair& qPrim)
 		{
-			updatedTransitions.clear();
-			for (const auto& transition : transitionsWithWord.second)
+			if (conflict)
+			{
+				return;
+			}
+#if defined(COLLECT_STATS)
+			++Stats.functionalityPairTransitionsCount;
+#endif
+
+			Outputs hPrim;
+			distance(h, o, hPrim);
+			if (qPrim == q && hPrim == h)
+			{
+				return;
+			}
+
+			auto it = AdmForLookups.find(qPrim);
+			if (it == AdmForLookups.end())
 			{
-				auto it = remapingOfStateIndexes.find(transition.state);
-				if (it != remapingOfStateIndexes.end())
+				if (!balancable(hPrim) ||
+					(FinalStates.find(qPrim.first) != FinalStates.end() && FinalStates.find(qPrim.second) != FinalStates.end() && !zero(hPrim)))
 				{
-					const auto& newDestinationStateIndex = it->second;
-					if (newDestinationStateIndex != REMOVED_STATE)
-					{
-						updatedTransitions.insert(Transition{ newDestinationStateIndex, transition.output });
-					}
+					conflict = IsPairCoReachable(qPrim, coReachable);
 				}
+				AdmForLookups[qPrim] = hPrim;
+				AdmStatesForIteration.push_back(qPrim);
 			}
-			transitionsWithWord.second = std::move(updatedTransitions);
-		}
+			else if (hPrim != it->second)
+			{
+				conflict = IsPairCoReachable(qPrim, coReachable);
+			}
+		});
 	}
+
+	TRACE_COUNTER("functionality pair states", AdmStatesForIteration.size());
+	TRACE_COUNTER("TestForFunctionality arena bytes", arena.GetStats().reservedBytes);
+#if defined(COLLECT_STATS)
+	Stats.functionalityPairStatesCount = AdmStatesForIteration.size();
+	AddArenaStats(Stats.functionalityAllocations, arena.GetStats());
+#endif
+	return Functional = !conflict;
 }
 
-void FinalStateTransducer::SquaredOutputTransducer::Proj1_2(SetOfTransitions& r) const
+void FinalStateTransducer::FindCoReachableStates(std::vector<bool>& coReachable) const
 {
-	for (unsigned i = 0, bound = (unsigned)Delta.size(); i < bound; ++i)
+	std::vector<std::vector<unsigned>> reversedDelta(Delta.size());
+	for (unsigned i = 0, bound = (unsigned) Delta.size(); i < bound; ++i)
 	{
 		for (const auto& transitions : Delta[i])
 		{
 			for (const auto& transition : transitions.second)
 			{
-				r[i].insert(transition.state);
+				reversedDelta[transition.state].push_back(i);
 			}
 		}
 	}
-}
 
-void FinalStateTransducer::SquaredOutputTransducer::Proj1_23(SetOfTransitionsWithPairedOutputs& r) const
-{
-	for (unsigned i = 0, bound = (unsigned)Delta.size(); i < bound; ++i)
+	coReachable.assign(Delta.size(), false);
+	std::vector<unsigned> q;
+	for (const auto& finalStateIndex : FinalStates)
 	{
-		for (const auto& transitions : Delta[i])
+		if (finalStateIndex < Delta.size() && !coReachable[finalStateIndex])
 		{
-			for (const auto& transition : transitions.second)
-			{
-				r[i].insert(StateAndOutputs{ transition.state, Outputs { transitions.first, transition.output} });
-			}
+			coReachable[finalStateIndex] = true;
+			q.push_back(finalStateIndex);
 		}
 	}
-}
-
-void FinalStateTransducer::Proj1_2(SetOfTransitions& r) const
-{
-	for (unsigned i = 0, bound = (unsigned) Delta.size(); i < bound; ++i)
+	while (!q.empty())
 	{
-		for (const auto& transitions : Delta[i])
+		const auto curr = q.back();
+		q.pop_back();
+		for (const auto& coReachableState : reversedDelta[curr])
 		{
-			for (const auto& transition : transitions.second)
+			if (!coReachable[coReachableState])
 			{
-				r[i].insert(transition.state);
+				coReachable[coReachableState] = true;
+				q.push_back(coReachableState);
 			}
 		}
 	}
 }
 
-void FinalStateTransducer::Proj1_23(SetOfTransitionsWithOutputs& r) const
+// The pair states of a BFS level are split in chunks of that size, which are taken by the threads.
+static const size_t PARALLEL_PAIRS_CHUNK_SIZE = 64;
+// The concurrent table of the pair ids has that many shards, each one with its own lock and arena.
+static const unsigned PAIR_IDS_SHARDS_COUNT = 64;
+static const unsigned NEW_PAIR_ID = unsigned(-1); // Found by the current level, the id is given at its end.
+
+// @firstSeen is the first <pair of the level, transition> (as (i << 32) + k) which goes to the new pair.
+struct PairId
 {
-	for (unsigned i = 0, bound = (unsigned) Delta.size(); i < bound; ++i)
+	unsigned id;
+	unsigned long long firstSeen;
+};
+
+// A part of the table of the pair ids, it is changed only under its lock.
+struct PairIdsShard
+{
+	PairIdsShard()
+		: Ids(Arena)
+		, NewPairs(Arena)
 	{
-		for (const auto& transitions : Delta[i])
-		{
-			for (const auto& transition : transitions.second)
-			{
-				r[i].insert(Transition{ transition.state, transition.output });
-			}
-		}
 	}
-}
 
-void FinalStateTransducer::MakeSquaredOutputTransducer()
+	std::mutex Mutex;
+	MonotonicArena Arena;
+	ArenaUnorderedMap<StatesPair, PairId, boost::hash<StatesPair>> Ids;
+	ArenaVector<std::pair<const StatesPair, PairId>*> NewPairs; // The ones found by the current level.
+};
+
+static unsigned GetPairIdsShard(const StatesPair& p)
 {
-	assert(IsRealTime());
-	assert(!IsInfinite());
+	// The high bits of a multiplicative hash, the low bits of boost::hash are used by the buckets in the shard.
+	const auto h = (unsigned long long) boost::hash<StatesPair>()(p) * 0x9E3779B97F4A7C15ull;
+	return (unsigned) ((h >> 32) % PAIR_IDS_SHARDS_COUNT);
+}
 
-	typedef std::pair<unsigned, unsigned> P; // <p1, p2>
+// Runs @worker on @threadsCount threads, the calling one is one of them.
+template<typename Worker>
+static void RunOnThreads(unsigned threadsCount, Worker worker)
+{
+	std::vector<std::thread> threads;
+	for (unsigned thread = 1; thread < threadsCount; ++thread)
+	{
+		threads.emplace_back(worker);
+	}
+	worker();
+	for (auto& thread : threads)
+	{
+		thread.join();
+	}
+}
 
-	size_t initialIxIElementsCount = InitialStates.size() * InitialStates.size();
-	std::vector<P> pForIteration;
-	pForIteration.reserve(initialIxIElementsCount);
-	std::unordered_map<P, unsigned,	boost::hash<P>> // <p1, p2>, id (it's place in the iteration vector)
-		pForLookups(initialIxIElementsCount);
+bool FinalStateTransducer::BuildPairStatesGraph(PairStatesGraph& graph, unsigned threadsCount, size_t maxPairStatesCount, const std::vector<bool>* allowedStates) const
+{
+	TRACE_SCOPE("BuildPairStatesGraph");
+	if (threadsCount == 0)
+	{
+		threadsCount = std::max(1u, std::thread::hardware_concurrency());
+	}
+	auto isAllowed = [allowedStates](const StatesPair& p)
+	{
+		return !allowedStates || ((*allowedStates)[p.first] && (*allowedStates)[p.second]);
+	};
 
-	unsigned id = 0;
+	graph.Pairs.clear();
+	graph.Offsets.assign(1, 0);
+	graph.Transitions.clear();
+	std::vector<PairIdsShard> shards(PAIR_IDS_SHARDS_COUNT);
 	for (const auto& initialStateIndex1 : InitialStates)
 	{
 		for (const auto& initialStateIndex2 : InitialStates)
 		{
-			pForIteration.push_back(P{ initialStateIndex1, initialStateIndex2 });
-			pForLookups[P{ initialStateIndex1, initialStateIndex2 }] = id;
-			++id;
+			const StatesPair p{ initialStateIndex1, initialStateIndex2 };
+			if (isAllowed(p))
+			{
+				shards[GetPairIdsShard(p)].Ids[p] = PairId{ (unsigned) graph.Pairs.size(), 0 };
+				graph.Pairs.push_back(p);
+			}
 		}
 	}
+	if (graph.Pairs.size() > maxPairStatesCount)
+	{
+		return false;
+	}
 
-	typedef std::pair<std::pair<unsigned, unsigned>, std::pair<unsigned, unsigned>>	// < <o1, o2>, <q1, q2>>
-		PairOutputsAndStates;
-
-	SOT.Delta.clear();
-	SOT.Delta.reserve(initialIxIElementsCount); // Tiny posible optimization.
-	for (unsigned i = 0; i < pForIteration.size(); ++i)
+	// The transitions of the pairs of a chunk of the level, the destinations are pairs until they get their ids.
+	struct ChunkTransitions
+	{
+		std::vector<size_t> Counts; // For each pair of the chunk.
+		std::vector<std::pair<Outputs, StatesPair>> Transitions;
+	};
+	std::vector<ChunkTransitions> chunks;
+	std::vector<std::pair<const StatesPair, PairId>*> newPairs;
+	for (size_t levelBegin = 0, levelEnd = graph.Pairs.size(); levelBegin < levelEnd; levelBegin = levelEnd, levelEnd = graph.Pairs.size())
 	{
-		const auto& p = pForIteration[i]; // a pair <p1, p2>
-		if (p.first < Delta.size() && p.second < Delta.size())
+		const size_t chunksCount = (levelEnd - levelBegin + PARALLEL_PAIRS_CHUNK_SIZE - 1) / PARALLEL_PAIRS_CHUNK_SIZE;
+		const auto levelThreadsCount = (unsigned) std::min<size_t>(threadsCount, chunksCount);
+		const bool locking = levelThreadsCount > 1;
+		if (chunks.size() < chunksCount)
 		{
-			const auto& D1Map = Delta[p.first];
-			const auto& D2Map = Delta[p.second];
+			chunks.resize(chunksCount);
+		}
 
-			std::unordered_set<PairOutputsAndStates, boost::hash<PairOutputsAndStates>> N;
-			for (const auto& wordAndTransitions : D1Map)
+		// Find the transitions of the level and add their new destinations to the table.
+		std::atomic<size_t> nextChunk(0);
+		RunOnThreads(levelThreadsCount, [&]()
+		{
+			for (auto chunk = nextChunk++; chunk < chunksCount; chunk = nextChunk++)
 			{
-				// Only couple them by same transition word.
-				const auto& D1 = wordAndTransitions.second;
-				auto it = D2Map.find(wordAndTransitions.first);
-				if (it != D2Map.end())
+				auto& chunkTransitions = chunks[chunk];
+				chunkTransitions.Counts.clear();
+				chunkTransitions.Transitions.clear();
+				for (size_t i = levelBegin + chunk * PARALLEL_PAIRS_CHUNK_SIZE, bound = std::min(levelEnd, i + PARALLEL_PAIRS_CHUNK_SIZE); i < bound; ++i)
 				{
-					const auto& D2 = it->second;
-					for (const auto& tr1 : D1)
+					unsigned long long k = 0;
+					ForEachPairTransition(graph.Pairs[i], [&](const Outputs& o, const StatesPair& next)
 					{
-						for (const auto& tr2 : D2)
+						if (!isAllowed(next))
 						{
-							N.insert(PairOutputsAndStates{ { tr1.output, tr2.output },{ tr1.state, tr2.state } }); // Inserting  < <o1, o2>, <q1, q2>>
+							return;
 						}
-					}
-				}
-			}
+						chunkTransitions.Transitions.push_back({ o, next });
+						const auto position = ((unsigned long long) i << 32) + k++;
 
-			// Add the new pair of states.
-			for (const auto& pairOutputsAndStates : N)
-			{
-				const auto& p = pairOutputsAndStates.second;
-				const auto it = pForLookups.find(p);
-				if (it == pForLookups.end())
-				{
-					pForLookups[p] = (unsigned)pForIteration.size(); // The number of 'p' in the vector
-					pForIteration.push_back(p);
+						auto& shard = shards[GetPairIdsShard(next)];
+						std::unique_lock<std::mutex> lock(shard.Mutex, std::defer_lock);
+						if (locking)
+						{
+							lock.lock();
+						}
+						auto it = shard.Ids.find(next);
+						if (it == shard.Ids.end())
+						{
+							it = shard.Ids.emplace(next, PairId{ NEW_PAIR_ID, position }).first;
+							shard.NewPairs.push_back(&*it);
+						}
+						else if (it->second.id == NEW_PAIR_ID && position < it->second.firstSeen)
+						{
+							it->second.firstSeen = position;
+						}
+					});
+					chunkTransitions.Counts.push_back((size_t) k);
 				}
 			}
+		});
 
-			// Update the Squared FST's delta by adding a new state and it's transitions.
-			SquaredOutputTransducer::SOTStateTransitions newStateWithTransitions;
-			for (const auto& pairOutputsAndStates : N)
-			{
-				const auto& o = pairOutputsAndStates.first;
-				const auto& p = pairOutputsAndStates.second;
-				const auto it = pForLookups.find(p);
-				assert(it != pForLookups.end());
-
-				// add transition <k, o1, #p, o2> ; it->second is the #p and k is the new state.
-				newStateWithTransitions[o.first].insert(Transition{ it->second, o.second });
-			}
-			SOT.Delta.push_back(std::move(newStateWithTransitions));
+		// The ids of the new pairs in the order in which a sequential BFS finds them.
+		newPairs.clear();
+		for (auto& shard : shards)
+		{
+			newPairs.insert(newPairs.end(), shard.NewPairs.begin(), shard.NewPairs.end());
+			shard.NewPairs.clear();
 		}
-	}
-
-	SOT.FinalStates.clear();
-	SOT.InitialStates.clear();
-	for (unsigned i = 0, bound = (unsigned) pForIteration.size(); i < bound; ++i)
-	{
-		const auto& p = pForIteration[i];
-
-		// Update the initial states.
-		if (InitialStates.find(p.first) != InitialStates.end() &&
-			InitialStates.find(p.second) != InitialStates.end())
+		std::sort(newPairs.begin(), newPairs.end(), [](const std::pair<const StatesPair, PairId>* left, const std::pair<const StatesPair, PairId>* right)
+		{
+			return left->second.firstSeen < right->second.firstSeen;
+		});
+		for (auto newPair : newPairs)
+		{
+			newPair->second.id = (unsigned) graph.Pairs.size();
+			graph.Pairs.push_back(newPair->first);
+		}
+		if (graph.Pairs.size() > maxPairStatesCount)
 		{
-			SOT.InitialStates.insert(i);
+			return false;
 		}
 
-		// Update the final states.
-		if (FinalStates.find(p.first) != FinalStates.end() &&
-			FinalStates.find(p.second) != FinalStates.end())
+		// The table is not changed anymore in the level, so the ids of the destinations are found without locking.
+		for (size_t chunk = 0; chunk < chunksCount; ++chunk)
 		{
-			SOT.FinalStates.insert(i);
+			for (const auto count : chunks[chunk].Counts)
+			{
+				graph.Offsets.push_back(graph.Offsets.back() + count);
+			}
 		}
+		graph.Transitions.resize(graph.Offsets.back());
+		nextChunk = 0;
+		RunOnThreads(levelThreadsCount, [&]()
+		{
+			for (auto chunk = nextChunk++; chunk < chunksCount; chunk = nextChunk++)
+			{
+				auto transition = graph.Transitions.begin() + graph.Offsets[levelBegin + chunk * PARALLEL_PAIRS_CHUNK_SIZE];
+				for (const auto& chunkTransition : chunks[chunk].Transitions)
+				{
+					const auto& next = chunkTransition.second;
+					*transition++ = { chunkTransition.first, shards[GetPairIdsShard(next)].Ids.find(next)->second.id };
+				}
+			}
+		});
 	}
-}
+	TRACE_COUNTER("pair states", graph.Pairs.size());
 
-void FinalStateTransducer::UpdateRecognizingEmptyWord()
-{
-	RecognizingEmptyWord = RealTime ?
-		RealTimeIsRecognizingEmptyWord() :
-		StandardIsRecognizingEmptyWord();
+	return true;
 }
 
-// Works only for one-symbol transducer(the transitions are only with one symbol or epsilon)
-bool FinalStateTransducer::TraverseWithWord(const char* word, std::unordered_set<unsigned>& outputs) const
+TwinsPropertyResult FinalStateTransducer::TestForTwinsProperty(unsigned maxPairStatesCount, unsigned threadsCount) const
 {
-	if (IsRealTime())
+	TRACE_SCOPE("TestForTwinsProperty");
+	if (IsInfinite() || !IsRealTime())
 	{
-		return RealTimeTraverseWithWord(word, outputs);
+		return TwinsPropertyResult::DoesNotHold;
 	}
 
-	return StandardTrawerseWithWord(word, outputs);
-}
+	std::vector<bool> coReachable;
+	FindCoReachableStates(coReachable);
 
-bool FinalStateTransducer::StandardTrawerseWithWord(const char* word, std::unordered_set<unsigned>& outputs) const
-{
-	if (!word) return false;
-	const char* pWord = word;
-#if defined(INFO)
-	std::cout << "Standard Traversing with \"" << pWord << "\" word...\n";
+	// The pair states with co-reachable components which are reachable from I x I and the transitions between them.
+	PairStatesGraph graph;
+	const bool tooManyStates = !BuildPairStatesGraph(graph, threadsCount, maxPairStatesCount, &coReachable);
+#if defined(COLLECT_STATS)
+	Stats.twinsPairStatesCount = graph.Pairs.size();
 #endif
-
-	outputs.clear();
-	char strTmp[] = "x";
-
-	struct TraverseTransition
-	{
-		int state;
-		unsigned accumulatedOutput;
-	};
-	TraverseTransition BFSLevelSeparator{ -1, 0 };
-	std::deque<TraverseTransition> q;
-
-	q.push_back(BFSLevelSeparator);
-	for (const auto& initialStateIndex : InitialStates)
+	if (tooManyStates)
 	{
-		q.push_back(TraverseTransition{ static_cast<int>(initialStateIndex), 0 }); // Fictial initial transition with the empty word and no output to each initial state.
+		return TwinsPropertyResult::TooManyStates;
 	}
 
-#if defined (GUARD_FROM_EPSILON_CYCLE_ON_TRAVERSING)
-	typedef std::tuple<unsigned, unsigned, unsigned> VisitedPair; // .first is the source, .second is the destination state
-	std::unordered_set<VisitedPair,
-						boost::hash<VisitedPair>
-						> visitedStateToStateWithEpsilon;
-#endif
-	while (*pWord)
+	MonotonicArena arena;
+	const auto statesCount = (unsigned) graph.Pairs.size();
+	ArenaVector<ArenaVector<unsigned>> pairDelta(statesCount, ArenaVector<unsigned>(arena), arena); // The destinations of each pair state.
+	for (unsigned i = 0; i < statesCount; ++i)
 	{
-		TraverseTransition currTransition = q.front();
-		q.pop_front();
-
-		if (q.empty())
+		pairDelta[i].reserve(graph.Offsets[i + 1] - graph.Offsets[i]);
+		for (auto k = graph.Offsets[i]; k < graph.Offsets[i + 1]; ++k)
 		{
-			return false;
+			pairDelta[i].push_back(graph.Transitions[k].second);
 		}
-		assert(currTransition.state == -1); // Only the level separator can have negative state's index.
+	}
 
-		q.push_back(currTransition); // Move the separator to the "end".
+	std::vector<unsigned> component;
+	StronglyConnectedComponents(pairDelta, component);
 
-#if defined (GUARD_FROM_EPSILON_CYCLE_ON_TRAVERSING)
-		visitedStateToStateWithEpsilon.clear();
-#endif
-		// Read all states at the 'next' level and add the posibile transitions.
-		while (q.front().state != -1) // Untill the level separator.
+	// In each component give a delay to each state (starting with 0) which has to fit all transitions in the component.
+	std::vector<long long> delay(statesCount, 0);
+	std::vector<bool> assigned(statesCount, false);
+	std::vector<unsigned> q;
+	for (unsigned root = 0; root < statesCount; ++root)
+	{
+		if (assigned[root])
 		{
-			currTransition = q.front();
-			q.pop_front();
-			if (StatesWithEpsilonCycleWithPositiveOutput.find(currTransition.state) != StatesWithEpsilonCycleWithPositiveOutput.end())
-			{
-#if defined(INFO)
-				std::cout << "The word was with infinite ambiguous\n";
-#endif
-				return false;
-			}
+			continue;
+		}
 
-			// If the state has a transition with the symbol *word, then add it
-			//TODO remove the "hack"
-			strTmp[0] = *pWord;
-			auto it = Delta[currTransition.state].find(strTmp);
-			if (it != Delta[currTransition.state].end()) // Found a transition with *word symbol.
+		assigned[root] = true;
+		q.push_back(root);
+		while (!q.empty())
+		{
+			const auto curr = q.back();
+			q.pop_back();
+			for (size_t k = 0; k < pairDelta[curr].size(); ++k)
 			{
-				for (const auto& transition : it->second) // Add all found transitions to the next level, because we have read one more symbol.
+				const auto next = pairDelta[curr][k];
+				if (component[next] != component[curr])
 				{
-					q.push_back(TraverseTransition{ (int)transition.state, currTransition.accumulatedOutput + transition.output });
+					continue;
 				}
-			}
 
-			it = Delta[currTransition.state].find("");
-			if (it != Delta[currTransition.state].end()) // There are epsilon transitions from this state to others.
-			{
-				for (const auto& transition : it->second) // Add them to the current level, because we have reached them withoud reading a symbol.
+				const auto& o = graph.Transitions[graph.Offsets[curr] + k].first;
+				const auto nextDelay = delay[curr] + ((long long) o.second - (long long) o.first);
+				if (!assigned[next])
 				{
-#if defined (GUARD_FROM_EPSILON_CYCLE_ON_TRAVERSING)
-					const auto accomulatedOutput = currTransition.accumulatedOutput + transition.output;
-					const std::tuple<unsigned, unsigned, unsigned> visitedPairWithEpsilon { currTransition.state, transition.state, accomulatedOutput };
-					if (visitedStateToStateWithEpsilon.find(visitedPairWithEpsilon) != visitedStateToStateWithEpsilon.end())
-					{
-						continue;
-					}
-					visitedStateToStateWithEpsilon.insert(visitedPairWithEpsilon);
-#endif
-					q.push_front(TraverseTransition{ (int)transition.state, currTransition.accumulatedOutput + transition.output });
+					assigned[next] = true;
+					delay[next] = nextDelay;
+					q.push_back(next);
+				}
+				else if (delay[next] != nextDelay)
+				{
+					return TwinsPropertyResult::DoesNotHold; // A cycle with different outputs.
 				}
 			}
-			assert(!q.empty());
 		}
-		++pWord;
 	}
 
-	if (q.empty())
+	return TwinsPropertyResult::Holds;
+}
+
+/*
+	Determinization with delayed outputs: a state of the subsequential transducer is a set of <q, r> pairs,
+	where 'r' is the output which is still not written when the transducer is in the state 'q'.
+	From a set S with symbol 'a' the transition writes the smallest m = r + o for <q, r> in S and q --a:o--> q'
+	and goes to the set of all <q', r + o - m>.
+	Only the co-reachable states are used, otherwise the not written outputs might grow forever.
+*/
+bool FinalStateTransducer::MakeSubsequential(unsigned maxStatesCount, unsigned threadsCount)
+{
+	TRACE_SCOPE("MakeSubsequential");
+	Subsequential.Clear();
+	IsSubsequentialDelta = false;
+	if (!IsRealTime() || !IsFunctional())
 	{
-		std::cout << "\tSomething went wrong...\n";
 		return false;
 	}
-	assert(q.front().state == -1);
-	q.pop_front(); // Remove the level separator.
 
-	// TODO the first one is the level separator...
+	if (TestForTwinsProperty(maxStatesCount, threadsCount) != TwinsPropertyResult::Holds)
+	{
+		return false;
+	}
+
+	std::vector<bool> coReachable;
+	FindCoReachableStates(coReachable);
+
+	MonotonicArena arena;
+	typedef ArenaVector<std::pair<unsigned, Output>> Subset; // <q, r> sorted by 'q'
+	ArenaUnorderedMap<Subset, unsigned, boost::hash<Subset>> subsetsForLookups(arena); // the subset and its id (the place in the iteration vector)
+	ArenaVector<Subset> subsetsForIteration(arena);
+
+	Subset initialSubset(arena);
+	for (const auto& initialStateIndex : InitialStates)
+	{
+		if (coReachable[initialStateIndex])
+		{
+			initialSubset.push_back({ initialStateIndex, 0 });
+		}
+	}
+	std::sort(initialSubset.begin(), initialSubset.end());
+	subsetsForLookups[initialSubset] = 0;
+	subsetsForIteration.push_back(std::move(initialSubset));
+
+	typedef std::tuple<unsigned char, unsigned, Output> SymbolStateAndOutput; // <a, q', r + o>
+	std::vector<SymbolStateAndOutput> next;
+	Subset nextSubset(arena);
+	for (size_t i = 0; i < subsetsForIteration.size(); ++i)
+	{
+		Subsequential.StateOffsets.push_back((unsigned) Subsequential.Transitions.size());
+
+		const Subset& subset = subsetsForIteration[i]; // Used only before the vector grows (with the next subsets below).
+		bool final = false;
+		Output finalOutput = 0;
+		next.clear();
+		for (const auto& stateAndOutput : subset)
+		{
+			const auto& q = stateAndOutput.first;
+			const auto& r = stateAndOutput.second;
+			if (FinalStates.find(q) != FinalStates.end())
+			{
+				if (final && finalOutput != r)
+				{
+					Subsequential.Clear();
+					return false; // Two outputs for the same word.
+				}
+				final = true;
+				finalOutput = r;
+			}
+
+			for (const auto& transitions : Delta[q])
+			{
+				const auto symbol = LabelSymbol(transitions.first);
+				for (const auto& transition : transitions.second)
+				{
+					if (coReachable[transition.state])
+					{
+						next.push_back(SymbolStateAndOutput{ symbol, transition.state, AddOutputs(r, transition.output) });
+					}
+				}
+			}
+		}
+		Subsequential.FinalStates.push_back(final);
+		Subsequential.FinalOutputs.push_back(finalOutput);
+
+		std::sort(next.begin(), next.end());
+		for (size_t begin = 0, end = 0; begin < next.size(); begin = end)
+		{
+			const auto symbol = std::get<0>(next[begin]);
+			auto m = std::get<2>(next[begin]);
+			for (end = begin; end < next.size() && std::get<0>(next[end]) == symbol; ++end)
+			{
+				m = std::min(m, std::get<2>(next[end]));
+			}
+
+			nextSubset.clear();
+			for (auto k = begin; k < end; ++k)
+			{
+				const auto state = std::get<1>(next[k]);
+				const auto output = std::get<2>(next[k]) - m;
+				if (!nextSubset.empty() && nextSubset.back().first == state)
+				{
+					if (nextSubset.back().second != output)
+					{
+						Subsequential.Clear();
+						return false; // Two outputs for the same word.
+					}
+					continue;
+				}
+				nextSubset.push_back({ state, output });
+			}
+
+			auto it = subsetsForLookups.find(nextSubset);
+			if (it == subsetsForLookups.end())
+			{
+				if (subsetsForIteration.size() >= maxStatesCount)
+				{
+#if defined(INFO)
+					std::cout << "The subsequential transducer needs more than " << maxStatesCount << " states.\n";
+#endif
+					Subsequential.Clear();
+					return false;
+				}
+				it = subsetsForLookups.insert({ nextSubset, (unsigned) subsetsForIteration.size() }).first;
+				subsetsForIteration.push_back(nextSubset);
+			}
+
+			Subsequential.Symbols.push_back(symbol);
+			Subsequential.Transitions.push_back(Transition{ it->second, m });
+		}
+	}
+	Subsequential.StateOffsets.push_back((unsigned) Subsequential.Transitions.size());
+	Subsequential.InitialOutput = 0;
+
+	MinimizeSubsequential(arena);
+
+	return IsSubsequentialDelta = true;
+}
+
+void FinalStateTransducer::MinimizeSubsequential(MonotonicArena& arena)
+{
+	TRACE_SCOPE("MinimizeSubsequential");
+	auto& S = Subsequential;
+	const auto statesCount = (unsigned) S.StateOffsets.size() - 1;
+	const auto INFINITE_OUTPUT = MAX_OUTPUT;
+
+	// d[q] is the smallest output from 'q' to a final state (including the final output), Dijkstra on the reversed transitions.
+	ArenaVector<ArenaVector<Transition>> reversedDelta(statesCount, ArenaVector<Transition>(arena), arena);
+	for (unsigned q = 0; q < statesCount; ++q)
+	{
+		for (auto k = S.StateOffsets[q]; k < S.StateOffsets[q + 1]; ++k)
+		{
+			reversedDelta[S.Transitions[k].state].push_back(Transition{ q, S.Transitions[k].output });
+		}
+	}
+	std::vector<Output> d(statesCount, INFINITE_OUTPUT);
+	typedef std::pair<Output, unsigned> OutputAndState;
+	std::priority_queue<OutputAndState, std::vector<OutputAndState>, std::greater<OutputAndState>> q;
+	for (unsigned i = 0; i < statesCount; ++i)
+	{
+		if (S.FinalStates[i])
+		{
+			d[i] = S.FinalOutputs[i];
+			q.push({ d[i], i });
+		}
+	}
+	while (!q.empty())
+	{
+		const auto curr = q.top();
+		q.pop();
+		if (curr.first != d[curr.second])
+		{
+			continue;
+		}
+		for (const auto& transition : reversedDelta[curr.second])
+		{
+			const auto output = AddOutputs(curr.first, transition.output);
+			if (output < d[transition.state])
+			{
+				d[transition.state] = output;
+				q.push({ d[transition.state], transition.state });
+			}
+		}
+	}
+
+	// Push the outputs: q --a:o--> q' becomes q --a:(o + d[q'] - d[q])--> q'. Only the initial state might not be co-reachable.
+	if (d[0] != INFINITE_OUTPUT)
+	{
+		S.InitialOutput += d[0];
+	}
+	for (unsigned i = 0; i < statesCount; ++i)
+	{
+		for (auto k = S.StateOffsets[i]; k < S.StateOffsets[i + 1]; ++k)
+		{
+			auto& transition = S.Transitions[k];
+			transition.output = transition.output + d[transition.state] - d[i];
+		}
+		if (S.FinalStates[i])
+		{
+			S.FinalOutputs[i] -= d[i];
+		}
+	}
+
+	/*
+		Hopcroft's partition refinement, the letters are the <symbol, output> pairs of the transitions.
+		The states are split by their final outputs, then a block B splits each block C to the states with a transition
+		with letter 'a' to B and the others. The transitions are partial, so all initial blocks are splitters.
+		The block 'i' is elements[blockStart[i]] ... elements[blockEnd[i] - 1].
+	*/
+	ArenaMap<std::pair<unsigned char, Output>, unsigned> letters(arena);
+	ArenaVector<ArenaVector<std::pair<unsigned, unsigned>>> reversedLetters(statesCount, // <letter, source> for each destination
+		ArenaVector<std::pair<unsigned, unsigned>>(arena), arena);
+	for (unsigned i = 0; i < statesCount; ++i)
+	{
+		for (auto k = S.StateOffsets[i]; k < S.StateOffsets[i + 1]; ++k)
+		{
+			const auto letter = letters.insert({ { S.Symbols[k], S.Transitions[k].output }, (unsigned) letters.size() }).first->second;
+			reversedLetters[S.Transitions[k].state].push_back({ letter, i });
+		}
+	}
+
+	std::vector<unsigned> elements(statesCount), location(statesCount), blockOf(statesCount);
+	std::vector<unsigned> blockStart, blockEnd, marked;
+	{
+		ArenaMap<std::pair<bool, Output>, unsigned> initialBlocks(arena);
+		for (unsigned i = 0; i < statesCount; ++i)
+		{
+			blockOf[i] = initialBlocks.insert({ { S.FinalStates[i], S.FinalStates[i] ? S.FinalOutputs[i] : 0 }, (unsigned) initialBlocks.size() }).first->second;
+		}
+		blockStart.assign(initialBlocks.size() + 1, 0);
+		for (unsigned i = 0; i < statesCount; ++i)
+		{
+			++blockStart[blockOf[i] + 1];
+		}
+		for (size_t b = 1; b < blockStart.size(); ++b)
+		{
+			blockStart[b] += blockStart[b - 1];
+		}
+		blockEnd.assign(blockStart.begin(), blockStart.end() - 1);
+		blockStart.pop_back();
+		for (unsigned i = 0; i < statesCount; ++i)
+		{
+			location[i] = blockEnd[blockOf[i]]++;
+			elements[location[i]] = i;
+		}
+		marked.assign(blockStart.size(), 0);
+	}
+
+	std::vector<unsigned> worklist;
+	std::vector<bool> inWorklist(blockStart.size(), true);
+	for (unsigned b = 0; b < blockStart.size(); ++b)
+	{
+		worklist.push_back(b);
+	}
+
+	std::vector<std::pair<unsigned, unsigned>> incoming; // <letter, source>
+	std::vector<unsigned> touchedBlocks;
+	while (!worklist.empty())
+	{
+		const auto B = worklist.back();
+		worklist.pop_back();
+		inWorklist[B] = false;
+
+		incoming.clear();
+		for (auto i = blockStart[B]; i < blockEnd[B]; ++i)
+		{
+			const auto& reversed = reversedLetters[elements[i]];
+			incoming.insert(incoming.end(), reversed.begin(), reversed.end());
+		}
+		std::sort(incoming.begin(), incoming.end());
+
+		for (size_t begin = 0, end = 0; begin < incoming.size(); begin = end)
+		{
+			// Move the sources with this letter to the beginning of their blocks. Each source has only one transition with the letter's symbol.
+			touchedBlocks.clear();
+			for (end = begin; end < incoming.size() && incoming[end].first == incoming[begin].first; ++end)
+			{
+				const auto p = incoming[end].second;
+				const auto C = blockOf[p];
+				if (marked[C] == 0)
+				{
+					touchedBlocks.push_back(C);
+				}
+				const auto to = blockStart[C] + marked[C]++;
+				const auto other = elements[to];
+				std::swap(elements[location[p]], elements[to]);
+				location[other] = location[p];
+				location[p] = to;
+			}
+
+			for (const auto C : touchedBlocks)
+			{
+				if (blockStart[C] + marked[C] == blockEnd[C])
+				{
+					marked[C] = 0;
+					continue;
+				}
+
+				// The marked ones become a new block D.
+				const auto D = (unsigned) blockStart.size();
+				blockStart.push_back(blockStart[C]);
+				blockEnd.push_back(blockStart[C] + marked[C]);
+				marked.push_back(0);
+				blockStart[C] = blockEnd[D];
+				marked[C] = 0;
+				for (auto i = blockStart[D]; i < blockEnd[D]; ++i)
+				{
+					blockOf[elements[i]] = D;
+				}
+
+				if (inWorklist[C] || blockEnd[D] - blockStart[D] < blockEnd[C] - blockStart[C])
+				{
+					worklist.push_back(D);
+					inWorklist.push_back(true);
+				}
+				else
+				{
+					worklist.push_back(C);
+					inWorklist[C] = true;
+					inWorklist.push_back(false);
+				}
+			}
+		}
+	}
+	const auto& classes = blockOf;
+	const size_t classesCount = blockStart.size();
+
+	// Build the minimal one, the initial state 0 is the first one and keeps its index.
+	const auto REMOVED_STATE = unsigned(-1);
+	std::vector<unsigned> classStates(classesCount, REMOVED_STATE); // The new index of each class.
+	std::vector<unsigned> representatives;
+	for (unsigned i = 0; i < statesCount; ++i)
+	{
+		if (classStates[classes[i]] == REMOVED_STATE)
+		{
+			classStates[classes[i]] = (unsigned) representatives.size();
+			representatives.push_back(i);
+		}
+	}
+
+	SubsequentialDelta minimal;
+	minimal.InitialOutput = S.InitialOutput;
+	for (const auto& i : representatives)
+	{
+		minimal.StateOffsets.push_back((unsigned) minimal.Transitions.size());
+		for (auto k = S.StateOffsets[i]; k < S.StateOffsets[i + 1]; ++k)
+		{
+			minimal.Symbols.push_back(S.Symbols[k]);
+			minimal.Transitions.push_back(Transition{ classStates[classes[S.Transitions[k].state]], S.Transitions[k].output });
+		}
+		minimal.FinalStates.push_back(S.FinalStates[i]);
+		minimal.FinalOutputs.push_back(S.FinalOutputs[i]);
+	}
+	minimal.StateOffsets.push_back((unsigned) minimal.Transitions.size());
+
+	S = std::move(minimal);
+}
+
+bool FinalStateTransducer::IsSubsequential() const
+{
+	return IsSubsequentialDelta;
+}
+
+void FinalStateTransducer::SubsequentialDelta::Clear()
+{
+	StateOffsets.clear();
+	Symbols.clear();
+	Transitions.clear();
+	FinalStates.clear();
+	FinalOutputs.clear();
+	InitialOutput = 0;
+}
+
+void FinalStateTransducer::Proj1_2(SetOfTransitions& r) const
+{
+	for (unsigned i = 0, bound = (unsigned) Delta.size(); i < bound; ++i)
+	{
+		for (const auto& transitions : Delta[i])
+		{
+			for (const auto& transition : transitions.second)
+			{
+				r[i].insert(transition.state);
+			}
+		}
+	}
+}
+
+void FinalStateTransducer::UpdateRecognizingEmptyWord()
+{
+	RecognizingEmptyWord = RealTime ?
+		RealTimeIsRecognizingEmptyWord() :
+		StandardIsRecognizingEmptyWord();
+}
+
+// Works only for one-symbol transducer(the transitions are only with one symbol or epsilon)
+bool FinalStateTransducer::TraverseWithWord(const char* word, std::unordered_set<Output>& outputs) const
+{
+	if (IsSubsequential())
+	{
+		return SubsequentialTraverseWithWord(word, outputs);
+	}
+
+	if (IsFrozen())
+	{
+		return FrozenTraverseWithWord(word, outputs);
+	}
+
+	if (IsRealTime())
+	{
+		return RealTimeTraverseWithWord(word, outputs);
+	}
+
+	return StandardTrawerseWithWord(word, outputs);
+}
+
+bool FinalStateTransducer::StandardTrawerseWithWord(const char* word, std::unordered_set<Output>& outputs) const
+{
+	if (!word) return false;
+	const char* pWord = word;
+#if defined(INFO)
+	std::cout << "Standard Traversing with \"" << pWord << "\" word...\n";
+#endif
+
+	outputs.clear();
+	struct TraverseTransition
+	{
+		int state;
+		Output accumulatedOutput;
+	};
+	TraverseTransition BFSLevelSeparator{ -1, 0 };
+	std::deque<TraverseTransition> q;
+
+	// The <state, accumulated output> pairs already added to the current and to the next level, each one is added only once.
+	std::unordered_set<Transition> currLevel, nextLevel;
+
+	q.push_back(BFSLevelSeparator);
+	for (const auto& initialStateIndex : InitialStates)
+	{
+		if (currLevel.insert(Transition{ initialStateIndex, 0 }).second)
+		{
+			q.push_back(TraverseTransition{ static_cast<int>(initialStateIndex), 0 }); // Fictial initial transition with the empty word and no output to each initial state.
+		}
+	}
+
+#if defined (GUARD_FROM_EPSILON_CYCLE_ON_TRAVERSING)
+	typedef std::tuple<unsigned, unsigned, Output> VisitedPair; // .first is the source, .second is the destination state
+	std::unordered_set<VisitedPair,
+						boost::hash<VisitedPair>
+						> visitedStateToStateWithEpsilon;
+#endif
+	while (*pWord)
+	{
+		TraverseTransition currTransition = q.front();
+		q.pop_front();
+
+		if (q.empty())
+		{
+			return false;
+		}
+		assert(currTransition.state == -1); // Only the level separator can have negative state's index.
+
+		q.push_back(currTransition); // Move the separator to the "end".
+
+#if defined (GUARD_FROM_EPSILON_CYCLE_ON_TRAVERSING)
+		visitedStateToStateWithEpsilon.clear();
+#endif
+		nextLevel.clear();
+		// Read all states at the 'next' level and add the posibile transitions.
+		while (q.front().state != -1) // Untill the level separator.
+		{
+			currTransition = q.front();
+			q.pop_front();
+			if (StatesWithEpsilonCycleWithPositiveOutput.find(currTransition.state) != StatesWithEpsilonCycleWithPositiveOutput.end())
+			{
+#if defined(INFO)
+				std::cout << "The word was with infinite ambiguous\n";
+#endif
+				return false;
+			}
+
+			// If the state has a transition with the symbol *word, then add it
+			auto it = Delta[currTransition.state].find(SymbolLabel(*pWord));
+			if (it != Delta[currTransition.state].end()) // Found a transition with *word symbol.
+			{
+				for (const auto& transition : it->second) // Add all found transitions to the next level, because we have read one more symbol.
+				{
+					const auto accumulatedOutput = AddOutputs(currTransition.accumulatedOutput, transition.output);
+					if (nextLevel.insert(Transition{ transition.state, accumulatedOutput }).second)
+					{
+						q.push_back(TraverseTransition{ (int)transition.state, accumulatedOutput });
+					}
+				}
+			}
+
+			it = Delta[currTransition.state].find(EPSILON_LABEL);
+			if (it != Delta[currTransition.state].end()) // There are epsilon transitions from this state to others.
+			{
+				for (const auto& transition : it->second) // Add them to the current level, because we have reached them withoud reading a symbol.
+				{
+#if defined (GUARD_FROM_EPSILON_CYCLE_ON_TRAVERSING)
+					const auto accomulatedOutput = AddOutputs(currTransition.accumulatedOutput, transition.output);
+					const std::tuple<unsigned, unsigned, Output> visitedPairWithEpsilon { currTransition.state, transition.state, accomulatedOutput };
+					if (visitedStateToStateWithEpsilon.find(visitedPairWithEpsilon) != visitedStateToStateWithEpsilon.end())
+					{
+						continue;
+					}
+					visitedStateToStateWithEpsilon.insert(visitedPairWithEpsilon);
+#endif
+					const auto accumulatedOutput = AddOutputs(currTransition.accumulatedOutput, transition.output);
+					if (currLevel.insert(Transition{ transition.state, accumulatedOutput }).second)
+					{
+						q.push_front(TraverseTransition{ (int)transition.state, accumulatedOutput });
+					}
+				}
+			}
+			assert(!q.empty());
+		}
+		currLevel.swap(nextLevel);
+		++pWord;
+	}
+
+	if (q.empty())
+	{
+		std::cout << "\tSomething went wrong...\n";
+		return false;
+	}
+	assert(q.front().state == -1);
+	q.pop_front(); // Remove the level separator.
+
+	// TODO the first one is the level separator...
 	// Try to find an final state on the last reached
-	std::unordered_set<unsigned> accumulatedOutputs;
+	std::unordered_set<Output> accumulatedOutputs;
 #if defined (GUARD_FROM_EPSILON_CYCLE_ON_TRAVERSING)
 	visitedStateToStateWithEpsilon.clear();
 #endif
@@ -1049,126 +1996,524 @@ bool FinalStateTransducer::StandardTrawerseWithWord(const char* word, std::unord
 			accumulatedOutputs.insert(currTransition.accumulatedOutput);
 		}
 
-		const auto it = Delta[currTransition.state].find("");
+		const auto it = Delta[currTransition.state].find(EPSILON_LABEL);
 		if (it != Delta[currTransition.state].end()) // There are epsilon transitions from this state to others which might be finils.
 		{
 			for (const auto& transition : it->second) // Add them to the current level, because we have reached them withoud reading a symbol.
 			{
 #if defined (GUARD_FROM_EPSILON_CYCLE_ON_TRAVERSING)
-				const auto accomulatedOutput = currTransition.accumulatedOutput + transition.output;
-				const std::tuple<unsigned, unsigned, unsigned> visitedPairWithEpsilon{ currTransition.state, transition.state, accomulatedOutput };
+				const auto accomulatedOutput = AddOutputs(currTransition.accumulatedOutput, transition.output);
+				const std::tuple<unsigned, unsigned, Output> visitedPairWithEpsilon{ currTransition.state, transition.state, accomulatedOutput };
 				if (visitedStateToStateWithEpsilon.find(visitedPairWithEpsilon) != visitedStateToStateWithEpsilon.end())
 				{
 					continue;
 				}
 				visitedStateToStateWithEpsilon.insert(visitedPairWithEpsilon);
 #endif
-				q.push_back(TraverseTransition{ (int)transition.state, currTransition.accumulatedOutput + transition.output });
+				const auto accumulatedOutput = AddOutputs(currTransition.accumulatedOutput, transition.output);
+				if (currLevel.insert(Transition{ transition.state, accumulatedOutput }).second)
+				{
+					q.push_back(TraverseTransition{ (int)transition.state, accumulatedOutput });
+				}
 			}
 		}
 
-		q.pop_front();
+		q.pop_front();
+	}
+
+	if (!*word && RecognizingEmptyWord)
+	{
+		outputs = std::move(InitialEpsilonOutputs);
+		outputs.insert(0);
+	}
+	else
+	{
+		outputs = std::move(accumulatedOutputs);
+	}
+
+	return !outputs.empty();
+}
+
+bool FinalStateTransducer::RealTimeTraverseWithWord(const char* word, std::unordered_set<Output>& outputs) const
+{
+	if (!word) return false;
+	const char* pWord = word;
+#if defined(INFO)
+	std::cout << "RealTime Traversing with \"" << pWord << "\" word...\n";
+#endif
+
+	struct TraverseTransition
+	{
+		int state;
+		Output accumulatedOutput;
+	};
+	TraverseTransition BFSLevelSeparator{ -1, 0 };
+	std::deque<TraverseTransition> q;
+
+	// The <state, accumulated output> pairs already added to the next level, each one is added only once.
+	std::unordered_set<Transition> nextLevel;
+
+	q.push_back(BFSLevelSeparator);
+	for (const auto& initialStateIndex : InitialStates)
+	{
+		q.push_back(TraverseTransition{ static_cast<int>(initialStateIndex), 0 }); // Fictial initial transition with the empty word and no output to each initial state.
+	}
+#if defined(COLLECT_STATS)
+	std::vector<size_t> frontierSizes(1, InitialStates.size());
+#endif
+
+	while (*pWord)
+	{
+		TraverseTransition currTransition = q.front();
+		q.pop_front();
+
+		if (q.empty())
+		{
+#if defined(COLLECT_STATS)
+			AddFrontierSizes(frontierSizes, 1, *std::max_element(frontierSizes.begin(), frontierSizes.end()));
+#endif
+			return false;
+		}
+		assert(currTransition.state == -1); // Only the level separator can have negative state's index.
+
+		q.push_back(currTransition); // Move the separator to the "end".
+
+		nextLevel.clear();
+		// Read all states at the 'next' level and add the posibile transitions.
+		while (q.front().state != -1) // Untill the level separator.
+		{
+			currTransition = q.front();
+			q.pop_front();
+
+			// If the state has a transition with the symbol *word, then add it
+			auto it = Delta[currTransition.state].find(SymbolLabel(*pWord));
+			if (it != Delta[currTransition.state].end()) // Found a transition with *word symbol.
+			{
+				for (const auto& transition : it->second) // Add all found transitions to the next level, because we have read one more symbol.
+				{
+					const auto accumulatedOutput = AddOutputs(currTransition.accumulatedOutput, transition.output);
+					if (nextLevel.insert(Transition{ transition.state, accumulatedOutput }).second)
+					{
+						q.push_back(TraverseTransition{ (int)transition.state, accumulatedOutput });
+					}
+				}
+			}
+
+			assert(!q.empty());
+		}
+#if defined(COLLECT_STATS)
+		frontierSizes.push_back(nextLevel.size());
+#endif
+		++pWord;
+	}
+#if defined(COLLECT_STATS)
+	AddFrontierSizes(frontierSizes, 1, *std::max_element(frontierSizes.begin(), frontierSizes.end()));
+#endif
+
+	assert(!q.empty());
+	assert(q.front().state == -1);
+	q.pop_front(); // Remove the level separator.
+
+	std::unordered_set<Output> accumulatedOutputs;
+	while (!q.empty())
+	{
+		const auto& currTransition = q.front();
+		if (FinalStates.find(currTransition.state) != FinalStates.end())
+		{
+			accumulatedOutputs.insert(currTransition.accumulatedOutput);
+		}
+		q.pop_front();
+	}
+
+	if (!*word && RecognizingEmptyWord)
+	{
+		outputs = std::move(InitialEpsilonOutputs);
+		outputs.insert(0);
+	}
+	else
+	{
+		outputs = std::move(accumulatedOutputs);
+	}
+
+	return !outputs.empty();
+}
+
+FrozenTransitions FinalStateTransducer::FrozenDelta::GetTransitions() const
+{
+	return FrozenTransitions{ StateOffsets.data(), Symbols.data(), Transitions.data(),
+		StateIndexes.empty() ? nullptr : StateIndexes.data(), SymbolOffsets.data(), Bitmaps.data() };
+}
+
+bool FinalStateTransducer::FrozenTraverseWithWord(const char* word, std::unordered_set<Output>& outputs) const
+{
+	if (!word) return false;
+#if defined(INFO)
+	std::cout << "Frozen Traversing with \"" << word << "\" word...\n";
+#endif
+
+	outputs.clear();
+
+	std::vector<Transition> currLevel, nextLevel; // The BFS levels (<state, accumulated output>), no need of separators.
+
+	for (const auto& initialStateIndex : InitialStates)
+	{
+		currLevel.push_back(Transition{ initialStateIndex, 0 }); // Fictial initial transition with the empty word and no output to each initial state.
+	}
+
+#if defined(COLLECT_STATS)
+	std::vector<size_t> frontierSizes;
+	const bool traversed = TraverseFrozenTransitions(Frozen.GetTransitions(), word, currLevel, nextLevel, &frontierSizes);
+	AddFrontierSizes(frontierSizes, 1, *std::max_element(frontierSizes.begin(), frontierSizes.end()));
+#else
+	const bool traversed = TraverseFrozenTransitions(Frozen.GetTransitions(), word, currLevel, nextLevel, nullptr);
+#endif
+	if (!traversed)
+	{
+		return false;
 	}
 
 	if (!*word && RecognizingEmptyWord)
 	{
-		outputs = std::move(InitialEpsilonOutputs);
+		outputs = InitialEpsilonOutputs;
 		outputs.insert(0);
 	}
 	else
 	{
-		outputs = std::move(accumulatedOutputs);
+		for (const auto& currTransition : currLevel)
+		{
+			if (Frozen.FinalStates[currTransition.state])
+			{
+				outputs.insert(currTransition.output);
+			}
+		}
 	}
 
 	return !outputs.empty();
 }
 
-bool FinalStateTransducer::RealTimeTraverseWithWord(const char* word, std::unordered_set<unsigned>& outputs) const
+const Transition* FinalStateTransducer::FindSubsequentialTransition(unsigned state, unsigned char symbol) const
+{
+	const auto symbols = Subsequential.Symbols.data();
+	const auto last = symbols + Subsequential.StateOffsets[state + 1];
+	const auto it = std::lower_bound(symbols + Subsequential.StateOffsets[state], last, symbol);
+	if (it == last || *it != symbol)
+	{
+		return nullptr;
+	}
+	return Subsequential.Transitions.data() + (it - symbols);
+}
+
+bool FinalStateTransducer::SubsequentialTraverseWithWord(const char* word, std::unordered_set<Output>& outputs) const
 {
 	if (!word) return false;
-	const char* pWord = word;
 #if defined(INFO)
-	std::cout << "RealTime Traversing with \"" << pWord << "\" word...\n";
+	std::cout << "Subsequential Traversing with \"" << word << "\" word...\n";
 #endif
 
-	char strTmp[] = "x";
+	outputs.clear();
+	if (!*word && RecognizingEmptyWord)
+	{
+		outputs = InitialEpsilonOutputs;
+		outputs.insert(0);
+		return true;
+	}
 
-	struct TraverseTransition
+	unsigned state = 0;
+	Output output = Subsequential.InitialOutput;
+	for (const char* pWord = word; *pWord; ++pWord)
 	{
-		int state;
-		unsigned accumulatedOutput;
-	};
-	TraverseTransition BFSLevelSeparator{ -1, 0 };
-	std::deque<TraverseTransition> q;
+		const auto transition = FindSubsequentialTransition(state, (unsigned char) *pWord);
+		if (!transition)
+		{
+			return false;
+		}
+		state = transition->state;
+		output = AddOutputs(output, transition->output);
+	}
+
+	if (!Subsequential.FinalStates[state])
+	{
+		return false;
+	}
+	outputs.insert(AddOutputs(output, Subsequential.FinalOutputs[state]));
+	return true;
+}
+
+bool FinalStateTransducer::TraverseWithWordForOutput(const char* word, OutputQuery query, Output& output) const
+{
+	return query == OutputQuery::Min ? TraverseWithWordIn<TropicalSemiring>(word, output) : TraverseWithWordIn<MaxPlusSemiring>(word, output);
+}
+
+void FinalStateTransducer::AddInitialLevel(std::vector<Transition>& level) const
+{
+	if (IsSubsequential())
+	{
+		level.push_back(Transition{ 0, Subsequential.InitialOutput });
+		return;
+	}
 
-	q.push_back(BFSLevelSeparator);
 	for (const auto& initialStateIndex : InitialStates)
 	{
-		q.push_back(TraverseTransition{ static_cast<int>(initialStateIndex), 0 }); // Fictial initial transition with the empty word and no output to each initial state.
+		level.push_back(Transition{ initialStateIndex, 0 }); // Fictial initial transition with the empty word and no output to each initial state.
 	}
+}
 
-	while (*pWord)
+bool FinalStateTransducer::GetFinalOutput(unsigned state, Output accumulatedOutput, Output& output) const
+{
+	if (IsSubsequential())
 	{
-		TraverseTransition currTransition = q.front();
-		q.pop_front();
+		output = AddOutputs(accumulatedOutput, Subsequential.FinalOutputs[state]);
+		return Subsequential.FinalStates[state];
+	}
 
-		if (q.empty())
+	output = accumulatedOutput;
+	return IsFrozen() ? Frozen.FinalStates[state] : FinalStates.find(state) != FinalStates.end();
+}
+
+void FinalStateTransducer::AddFinalOutputs(const Transition* first, const Transition* last, std::vector<Output>& outputs) const
+{
+	Output output;
+	for (auto curr = first; curr != last; ++curr)
+	{
+		if (GetFinalOutput(curr->state, curr->output, output))
 		{
-			return false;
+			outputs.push_back(output);
 		}
-		assert(currTransition.state == -1); // Only the level separator can have negative state's index.
+	}
+}
 
-		q.push_back(currTransition); // Move the separator to the "end".
+void FinalStateTransducer::AddTransitionsWithSymbol(unsigned state, Output accumulatedOutput, unsigned char symbol, std::vector<Transition>& nextLevel) const
+{
+	ForEachTransitionWithSymbol(state, symbol, [&](const Transition& transition)
+	{
+		nextLevel.push_back(Transition{ transition.state, AddOutputs(accumulatedOutput, transition.output) });
+	});
+}
 
-		// Read all states at the 'next' level and add the posibile transitions.
-		while (q.front().state != -1) // Untill the level separator.
-		{
-			currTransition = q.front();
-			q.pop_front();
+size_t FinalStateTransducer::TraverseBatch(const std::vector<std::string>& words, TraverseBatchResult& result) const
+{
+	TraverseBatchScratch scratch;
+	return TraverseBatch(words, result, scratch);
+}
 
-			// If the state has a transition with the symbol *word, then add it
-			//TODO remove the "hack"
-			strTmp[0] = *pWord;
-			auto it = Delta[currTransition.state].find(strTmp);
-			if (it != Delta[currTransition.state].end()) // Found a transition with *word symbol.
+size_t FinalStateTransducer::TraverseBatch(const std::vector<std::string>& words, TraverseBatchResult& result, TraverseBatchScratch& scratch) const
+{
+	result.Offsets.clear();
+	result.Outputs.clear();
+	result.Offsets.reserve(words.size() + 1);
+	result.Offsets.push_back(0);
+	size_t recognizedWords = 0;
+
+	if (!IsRealTime())
+	{
+		std::unordered_set<Output> outputs;
+		for (const auto& word : words)
+		{
+			if (TraverseWithWord(word.c_str(), outputs))
 			{
-				for (const auto& transition : it->second) // Add all found transitions to the next level, because we have read one more symbol.
-				{
-					q.push_back(TraverseTransition{ (int)transition.state, currTransition.accumulatedOutput + transition.output });
-				}
+				++recognizedWords;
 			}
-
-			assert(!q.empty());
+			const auto begin = result.Outputs.size();
+			result.Outputs.insert(result.Outputs.end(), outputs.begin(), outputs.end());
+			std::sort(result.Outputs.begin() + begin, result.Outputs.end());
+			result.Offsets.push_back(result.Outputs.size());
 		}
-		++pWord;
+		return recognizedWords;
 	}
 
-	assert(!q.empty());
-	assert(q.front().state == -1);
-	q.pop_front(); // Remove the level separator.
+	SortWords(words, scratch.Order);
+	scratch.Outputs.clear();
+	scratch.WordOutputs.resize(words.size());
+	recognizedWords = TraverseSortedWords(words, scratch.Order.data(), scratch.Order.data() + scratch.Order.size(), scratch, scratch.WordOutputs.data());
 
-	std::unordered_set<unsigned> accumulatedOutputs;
-	while (!q.empty())
+	// Write the outputs in the order of the words.
+	result.Outputs.reserve(scratch.Outputs.size());
+	for (const auto& wordOutputs : scratch.WordOutputs)
 	{
-		const auto& currTransition = q.front();
-		if (FinalStates.find(currTransition.state) != FinalStates.end())
+		result.Outputs.insert(result.Outputs.end(), scratch.Outputs.begin() + wordOutputs.first, scratch.Outputs.begin() + wordOutputs.second);
+		result.Offsets.push_back(result.Outputs.size());
+	}
+
+	return recognizedWords;
+}
+
+size_t FinalStateTransducer::TraverseBatchParallel(const std::vector<std::string>& words, TraverseBatchResult& result, unsigned threadsCount) const
+{
+	std::vector<TraverseBatchScratch> scratches;
+	return TraverseBatchParallel(words, result, threadsCount, scratches);
+}
+
+// The sorted words are given to the threads in chunks of that many words.
+// Small enough so the threads with the long words do not stay behind, big enough to share the prefixes of the words in it.
+static const size_t PARALLEL_BATCH_CHUNK_SIZE = 256;
+
+size_t FinalStateTransducer::TraverseBatchParallel(const std::vector<std::string>& words, TraverseBatchResult& result, unsigned threadsCount, std::vector<TraverseBatchScratch>& scratches) const
+{
+	if (threadsCount == 0)
+	{
+		threadsCount = std::max(1u, std::thread::hardware_concurrency());
+	}
+	const size_t chunksCount = (words.size() + PARALLEL_BATCH_CHUNK_SIZE - 1) / PARALLEL_BATCH_CHUNK_SIZE;
+	threadsCount = (unsigned) std::min<size_t>(threadsCount, chunksCount);
+	if (threadsCount <= 1 || !IsRealTime())
+	{
+		scratches.resize(1);
+		return TraverseBatch(words, result, scratches[0]);
+	}
+
+	scratches.resize(threadsCount);
+	auto& order = scratches[0].Order;
+	SortWords(words, order);
+
+	std::vector<std::pair<size_t, size_t>> wordOutputs(words.size()); // [begin, end) in the outputs of the thread which traversed the word.
+	std::vector<unsigned> wordThread(words.size());
+	std::vector<size_t> recognizedWords(threadsCount, 0);
+	std::atomic<size_t> nextChunk(0);
+
+	auto worker = [&](unsigned thread)
+	{
+		auto& scratch = scratches[thread];
+		scratch.Outputs.clear();
+		for (auto chunk = nextChunk++; chunk < chunksCount; chunk = nextChunk++)
 		{
-			accumulatedOutputs.insert(currTransition.accumulatedOutput);
+			const auto first = order.data() + chunk * PARALLEL_BATCH_CHUNK_SIZE;
+			const auto last = order.data() + std::min(words.size(), (chunk + 1) * PARALLEL_BATCH_CHUNK_SIZE);
+			recognizedWords[thread] += TraverseSortedWords(words, first, last, scratch, wordOutputs.data());
+			for (auto wordIndex = first; wordIndex != last; ++wordIndex)
+			{
+				wordThread[*wordIndex] = thread;
+			}
 		}
-		q.pop_front();
+	};
+
+	std::vector<std::thread> threads;
+	threads.reserve(threadsCount - 1);
+	for (unsigned thread = 1; thread < threadsCount; ++thread)
+	{
+		threads.emplace_back(worker, thread);
+	}
+	worker(0);
+	for (auto& thread : threads)
+	{
+		thread.join();
 	}
 
-	if (!*word && RecognizingEmptyWord)
+	// Write the outputs in the order of the words.
+	result.Offsets.clear();
+	result.Outputs.clear();
+	result.Offsets.reserve(words.size() + 1);
+	result.Offsets.push_back(0);
+	for (size_t i = 0; i < words.size(); ++i)
 	{
-		outputs = std::move(InitialEpsilonOutputs);
-		outputs.insert(0);
+		const auto& outputs = scratches[wordThread[i]].Outputs;
+		result.Outputs.insert(result.Outputs.end(), outputs.begin() + wordOutputs[i].first, outputs.begin() + wordOutputs[i].second);
+		result.Offsets.push_back(result.Outputs.size());
 	}
-	else
+
+	size_t allRecognizedWords = 0;
+	for (const auto count : recognizedWords)
 	{
-		outputs = std::move(accumulatedOutputs);
+		allRecognizedWords += count;
 	}
+	return allRecognizedWords;
+}
 
-	return !outputs.empty();
+void FinalStateTransducer::SortWords(const std::vector<std::string>& words, std::vector<size_t>& order)
+{
+	order.resize(words.size());
+	for (size_t i = 0; i < words.size(); ++i)
+	{
+		order[i] = i;
+	}
+	std::sort(order.begin(), order.end(), [&words](size_t l, size_t r) { return words[l] < words[r]; });
+}
+
+size_t FinalStateTransducer::TraverseSortedWords(const std::vector<std::string>& words, const size_t* first, const size_t* last,
+	TraverseBatchScratch& scratch, std::pair<size_t, size_t>* wordOutputs) const
+{
+	TRACE_SCOPE("TraverseSortedWords");
+	size_t recognizedWords = 0;
+
+	auto& levels = scratch.Levels;
+	auto& levelStarts = scratch.LevelStarts;
+	levels.clear();
+	levelStarts.clear();
+	levelStarts.push_back(0);
+	AddInitialLevel(levels);
+	levelStarts.push_back(levels.size());
+#if defined(COLLECT_STATS)
+	std::vector<size_t> frontierSizes;
+	size_t maxFrontierSize = 0;
+#endif
+
+	const std::string* previousWord = nullptr;
+	for (auto wordIndex = first; wordIndex != last; ++wordIndex)
+	{
+		const auto& word = words[*wordIndex];
+
+		// Keep only the levels of the common prefix with the previous word.
+		size_t depth = 0;
+		if (previousWord)
+		{
+			const auto bound = std::min(std::min(word.size(), previousWord->size()), levelStarts.size() - 2);
+			while (depth < bound && word[depth] == (*previousWord)[depth])
+			{
+				++depth;
+			}
+		}
+		levels.resize(levelStarts[depth + 1]);
+		levelStarts.resize(depth + 2);
+
+		for (; depth < word.size() && levelStarts[depth] != levelStarts[depth + 1]; ++depth)
+		{
+			const auto symbol = (unsigned char) word[depth];
+			for (auto k = levelStarts[depth], bound = levelStarts[depth + 1]; k < bound; ++k)
+			{
+				const auto curr = levels[k]; // A copy, @levels might grow.
+				AddTransitionsWithSymbol(curr.state, curr.output, symbol, levels);
+			}
+			UniqueLevel(levels, levelStarts[depth + 1]);
+			levelStarts.push_back(levels.size());
+		}
+#if defined(COLLECT_STATS)
+		// The shared levels of the common prefix are counted for each word, as if it was traversed alone.
+		if (frontierSizes.size() < depth + 1)
+		{
+			frontierSizes.resize(depth + 1, 0);
+		}
+		for (size_t d = 0; d <= depth; ++d)
+		{
+			const auto frontierSize = levelStarts[d + 1] - levelStarts[d];
+			frontierSizes[d] += frontierSize;
+			maxFrontierSize = std::max(maxFrontierSize, frontierSize);
+		}
+#endif
+
+		const auto begin = scratch.Outputs.size();
+		if (word.empty() && RecognizingEmptyWord)
+		{
+			scratch.Outputs.insert(scratch.Outputs.end(), InitialEpsilonOutputs.begin(), InitialEpsilonOutputs.end());
+			scratch.Outputs.push_back(0);
+		}
+		else if (depth == word.size())
+		{
+			AddFinalOutputs(levels.data() + levelStarts[depth], levels.data() + levelStarts[depth + 1], scratch.Outputs);
+		}
+		std::sort(scratch.Outputs.begin() + begin, scratch.Outputs.end());
+		scratch.Outputs.erase(std::unique(scratch.Outputs.begin() + begin, scratch.Outputs.end()), scratch.Outputs.end());
+		wordOutputs[*wordIndex] = { begin, scratch.Outputs.size() };
+		if (begin != scratch.Outputs.size())
+		{
+			++recognizedWords;
+		}
+
+		previousWord = &word;
+	}
+#if defined(COLLECT_STATS)
+	AddFrontierSizes(frontierSizes, last - first, maxFrontierSize);
+#endif
+
+	return recognizedWords;
 }
 
 bool FinalStateTransducer::GetRecognizingEmptyWord() const
@@ -1226,4 +2571,208 @@ bool FinalStateTransducer::StandardIsRecognizingEmptyWord() const
 		}
 	}
 	return false;
-}
\ No newline at end of file
+}
+
+TraversalCursor::TraversalCursor(const FinalStateTransducer& transducer)
+	: Transducer(transducer)
+	, FedSymbols(0)
+{
+}
+
+void TraversalCursor::Begin()
+{
+	CurrLevel.clear();
+	NextLevel.clear();
+	NotRealTimeWord.clear();
+	FedSymbols = 0;
+	if (Transducer.IsRealTime())
+	{
+		Transducer.AddInitialLevel(CurrLevel);
+	}
+}
+
+bool TraversalCursor::Feed(const char* chunk, size_t length)
+{
+	if (!Transducer.IsRealTime())
+	{
+		NotRealTimeWord.append(chunk, length);
+		FedSymbols += length;
+		return true;
+	}
+
+	for (size_t i = 0; i < length && !CurrLevel.empty(); ++i)
+	{
+		NextLevel.clear();
+		for (const auto& currTransition : CurrLevel)
+		{
+			Transducer.AddTransitionsWithSymbol(currTransition.state, currTransition.output, (unsigned char) chunk[i], NextLevel);
+		}
+		UniqueLevel(NextLevel, 0);
+		CurrLevel.swap(NextLevel);
+	}
+	FedSymbols += length;
+	return !CurrLevel.empty();
+}
+
+bool TraversalCursor::Finish(std::vector<Output>& outputs)
+{
+	outputs.clear();
+	if (!Transducer.IsRealTime())
+	{
+		Transducer.TraverseWithWord(NotRealTimeWord.c_str(), NotRealTimeOutputs);
+		outputs.assign(NotRealTimeOutputs.begin(), NotRealTimeOutputs.end());
+	}
+	else if (FedSymbols == 0 && Transducer.RecognizingEmptyWord)
+	{
+		outputs.assign(Transducer.InitialEpsilonOutputs.begin(), Transducer.InitialEpsilonOutputs.end());
+		outputs.push_back(0);
+	}
+	else
+	{
+		Transducer.AddFinalOutputs(CurrLevel.data(), CurrLevel.data() + CurrLevel.size(), outputs);
+	}
+
+	std::sort(outputs.begin(), outputs.end());
+	outputs.erase(std::unique(outputs.begin(), outputs.end()), outputs.end());
+	return !outputs.empty();
+}
+
+TextScanner::TextScanner(const FinalStateTransducer& transducer, ScanMode mode, size_t maxMatchLength)
+	: Transducer(transducer)
+	, Mode(mode)
+	, MaxMatchLength(maxMatchLength)
+	, Position(0)
+{
+	Begin();
+}
+
+void TextScanner::Begin()
+{
+	assert(Transducer.IsRealTime());
+	Position = 0;
+	InitialLevel.clear();
+	CurrLevel.clear();
+	NextLevel.clear();
+	LongestMatches.clear();
+	Transducer.AddInitialLevel(InitialLevel);
+}
+
+void TextScanner::Feed(const char* chunk, size_t length, ScanResult& result)
+{
+	for (size_t i = 0; i < length; ++i)
+	{
+		Step((unsigned char) chunk[i], result);
+	}
+}
+
+void TextScanner::Finish(ScanResult& result)
+{
+	if (Mode == ScanMode::LeftmostLongest)
+	{
+		AddLongestMatches(true, result);
+	}
+}
+
+void TextScanner::Step(unsigned char symbol, ScanResult& result)
+{
+	// The starts which have read MaxMatchLength symbols can not give a match after this symbol. They are the first ones.
+	if (MaxMatchLength > 0 && Position >= MaxMatchLength)
+	{
+		const auto lastDropped = Position - MaxMatchLength;
+		CurrLevel.erase(CurrLevel.begin(), std::partition_point(CurrLevel.begin(), CurrLevel.end(), [lastDropped](const ScanState& state)
+		{
+			return state.start <= lastDropped;
+		}));
+	}
+
+	// A match can start before this symbol too. The new start is the biggest one, so the level stays sorted.
+	for (const auto& initialTransition : InitialLevel)
+	{
+		CurrLevel.push_back(ScanState{ initialTransition, Position });
+	}
+
+	NextLevel.clear();
+	for (const auto& curr : CurrLevel)
+	{
+		Reached.clear();
+		Transducer.AddTransitionsWithSymbol(curr.transition.state, curr.transition.output, symbol, Reached);
+		for (const auto& transition : Reached)
+		{
+			NextLevel.push_back(ScanState{ transition, curr.start });
+		}
+	}
+	std::sort(NextLevel.begin(), NextLevel.end(), [](const ScanState& l, const ScanState& r)
+	{
+		return l.start < r.start || (l.start == r.start && (l.transition.state < r.transition.state ||
+			(l.transition.state == r.transition.state && l.transition.output < r.transition.output)));
+	});
+	NextLevel.erase(std::unique(NextLevel.begin(), NextLevel.end(), [](const ScanState& l, const ScanState& r)
+	{
+		return l.start == r.start && l.transition.state == r.transition.state && l.transition.output == r.transition.output;
+	}), NextLevel.end());
+	CurrLevel.swap(NextLevel);
+	++Position;
+
+	// The matches which end here, one for each start which reached a final state.
+	for (size_t i = 0; i < CurrLevel.size();)
+	{
+		const auto start = CurrLevel[i].start;
+		MatchOutputs.clear();
+		for (; i < CurrLevel.size() && CurrLevel[i].start == start; ++i)
+		{
+			Transducer.AddFinalOutputs(&CurrLevel[i].transition, &CurrLevel[i].transition + 1, MatchOutputs);
+		}
+		if (MatchOutputs.empty())
+		{
+			continue;
+		}
+		std::sort(MatchOutputs.begin(), MatchOutputs.end());
+		MatchOutputs.erase(std::unique(MatchOutputs.begin(), MatchOutputs.end()), MatchOutputs.end());
+
+		if (Mode == ScanMode::AllMatches)
+		{
+			AddMatch(start, Position, MatchOutputs, result);
+		}
+		else
+		{
+			auto& longestMatch = LongestMatches[start]; // The previous one (if any) ends before this one.
+			longestMatch.end = Position;
+			longestMatch.outputs = MatchOutputs;
+		}
+	}
+
+	if (Mode == ScanMode::LeftmostLongest)
+	{
+		AddLongestMatches(false, result);
+	}
+}
+
+void TextScanner::AddLongestMatches(bool finished, ScanResult& result)
+{
+	while (!LongestMatches.empty())
+	{
+		const auto first = LongestMatches.begin();
+		// A state with an earlier or the same start can still give an earlier or a longer match.
+		if (!finished && !CurrLevel.empty() && CurrLevel.front().start <= first->first)
+		{
+			return;
+		}
+
+		const auto end = first->second.end;
+		AddMatch(first->first, end, first->second.outputs, result);
+
+		// The next match starts at or after the end of this one.
+		LongestMatches.erase(first, LongestMatches.lower_bound(end));
+		CurrLevel.erase(CurrLevel.begin(), std::find_if(CurrLevel.begin(), CurrLevel.end(), [end](const ScanState& state)
+		{
+			return state.start >= end;
+		}));
+	}
+}
+
+void TextScanner::AddMatch(size_t start, size_t end, const std::vector<Output>& outputs, ScanResult& result)
+{
+	const auto outputsBegin = result.Outputs.size();
+	result.Outputs.insert(result.Outputs.end(), outputs.begin(), outputs.end());
+	result.Matches.push_back(ScanMatch{ start, end, outputsBegin, result.Outputs.size() });
+}
@@ -1,10 +1,17 @@
 #pragma once
 
 #include <vector>
+#include <string>
+#include <algorithm>
 #include <unordered_map>
 #include <unordered_set>
+#include <map>
+#include <memory>
 #include <boost/functional/hash.hpp>
 #include "SetOperations.h"
+#include "FrozenTransitions.h"
+#include "LabelTable.h"
+#include "Semirings.h"
 
 
 /*
@@ -18,21 +25,154 @@
 	q0 --word:number--> q1 ('e' will be epsilon, i.e. the empty word)
 */
 
-typedef std::pair<unsigned, unsigned> Outputs;
-typedef std::pair<unsigned, Outputs> StateAndOutputs;
-typedef std::unordered_map<unsigned, std::unordered_set<StateAndOutputs,
-	boost::hash<StateAndOutputs>>> SetOfTransitionsWithPairedOutputs;
+// How the frozen transducer finds the transitions of a state with a given symbol.
+enum class FrozenSymbolIndex
+{
+	None, // Binary search in the state's transitions.
+	Compressed, // 256 bits bitmap of the state's symbols + popcount for the symbol's place.
+	Dense, // 256 slots per state, one indexed load.
+	Auto, // Dense for the states with many symbols, compressed for the others.
+};
+
+// Memory used by a frozen transducer.
+struct FrozenInfo
+{
+	unsigned statesCount;
+	unsigned transitionsCount;
+	unsigned denseStatesCount;
+	unsigned compressedStatesCount;
+	size_t transitionsBytes; // The CSR arrays.
+	size_t symbolIndexBytes; // The dense and compressed per state indexes.
+	size_t allDenseSymbolIndexBytes; // What the symbol index would take if all states were dense.
+};
+
+// The size of the transducer after a stage of the construction.
+struct StageSizes
+{
+	unsigned statesCount;
+	size_t transitionsCount;
+	size_t epsilonTransitionsCount; // With the empty word (and any output).
+	size_t upperEpsilonTransitionsCount; // With the empty word and an output which is not 0.
+	size_t labelsCount; // The different words of the transitions.
+};
+
+/*
+	Counters of the construction and the traversal, collected only when COLLECT_STATS is defined (all are 0 otherwise).
+	They tell where an expression spends its time: the states added by Expand, the sizes of the epsilon closures,
+	the pair states of the functionality and the twins tests or the BFS levels of the traversal.
+	The construction counters are of the last call of each stage, the traversal counters are summed up until ResetStats.
+*/
+struct TransducerStats
+{
+	StageSizes built; // When MakeRealTime starts.
+	StageSizes afterRemoveEpsilon;
+	StageSizes afterExpand;
+	StageSizes afterRemoveUpperEpsilon;
+	std::map<std::string, size_t> builtTransitionsPerLabel; // By the word of the label (the empty one for the epsilon transitions).
+	ClosureStats epsilonClosure; // Of the (e,0) transitions in RemoveEpsilon.
+	ClosureStats upperEpsilonClosure; // Of the (e,X) transitions in RemoveUpperEpsilon (without the identity).
+	ArenaStats realTimeAllocations; // The arena of MakeRealTime.
+
+	size_t functionalityPairStatesCount; // The pair states explored by TestForFunctionality.
+	size_t functionalityPairTransitionsCount;
+	size_t coReachabilitySearchesCount; // The searches of IsPairCoReachable which were not cached.
+	size_t coReachabilityPairStatesCount; // The pair states visited by them.
+	ArenaStats functionalityAllocations; // The arenas of TestForFunctionality and of the searches.
+
+	size_t twinsPairStatesCount; // The pair states of the last TestForTwinsProperty.
+
+	size_t traversedWordsCount;
+	std::vector<size_t> frontierSizes; // [d] is the sum of the numbers of <state, output> pairs after 'd' symbols of the traversed words.
+	size_t maxFrontierSize;
+};
+
+// The outputs of a batch of words: the outputs of the i-th word are Outputs[Offsets[i]] ... Outputs[Offsets[i + 1] - 1] (sorted, unique).
+struct TraverseBatchResult
+{
+	std::vector<size_t> Offsets;
+	std::vector<Output> Outputs;
+};
+
+// Buffers for TraverseBatch, reusing it between the calls saves the allocations. One per thread.
+struct TraverseBatchScratch
+{
+	std::vector<size_t> Order; // The indexes of the words sorted by the words.
+	std::vector<Transition> Levels; // The BFS levels (<state, accumulated output>) of the current word, one after another.
+	std::vector<size_t> LevelStarts; // Level 'd' (after reading 'd' symbols) is Levels[LevelStarts[d]] ... Levels[LevelStarts[d + 1] - 1].
+	std::vector<Output> Outputs; // The outputs of the words in the sorted order.
+	std::vector<std::pair<size_t, size_t>> WordOutputs; // [begin, end) in @Outputs for each word.
+};
+
+// Which output of a word TraverseWithWordForOutput gives.
+enum class OutputQuery
+{
+	Min,
+	Max,
+};
+
+enum class ScanMode
+{
+	LeftmostLongest, // The matches do not overlap: the one which starts first, the longest of them, then the same after its end.
+	AllMatches, // Each non-empty part of the text which is recognized.
+};
+
+struct ScanMatch
+{
+	size_t start; // The match is text[start, end), the positions are from the beginning of the scan.
+	size_t end;
+	size_t outputsBegin; // Its outputs are ScanResult::Outputs[outputsBegin, outputsEnd), sorted.
+	size_t outputsEnd;
+};
+
+struct ScanResult
+{
+	std::vector<ScanMatch> Matches; // In the order of the ends, the ones with the same end in the order of the starts.
+	std::vector<Output> Outputs;
+};
+
+enum class TwinsPropertyResult
+{
+	Holds,
+	DoesNotHold,
+	TooManyStates, // The squared output transducer has more states than allowed.
+};
+
+typedef std::pair<Output, Output> Outputs;
+typedef std::pair<unsigned, unsigned> StatesPair; // <p1, p2>, a state of the squared output transducer
+
+/*
+	A part of a transducer which is built in place: its states are already at their final indexes in the Delta of the transducer,
+	so combining fragments never remaps transitions (the builder appends the states in the order of the reversed polish notation).
+*/
+struct TransducerFragment
+{
+	std::unordered_set<unsigned> InitialStates;
+	std::unordered_set<unsigned> FinalStates;
+};
 
 class FinalStateTransducer
 {
 public:
-	FinalStateTransducer(char* regExpr, int separator, int length); // The regular expression should be of type: 'word:number'
+	// The regular expression should be of type: 'word:number'. The word is added to @labels (a new table if it is null).
+	FinalStateTransducer(char* regExpr, int separator, int length, std::shared_ptr<LabelTable> labels = nullptr);
+	// A transducer without states, the states are added with AddWord.
+	explicit FinalStateTransducer(std::shared_ptr<LabelTable> labels = nullptr);
 
 	void CloseStar();
 	void ClosePlus();
 	void Concat(FinalStateTransducer& right);
 	void Union(FinalStateTransducer& right);
 
+	// Adds two new states with a transition 'word:number' between them (see the constructor) and returns them as a fragment.
+	TransducerFragment AddWord(char* regExpr, int separator, int length);
+	// The same operations on fragments of this transducer. The result is in @fragment (@left), @right is left empty.
+	void CloseStar(TransducerFragment& fragment);
+	void ClosePlus(TransducerFragment& fragment);
+	void Concat(TransducerFragment& left, TransducerFragment& right);
+	void Union(TransducerFragment& left, TransducerFragment& right);
+	// Makes the initial and final states of the transducer to be the ones of @fragment.
+	void SetStates(TransducerFragment& fragment);
+
 	void Remap(unsigned offset);
 	void RemapDelta(unsigned offset);
 	void RemapInitialStates(unsigned offset);
@@ -43,8 +183,46 @@ public:
 
 	void MakeSingleInitialState(unsigned newInitialStateIndex);
 
+	// Moves the transitions to the labels of @labels (when combining transducers with different label tables).
+	void UseLabels(const std::shared_ptr<LabelTable>& labels);
+
 	// Works only for one-symbol transducer(the transitions are only with one symbol or epsilon)
-	bool TraverseWithWord(const char* word, std::unordered_set<unsigned>& outputs) const;
+	bool TraverseWithWord(const char* word, std::unordered_set<Output>& outputs) const;
+
+	/*
+		Writes to @output the minimal or the maximal (@query) output of @word, returns false if @word is not recognized.
+		A real-time transducer keeps only the best accumulated output for each state of the BFS level (the sum is monotone,
+		so a worse one can not become the best later), so the cost does not depend on the number of the outputs and no set of them is built.
+		For the other transducers the outputs are found with TraverseWithWord.
+	*/
+	bool TraverseWithWordForOutput(const char* word, OutputQuery query, Output& output) const;
+
+	/*
+		Writes to @weight the weight of @word in @Semiring (see Semirings.h), returns false if @word is not recognized.
+		With an idempotent @Semiring the BFS level of a real-time transducer has one <state, weight> pair for each state.
+		Otherwise the weight is the Plus of the distinct outputs found with TraverseWithWord.
+	*/
+	template<typename Semiring>
+	bool TraverseWithWordIn(const char* word, typename Semiring::Weight& weight) const;
+
+	/*
+		Traverses all @words and writes their outputs in @result. Returns the number of recognized words.
+		The words are traversed in sorted order, so their common prefixes are traversed only once.
+		Works with real-time transducers (for the others it calls TraverseWithWord for each word).
+	*/
+	size_t TraverseBatch(const std::vector<std::string>& words, TraverseBatchResult& result) const;
+	size_t TraverseBatch(const std::vector<std::string>& words, TraverseBatchResult& result, TraverseBatchScratch& scratch) const;
+
+	/*
+		The same as TraverseBatch, but the sorted words are split in chunks which are taken by @threadsCount threads
+		(0 means std::thread::hardware_concurrency()) as they finish the previous ones. Each thread uses its own scratch from @scratches.
+
+		Thread-safety: all const methods only read the transducer, so once it is finalized (MakeRealTime, UpdateRecognizingEmptyWord,
+		TestForFunctionality and Freeze are done) it can be traversed from many threads at the same time.
+		A non-const method must not run while the transducer is traversed.
+	*/
+	size_t TraverseBatchParallel(const std::vector<std::string>& words, TraverseBatchResult& result, unsigned threadsCount = 0) const;
+	size_t TraverseBatchParallel(const std::vector<std::string>& words, TraverseBatchResult& result, unsigned threadsCount, std::vector<TraverseBatchScratch>& scratches) const;
 
 	bool GetRecognizingEmptyWord() const;
 
@@ -52,66 +230,409 @@ public:
 	bool IsRealTime() const;
 	bool IsFunctional() const;
 
-	bool MakeRealTime();
+	// Removes the epsilon transitions and expands the words to one symbol transitions. Returns true if the transducer is infinite.
+	// The last step can run on @threadsCount threads (0 means as many as the hardware supports).
+	bool MakeRealTime(unsigned threadsCount = 1);
+
+	// Compiles the real-time transducer into flat arrays (see FrozenDelta) which are used for traversing from now on.
+	// Returns false if the transducer is not real-time.
+	bool Freeze(FrozenSymbolIndex symbolIndex = FrozenSymbolIndex::Auto);
+	bool IsFrozen() const;
+	FrozenInfo GetFrozenInfo() const;
+
+	// Writes the frozen transducer to @fileName, it can be mapped and traversed with MappedTransducer.
+	// Returns false if the transducer is not frozen or the file can not be written.
+	bool SaveFrozen(const char* fileName) const;
 
 	bool TestForFunctionality();
 
+	/*
+		Twins property: for each two states q1 and q2 (each one co-reachable) reachable with the same word,
+		each two cycles q1 --v:c1--> q1 and q2 --v:c2--> q2 with the same word 'v' have the same outputs (c1 == c2).
+		A functional transducer is subsequential if and only if it has the twins property, i.e. the delay between
+		the outputs of two paths with the same word is bounded.
+		Checked on the pair states of the squared output transducer (at most @maxPairStatesCount),
+		the difference o2 - o1 has to be the same on each cycle in each strongly connected component of it.
+		The pair states are found on @threadsCount threads (0 means as many as the hardware supports).
+	*/
+	TwinsPropertyResult TestForTwinsProperty(unsigned maxPairStatesCount, unsigned threadsCount = 1) const;
+
+	/*
+		Converts the functional real-time transducer into a minimal subsequential one (deterministic, with an output for each final state)
+		which is used for traversing from now on, i.e. one transition and one addition per symbol.
+		Returns false if it is not functional, has no twins property or needs more than @maxStatesCount states
+		(for the pair states of the twins property test or for the subsequential transducer).
+		The twins property test runs on @threadsCount threads.
+	*/
+	bool MakeSubsequential(unsigned maxStatesCount = 1000000, unsigned threadsCount = 1);
+	bool IsSubsequential() const;
+
 	void UpdateRecognizingEmptyWord();
+
+	// See TransducerStats, collected only with COLLECT_STATS.
+	const TransducerStats& GetStats() const;
+	void ResetStats();
 private:
+	// Moves the initial and final states out of the transducer (the inverse of SetStates).
+	TransducerFragment TakeStates();
+
 	// Each transition to be with only single symbol(or epsilon)
 	void Expand();
 
 	void Proj1_2(SetOfTransitions& r) const;
-	void Proj1_23(SetOfTransitionsWithOutputs& r) const;
 
-	void MakeSquaredOutputTransducer();
+	// The pair states <p1, p2> of the squared output transducer reachable from I x I, in the order of a BFS, and their transitions.
+	// Built for the twins property test, which needs all of them.
+	struct PairStatesGraph
+	{
+		std::vector<StatesPair> Pairs;
+		std::vector<size_t> Offsets; // The transitions of Pairs[i] are Transitions[Offsets[i]] ... Transitions[Offsets[i + 1] - 1].
+		std::vector<std::pair<Outputs, unsigned>> Transitions; // <o1, o2> and the id (the place in @Pairs) of the destination.
+	};
+
+	/*
+		Level-synchronous BFS from I x I: the pairs of a level are split in chunks which are taken by @threadsCount threads,
+		the new pairs go to a concurrent table of the ids and get their ids at the end of the level, in the order
+		of the sequential BFS (so the ids do not depend on the threads).
+		Only the pairs of states in @allowedStates are used (all if it is nullptr).
+		Returns false if there are more than @maxPairStatesCount pairs, then @graph has only the first levels.
+	*/
+	bool BuildPairStatesGraph(PairStatesGraph& graph, unsigned threadsCount, size_t maxPairStatesCount, const std::vector<bool>* allowedStates) const;
+
+	// Calls @f(<o1, o2>, <q1, q2>) for each transition of the squared output transducer from the pair state @p,
+	// i.e. each <p1 --a:o1--> q1, p2 --a:o2--> q2> with the same symbol 'a'. Nothing is materialized.
+	template<typename Function>
+	void ForEachPairTransition(const StatesPair& p, Function f) const;
+
+	// Is there a word which leads from the pair state @p to a pair of final states. @coReachable caches the results from the previous calls.
+	bool IsPairCoReachable(const StatesPair& p, ArenaUnorderedMap<StatesPair, bool, boost::hash<StatesPair>>& coReachable) const;
 
-	// (e,0) transitions removing
-	void RemoveEpsilon();
+	// (e,0) transitions removing. The temporary containers of the stage (of MakeRealTime) are in @arena.
+	void RemoveEpsilon(MonotonicArena& arena);
 
 	// (e,X) transitions removing. When there is such transitions in the beginning (from the initial states) - they will be written to the @InitialEpsilonOutputs set.
-	void RemoveUpperEpsilon(bool& infinite);
+	void RemoveUpperEpsilon(bool& infinite, unsigned threadsCount, MonotonicArena& arena);
 
 	bool RealTimeIsRecognizingEmptyWord() const;
 	bool StandardIsRecognizingEmptyWord() const;
 
-	bool StandardTrawerseWithWord(const char* word, std::unordered_set<unsigned>& outputs) const;
-	bool RealTimeTraverseWithWord(const char* word, std::unordered_set<unsigned>& outputs) const;
-private: // TODO: the key has to be something else, not a whole string!
-	typedef std::unordered_map<std::string, std::unordered_set<Transition>>
+	bool StandardTrawerseWithWord(const char* word, std::unordered_set<Output>& outputs) const;
+	bool RealTimeTraverseWithWord(const char* word, std::unordered_set<Output>& outputs) const;
+	bool FrozenTraverseWithWord(const char* word, std::unordered_set<Output>& outputs) const;
+	bool SubsequentialTraverseWithWord(const char* word, std::unordered_set<Output>& outputs) const;
+
+	// The transition from the subsequential @state with @symbol, nullptr if there is no such one.
+	const Transition* FindSubsequentialTransition(unsigned state, unsigned char symbol) const;
+
+	// Pushes the outputs of the subsequential transducer towards the initial state and merges its equivalent states.
+	void MinimizeSubsequential(MonotonicArena& arena);
+
+	// @coReachable[i] is true if there is a path from state 'i' to a final state.
+	void FindCoReachableStates(std::vector<bool>& coReachable) const;
+
+	StageSizes GetStageSizes() const;
+	// Adds the frontier sizes of @wordsCount traversed words to the stats (it can be called by many traversing threads).
+	void AddFrontierSizes(const std::vector<size_t>& frontierSizes, size_t wordsCount, size_t maxFrontierSize) const;
+
+	// Sorts @level by the states and combines the weights of each state with Semiring::Plus.
+	template<typename Semiring>
+	static void SumLevel(std::vector<std::pair<unsigned, typename Semiring::Weight>>& level);
+
+	static void SortWords(const std::vector<std::string>& words, std::vector<size_t>& order);
+
+	// Traverses the words with indexes [@first, @last) which are sorted by the words. Appends their outputs to @scratch.Outputs
+	// and sets @wordOutputs[index] to the [begin, end) of the outputs of the word with that index. Returns the number of recognized words.
+	size_t TraverseSortedWords(const std::vector<std::string>& words, const size_t* first, const size_t* last,
+		TraverseBatchScratch& scratch, std::pair<size_t, size_t>* wordOutputs) const;
+
+	// Adds to @level the <state, output> pairs before reading a symbol (the initial states of the real-time, the frozen or the subsequential transducer).
+	void AddInitialLevel(std::vector<Transition>& level) const;
+
+	// Returns true if @state is final, then @output is the output of a word which reaches it with @accumulatedOutput.
+	bool GetFinalOutput(unsigned state, Output accumulatedOutput, Output& output) const;
+
+	// Adds to @outputs the outputs of the final ones of the <state, accumulated output> pairs [@first, @last) (not sorted, might repeat).
+	void AddFinalOutputs(const Transition* first, const Transition* last, std::vector<Output>& outputs) const;
+
+	// Adds to @nextLevel the transitions from @state with @symbol (the real-time or the frozen ones), adding @accumulatedOutput to their outputs.
+	void AddTransitionsWithSymbol(unsigned state, Output accumulatedOutput, unsigned char symbol, std::vector<Transition>& nextLevel) const;
+	// Calls @f(transition) for each transition from @state with @symbol (the subsequential, the frozen or the real-time ones).
+	template<typename Function>
+	void ForEachTransitionWithSymbol(unsigned state, unsigned char symbol, Function f) const;
+
+	void BuildFrozenSymbolIndex(FrozenSymbolIndex symbolIndex);
+private:
+	typedef std::unordered_map<unsigned, std::unordered_set<Transition>> // The key is the label of the word, see LabelTable.
 		StateTransitions;
 	typedef std::vector<StateTransitions> DeltaType;
 
+	std::shared_ptr<LabelTable> Labels;
 	DeltaType Delta; // State at position 'i' with word 'w' will lead to state(s) ('state') (which are indexes in the Delta vector) with output ('output') some number.
 	std::unordered_set<unsigned> FinalStates;
 	std::unordered_set<unsigned> InitialStates;
 
-	struct SquaredOutputTransducer
+	// Compressed sparse row form of the real-time Delta (see FrozenTransitions.h).
+	struct FrozenDelta
 	{
-		typedef std::unordered_map<unsigned, std::unordered_set<Transition>>
-			SOTStateTransitions;
-		typedef std::vector<SOTStateTransitions> SOTDeltaType;
-		SOTDeltaType Delta;
-		unsigned StatesCount;
-		std::unordered_set<unsigned> FinalStates;
-		std::unordered_set<unsigned> InitialStates;
+		std::vector<unsigned> StateOffsets; // Delta.size() + 1 elements.
+		std::vector<unsigned char> Symbols;
+		std::vector<Transition> Transitions;
+		std::vector<bool> FinalStates; // Indexed by state.
+
+		// Optional symbol index per state (empty if FrozenSymbolIndex::None).
+		std::vector<FrozenStateIndex> StateIndexes;
+		std::vector<unsigned> SymbolOffsets;
+		std::vector<uint64_t> Bitmaps;
 
-		void Proj1_2(SetOfTransitions& r) const;
-		void Proj1_23(SetOfTransitionsWithPairedOutputs& r) const;
+		FrozenTransitions GetTransitions() const;
+		void Clear();
+	} Frozen;
+
+	/*
+		The subsequential transducer in the same form as FrozenDelta, but with at most one transition per symbol. State 0 is the initial one.
+		The output for a word is InitialOutput + the outputs on its path + FinalOutputs[the last state].
+	*/
+	struct SubsequentialDelta
+	{
+		std::vector<unsigned> StateOffsets;
+		std::vector<unsigned char> Symbols;
+		std::vector<Transition> Transitions;
+		std::vector<bool> FinalStates;
+		std::vector<Output> FinalOutputs;
+		Output InitialOutput;
 
-		// Removes the states which are not connected to the a initial state or a final state.
-		void Trim();
-	} SOT;
+		void Clear();
+	} Subsequential;
 
 	bool RecognizingEmptyWord;
 	bool Infinite;
 	bool RealTime;
 	bool Functional;
+	bool IsFrozenDelta;
+	bool IsSubsequentialDelta;
 
 	SetOfTransitionsWithOutputs CloseEpsilonOnStates;
 	std::unordered_set<unsigned> StatesWithEpsilonCycleWithPositiveOutput;
-	std::unordered_set<unsigned> InitialEpsilonOutputs;
+	std::unordered_set<Output> InitialEpsilonOutputs;
+	mutable TransducerStats Stats; // Also updated by the const methods (the traversal, the twins test).
+	friend class TraversalCursor;
+	friend class TextScanner;
 private: // I do not want to copy this big structures, just to move them arround...
 	//FinalStateTransducer(const FinalStateTransducer& other) = delete; // TODO Whyyyy not able....
 	//FinalStateTransducer& operator=(const FinalStateTransducer& other) = delete;
 };
+
+template<typename Semiring>
+bool FinalStateTransducer::TraverseWithWordIn(const char* word, typename Semiring::Weight& weight) const
+{
+	if (!word) return false;
+
+	if (!Semiring::Idempotent || !IsRealTime())
+	{
+		std::unordered_set<Output> outputs;
+		if (!TraverseWithWord(word, outputs))
+		{
+			return false;
+		}
+		std::vector<Output> sortedOutputs(outputs.begin(), outputs.end());
+		std::sort(sortedOutputs.begin(), sortedOutputs.end()); // The same order of Plus each time (e.g. of the doubles).
+		auto output = sortedOutputs.begin();
+		weight = Semiring::FromOutput(*output);
+		while (++output != sortedOutputs.end())
+		{
+			weight = Semiring::Plus(weight, Semiring::FromOutput(*output));
+		}
+		return true;
+	}
+
+	if (!*word && RecognizingEmptyWord)
+	{
+		weight = Semiring::FromOutput(0); // The outputs are InitialEpsilonOutputs and 0 (Plus is idempotent, so they might repeat).
+		for (const auto& initialEpsilonOutput : InitialEpsilonOutputs)
+		{
+			if (initialEpsilonOutput != 0)
+			{
+				weight = Semiring::Plus(weight, Semiring::FromOutput(initialEpsilonOutput));
+			}
+		}
+		return true;
+	}
+
+	std::vector<std::pair<unsigned, typename Semiring::Weight>> currLevel, nextLevel; // The BFS levels (<state, weight of the paths to it>).
+	std::vector<Transition> initialLevel;
+	AddInitialLevel(initialLevel);
+	for (const auto& initialTransition : initialLevel)
+	{
+		currLevel.emplace_back(initialTransition.state, Semiring::FromOutput(initialTransition.output));
+	}
+
+	for (const char* pWord = word; *pWord; ++pWord)
+	{
+		nextLevel.clear();
+		for (const auto& curr : currLevel)
+		{
+			ForEachTransitionWithSymbol(curr.first, (unsigned char) *pWord, [&](const Transition& transition)
+			{
+				nextLevel.emplace_back(transition.state, Semiring::Times(curr.second, Semiring::FromOutput(transition.output)));
+			});
+		}
+		if (nextLevel.empty())
+		{
+			return false;
+		}
+		SumLevel<Semiring>(nextLevel);
+		currLevel.swap(nextLevel);
+	}
+
+	bool recognized = false;
+	Output finalOutput;
+	for (const auto& curr : currLevel)
+	{
+		if (GetFinalOutput(curr.first, 0, finalOutput))
+		{
+			const auto pathsWeight = Semiring::Times(curr.second, Semiring::FromOutput(finalOutput));
+			weight = recognized ? Semiring::Plus(weight, pathsWeight) : pathsWeight;
+			recognized = true;
+		}
+	}
+	return recognized;
+}
+
+template<typename Function>
+void FinalStateTransducer::ForEachTransitionWithSymbol(unsigned state, unsigned char symbol, Function f) const
+{
+	if (IsSubsequential())
+	{
+		const auto transition = FindSubsequentialTransition(state, symbol);
+		if (transition)
+		{
+			f(*transition);
+		}
+		return;
+	}
+
+	if (IsFrozen())
+	{
+		const Transition* begin;
+		const Transition* end;
+		Frozen.GetTransitions().Find(state, symbol, begin, end);
+		for (auto transition = begin; transition != end; ++transition)
+		{
+			f(*transition);
+		}
+		return;
+	}
+
+	const auto it = Delta[state].find(SymbolLabel(symbol));
+	if (it != Delta[state].end())
+	{
+		for (const auto& transition : it->second)
+		{
+			f(transition);
+		}
+	}
+}
+
+template<typename Semiring>
+void FinalStateTransducer::SumLevel(std::vector<std::pair<unsigned, typename Semiring::Weight>>& level)
+{
+	typedef std::pair<unsigned, typename Semiring::Weight> StateWeight;
+	std::sort(level.begin(), level.end(), [](const StateWeight& l, const StateWeight& r)
+	{
+		return l.first < r.first;
+	});
+
+	size_t last = 0;
+	for (size_t i = 1; i < level.size(); ++i)
+	{
+		if (level[i].first == level[last].first)
+		{
+			level[last].second = Semiring::Plus(level[last].second, level[i].second);
+		}
+		else
+		{
+			level[++last] = level[i];
+		}
+	}
+	level.erase(level.begin() + last + 1, level.end());
+}
+
+/*
+	Traverses @transducer with a word which comes in chunks: Begin(), Feed(chunk, length) for each chunk, Finish(outputs).
+	The chunks are not null terminated, so the word can contain '\0' symbols. Only the current BFS level (<state, accumulated output>)
+	is kept between the chunks. The cursor can be reused (Begin starts a new word), its buffers are kept, so once they are big enough
+	there are no allocations. Works with real-time transducers (for the others the chunks are collected and TraverseWithWord is used at the end,
+	then the word ends on the first '\0').
+	The transducer must not change while it is traversed, each thread uses its own cursor.
+*/
+class TraversalCursor
+{
+public:
+	explicit TraversalCursor(const FinalStateTransducer& transducer);
+
+	void Begin();
+	// Returns false if no state is reached (the word is already not recognized, the next chunks are ignored).
+	bool Feed(const char* chunk, size_t length);
+	// Writes the outputs of the fed word to @outputs (sorted, unique). Returns true if the word is recognized.
+	bool Finish(std::vector<Output>& outputs);
+private:
+	const FinalStateTransducer& Transducer;
+	std::vector<Transition> CurrLevel;
+	std::vector<Transition> NextLevel;
+	size_t FedSymbols;
+	std::string NotRealTimeWord; // The fed chunks when the transducer is not real-time.
+	std::unordered_set<Output> NotRealTimeOutputs;
+};
+
+/*
+	Finds the parts of a text (which comes in chunks, as in TraversalCursor) which are recognized by @transducer.
+	All start positions are traversed in one pass: before each symbol the initial states are added to the BFS level
+	with the current position as a start, so each symbol of the text is read once and each step is linear
+	in the number of <state, accumulated output, start> triples which are alive at the same time.
+	The scanning is linear in the text size only if the length of the matches is bounded: with a pattern like "a *"
+	every start stays alive over a run of 'a', so a run of n symbols takes O(n^2). @maxMatchLength (if not 0) bounds it,
+	the starts which have read @maxMatchLength symbols are dropped (the oldest ones first), so a step has at most
+	@maxMatchLength starts and only the matches which are not longer are found.
+	Only non-empty matches are reported. Works with real-time transducers (the real-time, the frozen or the subsequential ones).
+*/
+class TextScanner
+{
+public:
+	TextScanner(const FinalStateTransducer& transducer, ScanMode mode, size_t maxMatchLength = 0);
+
+	void Begin();
+	// Appends to @result the matches which are known after @chunk (with LeftmostLongest a match is known once no longer or earlier one can be found).
+	void Feed(const char* chunk, size_t length, ScanResult& result);
+	// Appends to @result the remaining matches.
+	void Finish(ScanResult& result);
+private:
+	struct ScanState
+	{
+		Transition transition; // <state, accumulated output>
+		size_t start;
+	};
+
+	// The longest match found so far for a start position (LeftmostLongest).
+	struct LongestMatch
+	{
+		size_t end;
+		std::vector<Output> outputs;
+	};
+
+	// Reads @symbol with all states of the level and adds the matches which end after it.
+	void Step(unsigned char symbol, ScanResult& result);
+	// Appends to @result the longest matches which can not change (all of them if @finished).
+	void AddLongestMatches(bool finished, ScanResult& result);
+	static void AddMatch(size_t start, size_t end, const std::vector<Output>& outputs, ScanResult& result);
+
+	const FinalStateTransducer& Transducer;
+	const ScanMode Mode;
+	const size_t MaxMatchLength; // 0 if the matches are not bounded.
+	size_t Position; // The symbols read so far.
+	std::vector<Transition> InitialLevel;
+	std::vector<ScanState> CurrLevel; // Sorted by <start, state, output>.
+	std::vector<ScanState> NextLevel;
+	std::vector<Transition> Reached;
+	std::vector<Output> MatchOutputs;
+	std::map<size_t, LongestMatch> LongestMatches; // By the start positions.
+};
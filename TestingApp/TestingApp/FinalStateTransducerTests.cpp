@@ -2,7 +2,18 @@
 #include <vector>
 #include <unordered_map>
 #include <string>
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <cstdio> // std::remove
+#include <tuple>
+#include <cmath>
+#include <cstring> // std::memcpy
 #include "RegularFinalStateTransducerBuilder.h"
+#include "MappedTransducer.h"
+#include "CustomTestExecuter.h"
+#include "TestCaseGenerator.h"
+#include "Trace.h"
 #include "Tests.h"
 
 struct TestCaseInfo
@@ -11,7 +22,7 @@ struct TestCaseInfo
 	bool infinite;
 	bool functional;
 	typedef std::pair<std::string,  // Word for traversing and expected outputs.
-					  std::vector<unsigned>> // a list of desired outputs (if empty then the word is not from the language)
+					  std::vector<Output>> // a list of desired outputs (if empty then the word is not from the language)
 		WordAndExpectedOutputs;
 	std::vector<WordAndExpectedOutputs> wordsAndExpectedOutputs;
 };
@@ -57,6 +68,7 @@ static void PopulateWithTestCases()
 			{ "aaa", { 15, 110, 205, 300 } },
 			{ "aaaa", { 20, 115, 210, 305, 400 } },
 			{ "aaaaa", { 25, 120, 215, 310, 405, 500 } },
+			{ "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaa", { 150, 245, 340, 435, 530, 625, 720, 815, 910, 1005, 1100, 1195, 1290, 1385, 1480, 1575, 1670, 1765, 1860, 1955, 2050, 2145, 2240, 2335, 2430, 2525, 2620, 2715, 2810, 2905, 3000 } }, // 2^30 paths, but only 31 different outputs.
 		}
 	});
 	FSTTestcases.push_back({
@@ -79,6 +91,34 @@ static void PopulateWithTestCases()
 			{ "c", { 40 } },
 		}
 	});
+	FSTTestcases.push_back({
+		"a:1 b:0 . a:2 c:0 . | *", // The pairs after 'a' hold different outputs, but they do not lead to a pair of final states.
+		false,
+		true,
+		{
+			{ "", { 0 } },
+			{ "a", {} },
+			{ "ab", { 1 } },
+			{ "ac", { 2 } },
+			{ "abac", { 3 } },
+			{ "acacab", { 5 } },
+		}
+	});
+	FSTTestcases.push_back({
+		"a:1 b:2 c:3 . . d:4 e:5 ef:6 | | * .", // Right-deep operands, their states are added before the operation is applied.
+		false,
+		true,
+		{
+			{ "", {} },
+			{ "abc", { 6 } },
+			{ "abcd", { 10 } },
+			{ "abcef", { 12 } },
+			{ "abcee", { 16 } },
+			{ "abcdeefe", { 26 } },
+			{ "abd", {} },
+			{ "bc", {} },
+		}
+	});
 	FSTTestcases.push_back({
 		"a:5 b:100 | c:1 |",
 		false,
@@ -1987,6 +2027,643 @@ static void PopulateWithTestCases()
 	});
 }
 
+// Traverses the words of the @testCase and checks the outputs. Returns the number of failed words.
+// @transducer is a FinalStateTransducer or a MappedTransducer.
+template<typename Transducer>
+static size_t TestTraversing(const Transducer& transducer, const TestCaseInfo& testCase)
+{
+	size_t failedTests = 0;
+	size_t testNumber = 0;
+	for (const auto& wordAndOutputs : testCase.wordsAndExpectedOutputs)
+	{
+		std::unordered_set<Output> outputs;
+		const auto& testWord = wordAndOutputs.first;
+		const auto& testOutputs = wordAndOutputs.second;
+
+		transducer.TraverseWithWord(testWord.c_str(), outputs);
+
+		std::cout << "\t" << testNumber << ": \"" << testWord << "\" ";
+		for (const auto& expectedOutput : testOutputs)
+		{
+			std::cout << expectedOutput << " ";
+		}
+
+		bool passed = false;
+		if (outputs.size() == testOutputs.size())
+		{
+			passed = true;
+			for (const auto& expectedOutput : testOutputs)
+			{
+				if (outputs.find(expectedOutput) == outputs.end())
+				{
+					passed = false;
+					break;
+				}
+			}
+		}
+
+		if (passed)
+		{
+			std::cout << " - passing.\n";
+		}
+		else
+		{
+			std::cout << "\n\t\tFAILED\n";
+			std::cout << "\t\tGot the following output: ";
+			for (const auto& output : outputs)
+			{
+				std::cout << output << " ";
+			}
+			std::cout << ".\n";
+			++failedTests;
+		}
+		++testNumber;
+	}
+
+	return failedTests;
+}
+
+// Traverses all words of the @testCase with one TraverseBatch call and checks the outputs. Returns the number of failed words.
+// Prints only the failed ones.
+// With @threadsCount > 1 the words are repeated, so there are enough of them for all threads, and TraverseBatchParallel is used.
+static size_t TestTraversingBatch(const FinalStateTransducer& transducer, const TestCaseInfo& testCase, unsigned threadsCount = 1)
+{
+	const size_t repeats = threadsCount > 1 ? 1000 : 1;
+	std::vector<std::string> words;
+	for (size_t i = 0; i < repeats; ++i)
+	{
+		for (const auto& wordAndOutputs : testCase.wordsAndExpectedOutputs)
+		{
+			words.push_back(wordAndOutputs.first);
+		}
+	}
+
+	TraverseBatchResult result;
+	if (threadsCount > 1)
+	{
+		transducer.TraverseBatchParallel(words, result, threadsCount);
+	}
+	else
+	{
+		transducer.TraverseBatch(words, result);
+	}
+
+	std::vector<bool> failed(testCase.wordsAndExpectedOutputs.size(), false);
+	for (size_t i = 0; i < words.size(); ++i)
+	{
+		const auto testNumber = i % testCase.wordsAndExpectedOutputs.size();
+		if (failed[testNumber])
+		{
+			continue;
+		}
+
+		std::vector<Output> expectedOutputs = testCase.wordsAndExpectedOutputs[testNumber].second;
+		std::sort(expectedOutputs.begin(), expectedOutputs.end());
+		expectedOutputs.erase(std::unique(expectedOutputs.begin(), expectedOutputs.end()), expectedOutputs.end());
+
+		const std::vector<Output> outputs(result.Outputs.begin() + result.Offsets[i], result.Outputs.begin() + result.Offsets[i + 1]);
+		if (outputs != expectedOutputs)
+		{
+			std::cout << "\t" << testNumber << ": \"" << words[i] << "\"\n\t\tFAILED with the batch traversing\n";
+			failed[testNumber] = true;
+		}
+	}
+
+	return std::count(failed.begin(), failed.end(), true);
+}
+
+// Checks the minimal and the maximal output of each word of the @testCase (TraverseWithWordForOutput). Returns the number of failed words.
+// Prints only the failed ones.
+static size_t TestTraversingForOutput(const FinalStateTransducer& transducer, const TestCaseInfo& testCase)
+{
+	size_t failedTests = 0;
+	for (size_t testNumber = 0; testNumber < testCase.wordsAndExpectedOutputs.size(); ++testNumber)
+	{
+		const auto& testWord = testCase.wordsAndExpectedOutputs[testNumber].first;
+		const auto& expectedOutputs = testCase.wordsAndExpectedOutputs[testNumber].second;
+
+		Output minOutput = 0, maxOutput = 0;
+		const bool recognized = transducer.TraverseWithWordForOutput(testWord.c_str(), OutputQuery::Min, minOutput);
+		bool passed = recognized == transducer.TraverseWithWordForOutput(testWord.c_str(), OutputQuery::Max, maxOutput);
+		if (expectedOutputs.empty())
+		{
+			passed = passed && !recognized;
+		}
+		else
+		{
+			passed = passed && recognized &&
+				minOutput == *std::min_element(expectedOutputs.begin(), expectedOutputs.end()) &&
+				maxOutput == *std::max_element(expectedOutputs.begin(), expectedOutputs.end());
+		}
+
+		if (!passed)
+		{
+			std::cout << "\t" << testNumber << ": \"" << testWord << "\"\n\t\tFAILED with the min/max output traversing\n";
+			++failedTests;
+		}
+	}
+
+	return failedTests;
+}
+
+// Traverses the words of the @testCase with one TraversalCursor, feeding each word in chunks of 1 and of 3 symbols, and checks the outputs.
+// A recognized word followed by '\0' must not be recognized (the chunks are not null terminated). Returns the number of failed words.
+// Prints only the failed ones.
+static size_t TestTraversingInChunks(const FinalStateTransducer& transducer, const TestCaseInfo& testCase)
+{
+	TraversalCursor cursor(transducer);
+	std::vector<Output> outputs;
+	size_t failedTests = 0;
+	for (size_t testNumber = 0; testNumber < testCase.wordsAndExpectedOutputs.size(); ++testNumber)
+	{
+		const auto& testWord = testCase.wordsAndExpectedOutputs[testNumber].first;
+		std::vector<Output> expectedOutputs = testCase.wordsAndExpectedOutputs[testNumber].second;
+		std::sort(expectedOutputs.begin(), expectedOutputs.end());
+		expectedOutputs.erase(std::unique(expectedOutputs.begin(), expectedOutputs.end()), expectedOutputs.end());
+
+		bool passed = true;
+		for (const size_t chunkSize : { 1, 3 })
+		{
+			cursor.Begin();
+			for (size_t i = 0; i < testWord.size(); i += chunkSize)
+			{
+				cursor.Feed(testWord.data() + i, std::min(chunkSize, testWord.size() - i));
+			}
+			cursor.Finish(outputs);
+			passed = passed && outputs == expectedOutputs;
+		}
+
+		if (transducer.IsRealTime() && !expectedOutputs.empty())
+		{
+			cursor.Begin();
+			cursor.Feed(testWord.c_str(), testWord.size() + 1);
+			passed = passed && !cursor.Finish(outputs);
+		}
+
+		if (!passed)
+		{
+			std::cout << "\t" << testNumber << ": \"" << testWord << "\"\n\t\tFAILED with the traversing in chunks\n";
+			++failedTests;
+		}
+	}
+
+	return failedTests;
+}
+
+struct SubsequentialTestCase
+{
+	std::string regExpr;
+	TwinsPropertyResult twinsProperty;
+	bool subsequential;
+};
+
+void RunSubsequentialTests()
+{
+	const std::vector<SubsequentialTestCase> testCases = {
+		{ "a:5 *", TwinsPropertyResult::Holds, true },
+		{ "a:1 c:0 . a:2 d:0 . |", TwinsPropertyResult::Holds, true },
+		{ "a:1 * b:0 . a:1 * c:0 . |", TwinsPropertyResult::Holds, true },
+		{ "a:1 * b:0 . a:2 * c:0 . |", TwinsPropertyResult::DoesNotHold, false }, // Functional, but the delay after a^n is n.
+		{ "a:1 * b:0 . a:2 * c:0 . | d:0 .", TwinsPropertyResult::DoesNotHold, false },
+		{ "a:5 a:100 | *", TwinsPropertyResult::DoesNotHold, false }, // Not functional.
+	};
+
+	size_t failedTests = 0;
+	std::cout << "RUNNING TESTS WITH " << testCases.size() << " SUBSEQUENTIAL TESTS:\n";
+	for (size_t i = 0; i < testCases.size(); ++i)
+	{
+		const auto& testCase = testCases[i];
+		std::cout << "\t" << i << ": \"" << testCase.regExpr << "\" ";
+
+		RegularFinalStateTransducerBuilder ts(testCase.regExpr.c_str());
+		auto transducer = ts.GetBuildedTransducer();
+		transducer->MakeRealTime();
+		transducer->UpdateRecognizingEmptyWord();
+		transducer->TestForFunctionality();
+
+		const auto twinsProperty = transducer->TestForTwinsProperty(1000);
+		const auto parallelTwinsProperty = transducer->TestForTwinsProperty(1000, 4);
+		const auto subsequential = transducer->MakeSubsequential(1000);
+		if (twinsProperty == testCase.twinsProperty && parallelTwinsProperty == testCase.twinsProperty && subsequential == testCase.subsequential &&
+			transducer->TestForTwinsProperty(1) == TwinsPropertyResult::TooManyStates)
+		{
+			std::cout << "passed\n";
+		}
+		else
+		{
+			std::cout << "failed!\n";
+			++failedTests;
+		}
+	}
+
+	// Many levels with many chunks of pair states, found by many threads.
+	const std::vector<GeneratedTest> largeTestCases = {
+		GenerateZipfianDictionary(300, "abc", 8, 1, 0, 1),
+		GenerateRomanNumerals(4, 1, false, 0, 2),
+	};
+	for (const auto& testCase : largeTestCases)
+	{
+		RegularFinalStateTransducerBuilder ts(testCase.regex.c_str());
+		auto transducer = ts.GetBuildedTransducer();
+		transducer->MakeRealTime();
+		transducer->UpdateRecognizingEmptyWord();
+		transducer->TestForFunctionality();
+
+		const auto twinsProperty = transducer->TestForTwinsProperty(1000000);
+		for (const unsigned threadsCount : { 2, 8 })
+		{
+			if (transducer->TestForTwinsProperty(1000000, threadsCount) != twinsProperty ||
+				transducer->TestForTwinsProperty(100, threadsCount) != TwinsPropertyResult::TooManyStates)
+			{
+				std::cout << "FAILED: \"" << testCase.name << "\" on " << threadsCount << " threads.\n";
+				++failedTests;
+			}
+		}
+	}
+
+	if (failedTests > 0)
+	{
+		std::cout << "Passed " << testCases.size() - failedTests << " tests.\n";
+		std::cout << "Failed " << failedTests << " tests.\n";
+	}
+	else
+	{
+		std::cout << "Passed all " << testCases.size() << " tests.\n";
+	}
+}
+
+struct ScanningTestCase
+{
+	std::string regExpr;
+	std::string text;
+	std::vector<std::pair<size_t, size_t>> longestMatches; // The expected [start, end) of the leftmost-longest matches.
+};
+
+// Scans @text with @transducer, feeding it in chunks of @chunkSize symbols. The matches are <start, end, outputs>.
+static std::vector<std::tuple<size_t, size_t, std::vector<Output>>> ScanText(const FinalStateTransducer& transducer, ScanMode mode,
+	const std::string& text, size_t chunkSize, size_t maxMatchLength = 0)
+{
+	TextScanner scanner(transducer, mode, maxMatchLength);
+	ScanResult result;
+	for (size_t i = 0; i < text.size(); i += chunkSize)
+	{
+		scanner.Feed(text.data() + i, std::min(chunkSize, text.size() - i), result);
+	}
+	scanner.Finish(result);
+
+	std::vector<std::tuple<size_t, size_t, std::vector<Output>>> matches;
+	for (const auto& match : result.Matches)
+	{
+		matches.emplace_back(match.start, match.end,
+			std::vector<Output>(result.Outputs.begin() + match.outputsBegin, result.Outputs.begin() + match.outputsEnd));
+	}
+	return matches;
+}
+
+// The expected matches: each part of @text (not longer than @maxMatchLength if it is not 0) is traversed separately.
+static std::vector<std::tuple<size_t, size_t, std::vector<Output>>> ScanTextByParts(const FinalStateTransducer& transducer, ScanMode mode,
+	const std::string& text, size_t maxMatchLength = 0)
+{
+	std::vector<std::vector<std::vector<Output>>> partOutputs(text.size() + 1, std::vector<std::vector<Output>>(text.size() + 1));
+	std::unordered_set<Output> outputs;
+	for (size_t start = 0; start < text.size(); ++start)
+	{
+		for (size_t end = start + 1; end <= text.size() && (maxMatchLength == 0 || end - start <= maxMatchLength); ++end)
+		{
+			transducer.TraverseWithWord(text.substr(start, end - start).c_str(), outputs);
+			partOutputs[start][end].assign(outputs.begin(), outputs.end());
+			std::sort(partOutputs[start][end].begin(), partOutputs[start][end].end());
+		}
+	}
+
+	std::vector<std::tuple<size_t, size_t, std::vector<Output>>> matches;
+	if (mode == ScanMode::AllMatches)
+	{
+		for (size_t end = 1; end <= text.size(); ++end)
+		{
+			for (size_t start = 0; start < end; ++start)
+			{
+				if (!partOutputs[start][end].empty())
+				{
+					matches.emplace_back(start, end, partOutputs[start][end]);
+				}
+			}
+		}
+		return matches;
+	}
+
+	for (size_t start = 0; start < text.size(); ++start)
+	{
+		for (size_t end = text.size(); end > start; --end)
+		{
+			if (!partOutputs[start][end].empty())
+			{
+				matches.emplace_back(start, end, partOutputs[start][end]);
+				start = end - 1;
+				break;
+			}
+		}
+	}
+	return matches;
+}
+
+void RunScanningTests()
+{
+	const std::vector<ScanningTestCase> testCases = {
+		{ "ab:1 abcd:2 | cd:3 |", "xabcdabcx", { { 1, 5 }, { 5, 7 } } },
+		{ "a:1 *", "aaba", { { 0, 2 }, { 3, 4 } } },
+		{ "a:1 b:2 . b:5 |", "abb", { { 0, 2 }, { 2, 3 } } },
+		{ "a:5 a:100 | *", "aa", { { 0, 2 } } }, // Not functional.
+		{ "abc:1 b:2 |", "abx", { { 1, 2 } } }, // The match from 0 fails after the one from 1 is found.
+		{ "abc:1 b:2 |", "abc", { { 0, 3 } } }, // The match from 0 is found after the one from 1.
+		{ "a:5 b:100 | c:1 . * d:3 |", "acbcdxacd", { { 0, 4 }, { 4, 5 }, { 6, 8 }, { 8, 9 } } },
+		{ ":3 a:5 |", "bab", { { 1, 2 } } }, // The empty matches are not reported.
+	};
+
+	const auto testsCount = testCases.size() + 1; // And the long run.
+	size_t failedTests = 0;
+	std::cout << "RUNNING TESTS WITH " << testsCount << " SCANNING TESTS:\n";
+	for (size_t i = 0; i < testCases.size(); ++i)
+	{
+		const auto& testCase = testCases[i];
+		std::cout << "\t" << i << ": \"" << testCase.regExpr << "\" in \"" << testCase.text << "\" ";
+
+		RegularFinalStateTransducerBuilder ts(testCase.regExpr.c_str());
+		auto transducer = ts.GetBuildedTransducer();
+		transducer->MakeRealTime();
+		transducer->UpdateRecognizingEmptyWord();
+		const auto functional = transducer->TestForFunctionality();
+
+		bool passed = true;
+		std::vector<std::pair<size_t, size_t>> longestMatches;
+		for (const auto& match : ScanText(*transducer, ScanMode::LeftmostLongest, testCase.text, 1))
+		{
+			longestMatches.emplace_back(std::get<0>(match), std::get<1>(match));
+		}
+		passed = longestMatches == testCase.longestMatches;
+
+		// The same with the frozen and the subsequential transducer, in chunks of different sizes.
+		for (int variant = 0; variant < 3; ++variant)
+		{
+			if ((variant == 1 && !transducer->Freeze(FrozenSymbolIndex::Compressed)) ||
+				(variant == 2 && (!functional || !transducer->MakeSubsequential())))
+			{
+				continue;
+			}
+			for (const auto mode : { ScanMode::LeftmostLongest, ScanMode::AllMatches })
+			{
+				for (const size_t maxMatchLength : { 0, 1, 2 })
+				{
+					const auto expectedMatches = ScanTextByParts(*transducer, mode, testCase.text, maxMatchLength);
+					for (const size_t chunkSize : { 1, 2, 5 })
+					{
+						passed = passed && ScanText(*transducer, mode, testCase.text, chunkSize, maxMatchLength) == expectedMatches;
+					}
+				}
+			}
+		}
+
+		if (passed)
+		{
+			std::cout << "passed\n";
+		}
+		else
+		{
+			std::cout << "failed!\n";
+			++failedTests;
+		}
+	}
+
+	// Every start stays alive over a run of 'a', the maximal match length keeps the level (and each step) small.
+	{
+		const size_t runLength = 100000, maxMatchLength = 64;
+		std::cout << "\t" << testCases.size() << ": \"a:1 *\" in a run of " << runLength << " 'a' with matches up to " << maxMatchLength << " symbols ";
+
+		RegularFinalStateTransducerBuilder ts("a:1 *");
+		auto transducer = ts.GetBuildedTransducer();
+		transducer->MakeRealTime();
+		transducer->UpdateRecognizingEmptyWord();
+
+		const auto matches = ScanText(*transducer, ScanMode::LeftmostLongest, std::string(runLength, 'a'), 4096, maxMatchLength);
+		bool passed = matches.size() == (runLength + maxMatchLength - 1) / maxMatchLength;
+		for (size_t i = 0; passed && i < matches.size(); ++i)
+		{
+			const auto start = i * maxMatchLength;
+			const auto end = std::min(start + maxMatchLength, runLength);
+			passed = matches[i] == std::make_tuple(start, end, std::vector<Output>{ (Output) (end - start) });
+		}
+
+		if (passed)
+		{
+			std::cout << "passed\n";
+		}
+		else
+		{
+			std::cout << "failed!\n";
+			++failedTests;
+		}
+	}
+
+	if (failedTests > 0)
+	{
+		std::cout << "Passed " << testsCount - failedTests << " tests.\n";
+		std::cout << "Failed " << failedTests << " tests.\n";
+	}
+	else
+	{
+		std::cout << "Passed all " << testsCount << " tests.\n";
+	}
+}
+
+struct SemiringTestCase
+{
+	std::string regExpr;
+	std::string word;
+	bool recognized;
+	Output minOutput;
+	Output maxOutput;
+	double logWeight;
+};
+
+// Traverses @word with @transducer in the semirings of Semirings.h and compares the weights with @testCase.
+static bool TestSemirings(const FinalStateTransducer& transducer, const SemiringTestCase& testCase)
+{
+	Output minOutput = 0, maxOutput = 0;
+	double logWeight = 0;
+	const auto word = testCase.word.c_str();
+	if (transducer.TraverseWithWordIn<TropicalSemiring>(word, minOutput) != testCase.recognized ||
+		transducer.TraverseWithWordIn<MaxPlusSemiring>(word, maxOutput) != testCase.recognized ||
+		transducer.TraverseWithWordIn<LogSemiring>(word, logWeight) != testCase.recognized)
+	{
+		return false;
+	}
+
+	return !testCase.recognized || (minOutput == testCase.minOutput && maxOutput == testCase.maxOutput &&
+		std::abs(logWeight - testCase.logWeight) < 1e-9);
+}
+
+void RunSemiringTests()
+{
+	const std::vector<SemiringTestCase> testCases = {
+		{ "a:5", "a", true, 5, 5, 5 },
+		{ "a:5", "b", false, 0, 0, 0 },
+		{ "a:5 a:100 | *", "aa", true, 10, 200, 10 - std::log1p(std::exp(-95.0) + std::exp(-190.0)) }, // 4 paths, 3 outputs.
+		{ "a:5 a:100 | *", "aaa", true, 15, 300, 15 - std::log1p(std::exp(-95.0) + std::exp(-190.0) + std::exp(-285.0)) },
+		{ "a:5 a:100 | *", "", true, 0, 0, 0 },
+		{ "a:1 b:2 . a:3 b:4 . |", "ab", true, 3, 7, 3 - std::log1p(std::exp(-4.0)) },
+		{ ":3 a:5 |", "", true, 0, 3, -std::log1p(std::exp(-3.0)) },
+		{ "abc:200 abc:300 | d:100 .", "abcd", true, 300, 400, 300 - std::log1p(std::exp(-100.0)) },
+		{ "a:5 a:5 |", "a", true, 5, 5, 5 }, // 2 paths with the same output (1 in the subsequential one).
+		{ ":5 :5 | a:1 |", "", true, 0, 5, -std::log1p(std::exp(-5.0)) },
+	};
+
+	size_t failedTests = 0;
+	std::cout << "RUNNING TESTS WITH " << testCases.size() << " SEMIRING TESTS:\n";
+	for (size_t i = 0; i < testCases.size(); ++i)
+	{
+		const auto& testCase = testCases[i];
+		std::cout << "\t" << i << ": \"" << testCase.regExpr << "\" with \"" << testCase.word << "\" ";
+
+		RegularFinalStateTransducerBuilder ts(testCase.regExpr.c_str());
+		auto transducer = ts.GetBuildedTransducer();
+		transducer->MakeRealTime();
+		transducer->UpdateRecognizingEmptyWord();
+		const auto functional = transducer->TestForFunctionality();
+		bool passed = TestSemirings(*transducer, testCase);
+		passed = passed && (!transducer->Freeze(FrozenSymbolIndex::Dense) || TestSemirings(*transducer, testCase));
+		passed = passed && (!functional || !transducer->MakeSubsequential() || TestSemirings(*transducer, testCase));
+
+		if (passed)
+		{
+			std::cout << "passed\n";
+		}
+		else
+		{
+			std::cout << "failed!\n";
+			++failedTests;
+		}
+	}
+
+	if (failedTests > 0)
+	{
+		std::cout << "Passed " << testCases.size() - failedTests << " tests.\n";
+		std::cout << "Failed " << failedTests << " tests.\n";
+	}
+	else
+	{
+		std::cout << "Passed all " << testCases.size() << " tests.\n";
+	}
+}
+
+// The sum of two outputs 4000000000 (more than 32 bits) in each traversal, as the build sums the outputs (see Output in SetOperations.h).
+void RunOutputOverflowTests()
+{
+#if defined(OUTPUTS_64_BIT)
+	const Output expectedOutput = 8000000000ull;
+#elif defined(CHECK_OUTPUT_OVERFLOW) || defined(SATURATE_OUTPUTS)
+	const Output expectedOutput = MAX_OUTPUT;
+#else
+	const Output expectedOutput = (Output) 8000000000ull; // Wraps around.
+#endif
+#if defined(CHECK_OUTPUT_OVERFLOW) && !defined(NDEBUG)
+	std::cout << "SKIPPING OUTPUT OVERFLOW TESTS, the overflows are asserted.\n";
+	return;
+#endif
+	const TestCaseInfo testCase = { "a:4000000000 *", true, true, { { "aa", { expectedOutput } } } };
+
+	std::cout << "RUNNING OUTPUT OVERFLOW TESTS (" << sizeof(Output) * 8 << "-bit outputs, expecting " << expectedOutput << "):\n";
+	RegularFinalStateTransducerBuilder ts(testCase.regExpr.c_str());
+	auto transducer = ts.GetBuildedTransducer();
+	transducer->MakeRealTime();
+	transducer->UpdateRecognizingEmptyWord();
+	transducer->TestForFunctionality();
+
+	size_t failedTests = TestTraversing(*transducer, testCase);
+	failedTests += TestTraversingBatch(*transducer, testCase);
+	transducer->Freeze();
+	failedTests += TestTraversing(*transducer, testCase);
+	if (transducer->MakeSubsequential())
+	{
+		failedTests += TestTraversing(*transducer, testCase);
+	}
+	else
+	{
+		std::cout << "FAILED: Expected the transducer to be subsequential.\n";
+		++failedTests;
+	}
+
+	if (failedTests > 0)
+	{
+		std::cout << "Failed " << failedTests << " tests.\n";
+	}
+	else
+	{
+		std::cout << "Passed all tests.\n";
+	}
+}
+
+// The frozen transducers are saved there and mapped with MappedTransducer.
+static const char* MAPPED_TEST_FILE = "FinalStateTransducerTests.fst";
+
+// Damages copies of the saved file @fileName, MappedTransducer has to reject each of them.
+// Returns the number of failed cases, @testCases is increased by the number of cases.
+static size_t TestMappingDamagedFiles(const char* fileName, size_t& testCases)
+{
+	std::ifstream file(fileName, std::ios::binary);
+	const std::string bytes{ std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>() };
+	file.close();
+
+	typedef void (*Damage)(MappedTransducerHeader& header);
+	const std::pair<Damage, const char*> damages[] = {
+		{ [](MappedTransducerHeader& header) { header.magic[0] ^= 1; }, "bad magic" },
+		{ [](MappedTransducerHeader& header) { ++header.version; }, "other version" },
+		{ [](MappedTransducerHeader& header) { header.flags ^= MAPPED_64_BIT_OUTPUTS; }, "other output width" },
+		{ [](MappedTransducerHeader& header) { header.transitionsAt = header.fileSize + 8; }, "transitions after the end" },
+		{ [](MappedTransducerHeader& header) { header.finalStatesAt = ~0ull - 7; }, "overflowing offset" },
+		{ [](MappedTransducerHeader& header) { header.symbolsAt += 1; }, "unaligned offset" },
+		// The file is cut after the header (and the size in the header is changed accordingly).
+		{ [](MappedTransducerHeader& header) { header.fileSize = sizeof(MappedTransducerHeader); }, "truncated arrays" },
+	};
+
+	size_t failedTests = 0;
+	std::vector<uint64_t> copy((bytes.size() + 7) / 8); // 8 bytes aligned.
+	const auto header = reinterpret_cast<MappedTransducerHeader*>(copy.data());
+	MappedTransducer mapped;
+	std::memcpy(copy.data(), bytes.data(), bytes.size());
+	++testCases;
+	if (bytes.size() < sizeof(MappedTransducerHeader) || !mapped.Attach(copy.data(), bytes.size()))
+	{
+		std::cout << "FAILED: The undamaged file was not attached.\n";
+		return failedTests + 1;
+	}
+	for (const auto& damage : damages)
+	{
+		std::memcpy(copy.data(), bytes.data(), bytes.size());
+		damage.first(*header);
+		++testCases;
+		if (mapped.Attach(copy.data(), (size_t) std::min<uint64_t>(header->fileSize, bytes.size())))
+		{
+			std::cout << "FAILED: The file with " << damage.second << " was attached.\n";
+			++failedTests;
+		}
+	}
+
+	// A file shorter than its header says, and one shorter than a header.
+	for (const auto size : { bytes.size() - 8, sizeof(MappedTransducerHeader) - 8 })
+	{
+		std::ofstream truncated(fileName, std::ios::binary | std::ios::trunc);
+		truncated.write(bytes.data(), size);
+		truncated.close();
+		++testCases;
+		if (mapped.Open(fileName))
+		{
+			std::cout << "FAILED: The file truncated to " << size << " bytes was opened.\n";
+			++failedTests;
+		}
+	}
+	return failedTests;
+}
+
 void RunFinalStateTransducerTests()
 {
 	PopulateWithTestCases();
@@ -2025,55 +2702,79 @@ void RunFinalStateTransducerTests()
 			++failedTests;
 		}
 
-		size_t testNumber = 0;
 		testCases += testCase.wordsAndExpectedOutputs.size();
-		for (const auto& wordAndOutputs : testCase.wordsAndExpectedOutputs)
-		{
-			std::unordered_set<unsigned> outputs;
-			const auto& testWord = wordAndOutputs.first;
-			const auto& testOutputs = wordAndOutputs.second;
+		failedTests += TestTraversing(*transducer, testCase);
+		testCases += testCase.wordsAndExpectedOutputs.size();
+		failedTests += TestTraversingBatch(*transducer, testCase);
+		testCases += testCase.wordsAndExpectedOutputs.size();
+		failedTests += TestTraversingInChunks(*transducer, testCase);
+		testCases += testCase.wordsAndExpectedOutputs.size();
+		failedTests += TestTraversingForOutput(*transducer, testCase);
 
-			transducer->TraverseWithWord(testWord.c_str(), outputs);
+		RegularFinalStateTransducerBuilder parallelTs(testCase.regExpr.c_str());
+		auto parallelTransducer = parallelTs.GetBuildedTransducer();
+		if (parallelTransducer->MakeRealTime(4) != infinite)
+		{
+			std::cout << "FAILED: The real-time conversion on 4 threads gave a different infinity.\n";
+			++failedTests;
+		}
+		parallelTransducer->UpdateRecognizingEmptyWord();
+		std::cout << "\tThe same words with the FST made real-time on 4 threads:\n";
+		testCases += testCase.wordsAndExpectedOutputs.size();
+		failedTests += TestTraversing(*parallelTransducer, testCase);
 
-			std::cout << "\t" << testNumber << ": \"" << testWord << "\" ";
-			for (const auto& expectedOutput : testOutputs)
+		const std::pair<FrozenSymbolIndex, const char*> symbolIndexes[] = {
+			{ FrozenSymbolIndex::None, "without symbol index" },
+			{ FrozenSymbolIndex::Compressed, "with compressed symbol index" },
+			{ FrozenSymbolIndex::Dense, "with dense symbol index" },
+		};
+		for (const auto& symbolIndex : symbolIndexes)
+		{
+			if (transducer->Freeze(symbolIndex.first))
 			{
-				std::cout << expectedOutput << " ";
-			}
+				std::cout << "\tThe same words with the frozen FST " << symbolIndex.second << ":\n";
+				testCases += testCase.wordsAndExpectedOutputs.size();
+				failedTests += TestTraversing(*transducer, testCase);
 
-			bool passed = false;
-			if (outputs.size() == testOutputs.size())
-			{
-				passed = true;
-				for (const auto& expectedOutput : testOutputs)
+				MappedTransducer mapped;
+				if (!transducer->SaveFrozen(MAPPED_TEST_FILE) || !mapped.Open(MAPPED_TEST_FILE) || mapped.IsFunctional() != functional)
 				{
-					if (outputs.find(expectedOutput) == outputs.end())
-					{
-						passed = false;
-						break;
-					}
+					std::cout << "FAILED: The frozen FST " << symbolIndex.second << " was not saved and mapped.\n";
+					++failedTests;
+					continue;
 				}
+				std::cout << "\tThe same words with the mapped FST " << symbolIndex.second << ":\n";
+				testCases += testCase.wordsAndExpectedOutputs.size();
+				failedTests += TestTraversing(mapped, testCase);
+				mapped.Close();
+				failedTests += TestMappingDamagedFiles(MAPPED_TEST_FILE, testCases);
 			}
+		}
 
-			if (passed)
-			{
-				std::cout << " - passing.\n";
-			}
-			else
-			{
-				std::cout << "\n\t\tFAILED\n";
-				std::cout << "\t\tGot the following output: ";
-				for (const auto& output : outputs)
-				{
-					std::cout << output << " ";
-				}
-				std::cout << ".\n";
-				++failedTests;
-			}
-			++testNumber;
+		testCases += testCase.wordsAndExpectedOutputs.size();
+		failedTests += TestTraversingBatch(*transducer, testCase);
+		testCases += testCase.wordsAndExpectedOutputs.size();
+		failedTests += TestTraversingBatch(*transducer, testCase, 4);
+		testCases += testCase.wordsAndExpectedOutputs.size();
+		failedTests += TestTraversingInChunks(*transducer, testCase);
+		testCases += testCase.wordsAndExpectedOutputs.size();
+		failedTests += TestTraversingForOutput(*transducer, testCase);
+
+		if (functional && transducer->MakeSubsequential())
+		{
+			std::cout << "\tThe same words with the subsequential FST:\n";
+			testCases += testCase.wordsAndExpectedOutputs.size();
+			failedTests += TestTraversing(*transducer, testCase);
+			testCases += testCase.wordsAndExpectedOutputs.size();
+			failedTests += TestTraversingBatch(*transducer, testCase);
+			testCases += testCase.wordsAndExpectedOutputs.size();
+			failedTests += TestTraversingInChunks(*transducer, testCase);
+			testCases += testCase.wordsAndExpectedOutputs.size();
+			failedTests += TestTraversingForOutput(*transducer, testCase);
 		}
 		std::cout << "\n";
 	}
+	std::remove(MAPPED_TEST_FILE);
 
 	if (failedTests > 0)
 	{
@@ -2084,4 +2785,179 @@ void RunFinalStateTransducerTests()
 	{
 		std::cout << "Passed all " << testCases << " tests.\n";
 	}
-}
\ No newline at end of file
+}
+// Each family of TestCaseGenerator.h at a small scale: the traversal has the outputs found by matching the expression.
+void RunGeneratedTests()
+{
+	const std::vector<GeneratedTest> tests = {
+		GenerateWordConcatenations("word", 10, 10, 1),
+		GenerateWordUnions("abc", 10, 10, 2),
+		GenerateZipfianDictionary(50, "abc", 5, 1, 30, 3),
+		GenerateNestedStars(3, true, false, 30, 4),
+		GenerateNestedStars(3, false, true, 30, 5),
+		GenerateRomanNumerals(4, 1, false, 30, 6),
+		GenerateRomanNumerals(2, 2, true, 30, 7),
+		GenerateAmbiguousUnions(3, 3, 30, 8),
+		GenerateLargeAlphabet(100, 50, 4, 30, 9),
+	};
+
+	std::cout << "RUNNING GENERATED TESTS:\n";
+	size_t failedTests = 0;
+	// The same regex as the one in test1.txt.
+	if (tests[0].regex != "word:1 word:2 word:3 word:4 word:5 word:6 word:7 word:8 word:9 word:10 . . . . . . . . .")
+	{
+		std::cout << "FAILED: The regex of the concatenations is \"" << tests[0].regex << "\".\n";
+		++failedTests;
+	}
+
+	const std::string fileName = "GeneratedTest.txt";
+	for (const auto& test : tests)
+	{
+		std::string regex;
+		std::vector<std::string> words;
+		std::vector<std::vector<Output>> expectedOutputs;
+		if (!WriteCustomTestFile(fileName, test) || !ReadCustomTestFile(fileName, regex, words, &expectedOutputs) ||
+			regex != test.regex || words != test.words || expectedOutputs != test.expectedOutputs)
+		{
+			std::cout << "FAILED: \"" << test.name << "\" is not read as written.\n";
+			++failedTests;
+		}
+
+		RegularFinalStateTransducerBuilder ts(test.regex.c_str());
+		auto transducer = ts.GetBuildedTransducer();
+		transducer->MakeRealTime();
+		transducer->UpdateRecognizingEmptyWord();
+		transducer->TestForFunctionality();
+		transducer->Freeze();
+
+		TraverseBatchResult result;
+		transducer->TraverseBatch(test.words, result);
+		for (size_t i = 0; i < test.words.size(); ++i)
+		{
+			if (!HasExpectedOutputs(result, i, test.expectedOutputs[i]))
+			{
+				std::cout << "FAILED: \"" << test.name << "\" with the word \"" << test.words[i] << "\".\n";
+				++failedTests;
+			}
+		}
+	}
+	std::remove(fileName.c_str());
+
+	if (failedTests > 0)
+	{
+		std::cout << "Failed " << failedTests << " tests.\n";
+	}
+	else
+	{
+		std::cout << "Passed all " << tests.size() << " tests.\n";
+	}
+}
+
+void RunStatsTests()
+{
+#if defined(COLLECT_STATS)
+	std::cout << "RUNNING STATS TESTS:\n";
+	size_t failedTests = 0;
+	auto expect = [&failedTests](bool condition, const char* description)
+	{
+		if (!condition)
+		{
+			std::cout << "FAILED: " << description << ".\n";
+			++failedTests;
+		}
+	};
+
+	RegularFinalStateTransducerBuilder ts("a:1 b:2 | :0 a:3 | . *");
+	auto transducer = ts.GetBuildedTransducer();
+	transducer->MakeRealTime();
+	transducer->UpdateRecognizingEmptyWord();
+	transducer->TestForFunctionality();
+	const auto& stats = transducer->GetStats();
+	expect(stats.built.epsilonTransitionsCount > 0, "The built transducer has epsilon transitions");
+	expect(stats.builtTransitionsPerLabel.at("a") == 2 && stats.builtTransitionsPerLabel.at("b") == 1, "The built transitions per label are counted");
+	expect(stats.epsilonClosure.statesCount > 0, "The epsilon closure is counted");
+	expect(stats.afterRemoveUpperEpsilon.epsilonTransitionsCount == 0, "The real-time transducer has no epsilon transitions");
+	expect(stats.functionalityPairStatesCount > 0 && stats.functionalityPairTransitionsCount > 0, "The pair states are counted");
+	expect(stats.realTimeAllocations.allocationsCount > 0, "The allocations of MakeRealTime are counted");
+
+	TraverseBatchResult result;
+	transducer->TraverseBatch({ "ab" }, result);
+	expect(stats.traversedWordsCount == 1 && stats.frontierSizes.size() == 3, "The levels of a word are counted");
+	const auto initialLevelSize = stats.frontierSizes.empty() ? 0 : stats.frontierSizes[0];
+	transducer->TraverseBatch({ "aa", "b", "" }, result); // The traversal counters are summed up.
+	expect(stats.traversedWordsCount == 4 && stats.frontierSizes.size() == 3 && stats.frontierSizes[0] == 4 * initialLevelSize,
+		"The frontier sizes are counted for each word");
+	expect(stats.maxFrontierSize > 0, "The max frontier size is counted");
+
+	transducer->ResetStats();
+	expect(stats.traversedWordsCount == 0 && stats.frontierSizes.empty(), "The stats are reset");
+
+	if (failedTests > 0)
+	{
+		std::cout << "Failed " << failedTests << " tests.\n";
+	}
+	else
+	{
+		std::cout << "Passed all tests.\n";
+	}
+#else
+	std::cout << "SKIPPING STATS TESTS, COLLECT_STATS is not defined.\n";
+#endif
+}
+
+void RunTraceTests()
+{
+#if defined(TRACE)
+	std::cout << "RUNNING TRACE TESTS:\n";
+	size_t failedTests = 0;
+
+	StartTrace();
+	{
+		RegularFinalStateTransducerBuilder ts("a:1 b:2 | :0 a:3 | . *");
+		auto transducer = ts.GetBuildedTransducer();
+		transducer->MakeRealTime();
+		transducer->UpdateRecognizingEmptyWord();
+		transducer->TestForFunctionality();
+	}
+	StopTrace();
+
+	const std::string fileName = "FinalStateTransducerTests.trace.json";
+	if (!WriteTrace(fileName))
+	{
+		std::cout << "FAILED: The trace is not written.\n";
+		++failedTests;
+	}
+	std::ifstream f(fileName);
+	const std::string trace((std::istreambuf_iterator<char>(f)), std::istreambuf_iterator<char>());
+	f.close();
+	std::remove(fileName.c_str());
+
+	const char* expectedEvents[] = { "Build", "AddWord", "Union", "Concat", "CloseStar", "MakeRealTime", "RemoveEpsilon", "Expand",
+		"RemoveUpperEpsilon", "TestForFunctionality", "states" };
+	for (const auto name : expectedEvents)
+	{
+		if (trace.find(std::string("{\"name\": \"") + name + "\"") == std::string::npos)
+		{
+			std::cout << "FAILED: There is no \"" << name << "\" event in the trace.\n";
+			++failedTests;
+		}
+	}
+	if (trace.find("\"traceEvents\": [") == std::string::npos || trace.find("\"ph\": \"X\"") == std::string::npos ||
+		trace.find("\"ph\": \"C\"") == std::string::npos)
+	{
+		std::cout << "FAILED: The trace is not in the trace event format.\n";
+		++failedTests;
+	}
+
+	if (failedTests > 0)
+	{
+		std::cout << "Failed " << failedTests << " tests.\n";
+	}
+	else
+	{
+		std::cout << "Passed all tests.\n";
+	}
+#else
+	std::cout << "SKIPPING TRACE TESTS, TRACE is not defined.\n";
+#endif
+}
@@ -0,0 +1,49 @@
+#include "FrozenTransitions.h"
+
+static_assert(sizeof(unsigned) == sizeof(uint32_t), "The offsets of FrozenDelta are used as uint32_t.");
+static_assert(sizeof(FrozenStateIndex) == 12, "The state indexes are mapped as 3 x uint32.");
+
+void UniqueLevel(std::vector<Transition>& levels, size_t levelStart)
+{
+	std::sort(levels.begin() + levelStart, levels.end(), [](const Transition& l, const Transition& r)
+	{
+		return l.state < r.state || (l.state == r.state && l.output < r.output);
+	});
+	levels.erase(std::unique(levels.begin() + levelStart, levels.end()), levels.end());
+}
+
+bool TraverseFrozenTransitions(const FrozenTransitions& transitions, const char* word, std::vector<Transition>& level,
+	std::vector<Transition>& nextLevel, std::vector<size_t>* frontierSizes)
+{
+	if (frontierSizes)
+	{
+		frontierSizes->push_back(level.size());
+	}
+
+	const Transition* begin;
+	const Transition* end;
+	for (const char* pWord = word; *pWord; ++pWord)
+	{
+		nextLevel.clear();
+		for (const auto& currTransition : level)
+		{
+			transitions.Find(currTransition.state, (unsigned char) *pWord, begin, end);
+			for (auto transition = begin; transition != end; ++transition) // Add all found transitions to the next level, because we have read one more symbol.
+			{
+				nextLevel.push_back(Transition{ transition->state, AddOutputs(currTransition.output, transition->output) });
+			}
+		}
+
+		UniqueLevel(nextLevel, 0);
+		level.swap(nextLevel);
+		if (frontierSizes)
+		{
+			frontierSizes->push_back(level.size());
+		}
+		if (level.empty())
+		{
+			return false;
+		}
+	}
+	return true;
+}
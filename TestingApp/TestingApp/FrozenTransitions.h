@@ -0,0 +1,99 @@
+#pragma once
+
+#include <algorithm>
+#include <bitset>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "SetOperations.h"
+
+/*
+	The transitions of a frozen (real-time) transducer in compressed sparse row form. They are the same in memory
+	(FinalStateTransducer::FrozenDelta) and in a mapped file (MappedTransducer), so both are searched and traversed by the code below:
+	the transitions from state 'i' are Transitions[StateOffsets[i]] ... Transitions[StateOffsets[i + 1] - 1],
+	sorted by their symbol (Symbols[k] is the symbol of Transitions[k]).
+
+	Optional symbol index per state:
+	Dense: SymbolOffsets[at + c] is the first transition with symbol 'c' and SymbolOffsets[at + c + 1] is the end, 257 elements.
+	Compressed: Bitmaps[bitmapAt] ... Bitmaps[bitmapAt + 3] has the bits of the state's symbols and
+	SymbolOffsets[at + k] is the first transition of the k-th symbol (by popcount), one more element for the end.
+*/
+
+// The kinds of the state indexes.
+const uint32_t FROZEN_NO_TRANSITIONS = 0;
+const uint32_t FROZEN_COMPRESSED_INDEX = 1;
+const uint32_t FROZEN_DENSE_INDEX = 2;
+
+struct FrozenStateIndex
+{
+	uint32_t kind;
+	uint32_t bitmapAt;
+	uint32_t at;
+};
+
+// The arrays, owned by a FrozenDelta or a mapped file.
+struct FrozenTransitions
+{
+	const uint32_t* StateOffsets;
+	const unsigned char* Symbols;
+	const Transition* Transitions;
+	const FrozenStateIndex* StateIndexes; // nullptr without a symbol index.
+	const uint32_t* SymbolOffsets;
+	const uint64_t* Bitmaps;
+
+	// The transitions from @state with @symbol are [@begin, @end).
+	void Find(unsigned state, unsigned char symbol, const Transition*& begin, const Transition*& end) const
+	{
+		if (StateIndexes != nullptr)
+		{
+			const auto& stateIndex = StateIndexes[state];
+			switch (stateIndex.kind)
+			{
+			case FROZEN_DENSE_INDEX:
+				begin = Transitions + SymbolOffsets[stateIndex.at + symbol];
+				end = Transitions + SymbolOffsets[stateIndex.at + symbol + 1];
+				return;
+			case FROZEN_COMPRESSED_INDEX:
+			{
+				const auto bitmap = Bitmaps + stateIndex.bitmapAt;
+				const unsigned word = symbol / 64;
+				const auto bit = 1ull << (symbol % 64);
+				if (!(bitmap[word] & bit))
+				{
+					begin = end = Transitions;
+					return;
+				}
+
+				// The place of the symbol is the number of the state's symbols before it.
+				size_t rank = std::bitset<64>(bitmap[word] & (bit - 1)).count();
+				for (unsigned i = 0; i < word; ++i)
+				{
+					rank += std::bitset<64>(bitmap[i]).count();
+				}
+				begin = Transitions + SymbolOffsets[stateIndex.at + rank];
+				end = Transitions + SymbolOffsets[stateIndex.at + rank + 1];
+				return;
+			}
+			default:
+				begin = end = Transitions;
+				return;
+			}
+		}
+
+		const auto first = StateOffsets[state];
+		const auto last = StateOffsets[state + 1];
+		const auto range = std::equal_range(Symbols + first, Symbols + last, symbol);
+
+		begin = Transitions + (range.first - Symbols);
+		end = Transitions + (range.second - Symbols);
+	}
+};
+
+// Removes the repeating <state, accumulated output> pairs from the last level, which starts at @levelStart.
+void UniqueLevel(std::vector<Transition>& levels, size_t levelStart);
+
+// Reads @word from the <state, accumulated output> pairs in @level, which become the pairs after it (sorted, without repetitions).
+// @nextLevel is a buffer. Returns false if @word can not be read. The size of each level (the first one too) is added to @frontierSizes
+// if it is not nullptr.
+bool TraverseFrozenTransitions(const FrozenTransitions& transitions, const char* word, std::vector<Transition>& level,
+	std::vector<Transition>& nextLevel, std::vector<size_t>* frontierSizes);
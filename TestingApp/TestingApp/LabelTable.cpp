@@ -0,0 +1,63 @@
+#include <cstring>
+#include <boost/functional/hash.hpp>
+#include "LabelTable.h"
+
+LabelTable::LabelTable()
+{
+	Words.reserve(1 + SYMBOL_LABELS_COUNT);
+	Words.push_back(WordInArena{ 0, 0 }); // epsilon
+	for (unsigned symbol = 0; symbol < SYMBOL_LABELS_COUNT; ++symbol)
+	{
+		Words.push_back(WordInArena{ Arena.size(), 1 });
+		Arena.push_back((char) symbol);
+	}
+}
+
+unsigned LabelTable::Intern(const char* word, size_t length)
+{
+	if (length == 0)
+	{
+		return EPSILON_LABEL;
+	}
+	if (length == 1)
+	{
+		return SymbolLabel((unsigned char) *word);
+	}
+
+	const auto hash = boost::hash_range(word, word + length);
+	const auto range = LabelsByHash.equal_range(hash);
+	for (auto it = range.first; it != range.second; ++it)
+	{
+		const auto& inArena = Words[it->second];
+		if (inArena.length == length && std::memcmp(Arena.data() + inArena.offset, word, length) == 0)
+		{
+			return it->second;
+		}
+	}
+
+	const auto label = (unsigned) Words.size();
+	Words.push_back(WordInArena{ Arena.size(), length });
+	Arena.append(word, length);
+	LabelsByHash.insert({ hash, label });
+	return label;
+}
+
+const char* LabelTable::Word(unsigned label) const
+{
+	return Arena.data() + Words[label].offset;
+}
+
+size_t LabelTable::Length(unsigned label) const
+{
+	return Words[label].length;
+}
+
+unsigned LabelTable::LabelsCount() const
+{
+	return (unsigned) Words.size();
+}
+
+size_t LabelTable::ArenaSize() const
+{
+	return Arena.size();
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+/*
+	The words on the transitions are kept as labels (32-bit ids) and the words themselves are in one arena.
+	The empty word (epsilon) is label 0 and each one symbol word 'c' is label 1 + c,
+	so the real-time transducers (only one symbol transitions) need no lookups in the table.
+	One table is shared by all transducers which are combined (e.g. by the builder), so the labels can be used between them.
+*/
+
+const unsigned EPSILON_LABEL = 0;
+const unsigned SYMBOL_LABELS_COUNT = 256;
+
+inline unsigned SymbolLabel(unsigned char symbol)
+{
+	return 1 + symbol;
+}
+
+inline bool IsSymbolLabel(unsigned label)
+{
+	return label >= 1 && label <= SYMBOL_LABELS_COUNT;
+}
+
+inline unsigned char LabelSymbol(unsigned label)
+{
+	return (unsigned char) (label - 1);
+}
+
+class LabelTable
+{
+public:
+	LabelTable();
+
+	// Returns the label of the word [@word, @word + @length), adds it if it is a new one.
+	unsigned Intern(const char* word, size_t length);
+
+	// The word of the @label is [Word(label), Word(label) + Length(label)), not null terminated.
+	const char* Word(unsigned label) const;
+	size_t Length(unsigned label) const;
+
+	unsigned LabelsCount() const;
+	size_t ArenaSize() const;
+private:
+	struct WordInArena
+	{
+		size_t offset;
+		size_t length;
+	};
+
+	std::string Arena;
+	std::vector<WordInArena> Words; // The word of each label.
+	std::unordered_multimap<size_t, unsigned> LabelsByHash; // Only the words longer than one symbol, the words are compared in the arena.
+};
@@ -0,0 +1,234 @@
+#include <cstring>
+#include <vector>
+#include "MappedTransducer.h"
+
+#if defined(_WIN32)
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static_assert(sizeof(Transition) == 2 * sizeof(Output), "The transitions are mapped as <uint32 state, output>.");
+static_assert(sizeof(MappedTransducerHeader) % 8 == 0, "The arrays after the header are 8 bytes aligned.");
+
+MappedTransducer::MappedTransducer()
+	: Data(nullptr)
+	, Size(0)
+	, Mapping(nullptr)
+	, Header(nullptr)
+	, Transitions{}
+	, FinalStates(nullptr)
+	, InitialStates(nullptr)
+	, InitialEpsilonOutputs(nullptr)
+{
+}
+
+MappedTransducer::~MappedTransducer()
+{
+	Close();
+}
+
+bool MappedTransducer::Open(const char* fileName)
+{
+	Close();
+
+	void* view = nullptr;
+	size_t size = 0;
+#if defined(_WIN32)
+	const auto file = CreateFileA(fileName, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		return false;
+	}
+	LARGE_INTEGER fileSize;
+	if (GetFileSizeEx(file, &fileSize) && fileSize.QuadPart > 0)
+	{
+		const auto mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (mapping != nullptr)
+		{
+			view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+			size = (size_t) fileSize.QuadPart;
+			CloseHandle(mapping); // The view keeps the mapping.
+		}
+	}
+	CloseHandle(file);
+#else
+	const auto file = open(fileName, O_RDONLY);
+	if (file < 0)
+	{
+		return false;
+	}
+	struct stat fileStat;
+	if (fstat(file, &fileStat) == 0 && fileStat.st_size > 0)
+	{
+		view = mmap(nullptr, (size_t) fileStat.st_size, PROT_READ, MAP_SHARED, file, 0);
+		if (view == MAP_FAILED)
+		{
+			view = nullptr;
+		}
+		size = (size_t) fileStat.st_size;
+	}
+	close(file); // The mapping stays.
+#endif
+	if (view == nullptr)
+	{
+		return false;
+	}
+
+	if (!Attach(view, size))
+	{
+#if defined(_WIN32)
+		UnmapViewOfFile(view);
+#else
+		munmap(view, size);
+#endif
+		return false;
+	}
+	Mapping = view;
+	return true;
+}
+
+bool MappedTransducer::Attach(const void* data, size_t size)
+{
+	Close();
+
+	const auto header = static_cast<const MappedTransducerHeader*>(data);
+	if (data == nullptr || (uintptr_t) data % 8 != 0 || size < sizeof(MappedTransducerHeader) ||
+		std::memcmp(header->magic, MAPPED_TRANSDUCER_MAGIC, sizeof(MAPPED_TRANSDUCER_MAGIC)) != 0 ||
+		header->version != MAPPED_TRANSDUCER_VERSION || header->fileSize != size ||
+		((header->flags & MAPPED_64_BIT_OUTPUTS) != 0) != (sizeof(Output) == sizeof(uint64_t)))
+	{
+		return false;
+	}
+
+	// Each array has to be inside the file. The contents are trusted (as written by SaveFrozen), they are not checked one by one.
+	const bool hasSymbolIndex = (header->flags & MAPPED_HAS_SYMBOL_INDEX) != 0;
+	const std::pair<uint64_t, uint64_t> arrays[] = { // <offset, bytes>
+		{ header->stateOffsetsAt, (header->statesCount + 1ull) * sizeof(uint32_t) },
+		{ header->symbolsAt, header->transitionsCount * 1ull },
+		{ header->transitionsAt, header->transitionsCount * (uint64_t) sizeof(Transition) },
+		{ header->finalStatesAt, (header->statesCount + 63ull) / 64 * sizeof(uint64_t) },
+		{ header->initialStatesAt, header->initialStatesCount * (uint64_t) sizeof(uint32_t) },
+		{ header->initialEpsilonOutputsAt, header->initialEpsilonOutputsCount * (uint64_t) sizeof(Output) },
+		{ header->stateIndexesAt, hasSymbolIndex ? header->statesCount * (uint64_t) sizeof(FrozenStateIndex) : 0 },
+		{ header->symbolOffsetsAt, header->symbolOffsetsCount * (uint64_t) sizeof(uint32_t) },
+		{ header->bitmapsAt, header->bitmapsCount * (uint64_t) sizeof(uint64_t) },
+	};
+	for (const auto& array : arrays)
+	{
+		if (array.first % 8 != 0 || array.first > size || array.second > size - array.first)
+		{
+			return false;
+		}
+	}
+
+	Data = static_cast<const char*>(data);
+	Size = size;
+	Header = header;
+	Transitions.StateOffsets = reinterpret_cast<const uint32_t*>(Data + header->stateOffsetsAt);
+	Transitions.Symbols = reinterpret_cast<const unsigned char*>(Data + header->symbolsAt);
+	Transitions.Transitions = reinterpret_cast<const Transition*>(Data + header->transitionsAt);
+	FinalStates = reinterpret_cast<const uint64_t*>(Data + header->finalStatesAt);
+	InitialStates = reinterpret_cast<const uint32_t*>(Data + header->initialStatesAt);
+	InitialEpsilonOutputs = reinterpret_cast<const Output*>(Data + header->initialEpsilonOutputsAt);
+	Transitions.StateIndexes = hasSymbolIndex ? reinterpret_cast<const FrozenStateIndex*>(Data + header->stateIndexesAt) : nullptr;
+	Transitions.SymbolOffsets = reinterpret_cast<const uint32_t*>(Data + header->symbolOffsetsAt);
+	Transitions.Bitmaps = reinterpret_cast<const uint64_t*>(Data + header->bitmapsAt);
+
+	if (Transitions.StateOffsets[header->statesCount] != header->transitionsCount)
+	{
+		Close();
+		return false;
+	}
+	return true;
+}
+
+void MappedTransducer::Close()
+{
+	if (Mapping != nullptr)
+	{
+#if defined(_WIN32)
+		UnmapViewOfFile(Mapping);
+#else
+		munmap(Mapping, Size);
+#endif
+		Mapping = nullptr;
+	}
+	Data = nullptr;
+	Size = 0;
+	Header = nullptr;
+	Transitions = FrozenTransitions{};
+}
+
+bool MappedTransducer::IsOpen() const
+{
+	return Header != nullptr;
+}
+
+bool MappedTransducer::GetRecognizingEmptyWord() const
+{
+	return IsOpen() && (Header->flags & MAPPED_RECOGNIZING_EMPTY_WORD) != 0;
+}
+
+bool MappedTransducer::IsInfinite() const
+{
+	return IsOpen() && (Header->flags & MAPPED_INFINITE) != 0;
+}
+
+bool MappedTransducer::IsFunctional() const
+{
+	return IsOpen() && (Header->flags & MAPPED_FUNCTIONAL) != 0;
+}
+
+unsigned MappedTransducer::GetStatesCount() const
+{
+	return IsOpen() ? Header->statesCount : 0;
+}
+
+unsigned MappedTransducer::GetTransitionsCount() const
+{
+	return IsOpen() ? Header->transitionsCount : 0;
+}
+
+bool MappedTransducer::IsFinal(unsigned state) const
+{
+	return (FinalStates[state / 64] >> (state % 64)) & 1;
+}
+
+bool MappedTransducer::TraverseWithWord(const char* word, std::unordered_set<Output>& outputs) const
+{
+	outputs.clear();
+	if (!word || !IsOpen()) return false;
+
+	std::vector<Transition> currLevel, nextLevel; // The BFS levels (<state, accumulated output>).
+	for (uint32_t i = 0; i < Header->initialStatesCount; ++i)
+	{
+		currLevel.push_back(Transition{ InitialStates[i], 0 });
+	}
+	if (!TraverseFrozenTransitions(Transitions, word, currLevel, nextLevel, nullptr))
+	{
+		return false;
+	}
+
+	if (!*word && GetRecognizingEmptyWord())
+	{
+		outputs.insert(InitialEpsilonOutputs, InitialEpsilonOutputs + Header->initialEpsilonOutputsCount);
+		outputs.insert(0);
+	}
+	else
+	{
+		for (const auto& currTransition : currLevel)
+		{
+			if (IsFinal(currTransition.state))
+			{
+				outputs.insert(currTransition.output);
+			}
+		}
+	}
+
+	return !outputs.empty();
+}
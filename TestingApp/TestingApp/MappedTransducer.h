@@ -0,0 +1,100 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <unordered_set>
+#include "FrozenTransitions.h"
+
+/*
+	Binary file of a frozen (real-time) transducer, written by FinalStateTransducer::SaveFrozen.
+	It is position-independent: the header has the byte offsets (from the beginning of the file) of the arrays,
+	so the file is mapped read-only and traversed in place, without reading it into other structures.
+	The numbers are in the byte order of the machine which wrote it, the arrays are 8 bytes aligned.
+	The outputs are 32 or 64 bits wide (MAPPED_64_BIT_OUTPUTS, see Output), a file is mapped only by a build with the same width.
+
+	[header]
+	[state offsets]          statesCount + 1 x uint32, the transitions of state 'i' are [stateOffsets[i], stateOffsets[i + 1])
+	[symbols]                transitionsCount x uint8, sorted for each state
+	[transitions]            transitionsCount x <uint32 state, output> (with 4 padding bytes before a 64-bit output)
+	[final states]           (statesCount + 63) / 64 x uint64, a bit for each state
+	[initial states]         initialStatesCount x uint32
+	[initial epsilon outputs] initialEpsilonOutputsCount x output
+	[state indexes]          statesCount x <uint32 kind, uint32 bitmapAt, uint32 at>, only with MAPPED_HAS_SYMBOL_INDEX
+	[symbol offsets]         symbolOffsetsCount x uint32
+	[bitmaps]                bitmapsCount x uint64
+	The arrays from the state offsets to the bitmaps, except the final states, are searched by FrozenTransitions.
+*/
+
+const char MAPPED_TRANSDUCER_MAGIC[8] = { 'F', 'S', 'T', 'F', 'R', 'O', 'Z', 'N' };
+const uint32_t MAPPED_TRANSDUCER_VERSION = 1;
+
+// The flags in the header.
+const uint32_t MAPPED_FUNCTIONAL = 1;
+const uint32_t MAPPED_INFINITE = 2;
+const uint32_t MAPPED_RECOGNIZING_EMPTY_WORD = 4;
+const uint32_t MAPPED_HAS_SYMBOL_INDEX = 8;
+const uint32_t MAPPED_64_BIT_OUTPUTS = 16;
+
+struct MappedTransducerHeader
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t flags;
+	uint32_t statesCount;
+	uint32_t transitionsCount;
+	uint32_t initialStatesCount;
+	uint32_t initialEpsilonOutputsCount;
+	uint32_t symbolOffsetsCount;
+	uint32_t bitmapsCount;
+	uint64_t stateOffsetsAt;
+	uint64_t symbolsAt;
+	uint64_t transitionsAt;
+	uint64_t finalStatesAt;
+	uint64_t initialStatesAt;
+	uint64_t initialEpsilonOutputsAt;
+	uint64_t stateIndexesAt;
+	uint64_t symbolOffsetsAt;
+	uint64_t bitmapsAt;
+	uint64_t fileSize;
+};
+
+/*
+	A transducer file mapped read-only. The pages are shared by all processes which map the same file.
+	The traversal gives the same outputs as the frozen transducer which was saved.
+*/
+class MappedTransducer
+{
+public:
+	MappedTransducer();
+	~MappedTransducer();
+
+	MappedTransducer(const MappedTransducer&) = delete;
+	MappedTransducer& operator=(const MappedTransducer&) = delete;
+
+	// Maps the file. Returns false if it can not be mapped or it is not a transducer file of this version.
+	bool Open(const char* fileName);
+	// Uses the file which is already in memory at @data (8 bytes aligned, it has to live while it is used). The same checks as Open.
+	bool Attach(const void* data, size_t size);
+	void Close();
+	bool IsOpen() const;
+
+	bool TraverseWithWord(const char* word, std::unordered_set<Output>& outputs) const;
+
+	bool GetRecognizingEmptyWord() const;
+	bool IsInfinite() const;
+	bool IsFunctional() const;
+	unsigned GetStatesCount() const;
+	unsigned GetTransitionsCount() const;
+private:
+	bool IsFinal(unsigned state) const;
+
+	const char* Data;
+	size_t Size;
+	void* Mapping; // The mapped view if the file was opened by Open, otherwise nullptr.
+
+	const MappedTransducerHeader* Header;
+	FrozenTransitions Transitions;
+	const uint64_t* FinalStates;
+	const uint32_t* InitialStates;
+	const Output* InitialEpsilonOutputs;
+};
@@ -2,9 +2,9 @@
 #include <iostream>
 #include "RegularFinalStateTransducerBuilder.h"
 #include "AssertLog.h"
+#include "Trace.h"
 
 RegularFinalStateTransducerBuilder::RegularFinalStateTransducerBuilder(const char* regExpr)
-	: transducer(nullptr)
 {
 	auto regExprLen = std::strlen(regExpr);
 	regExprHolder = new (std::nothrow) char[regExprLen + 1];
@@ -19,6 +19,7 @@ RegularFinalStateTransducerBuilder::RegularFinalStateTransducerBuilder(const cha
 
 void RegularFinalStateTransducerBuilder::build()
 {
+	TRACE_SCOPE("Build");
 	//stack.reserve(regExpr.length() / 4); // Some 'random' optimization...
 #if defined(INFO)
 	std::cout << "Buidling a final state transudcer with regular expression \"" << regExprHolder << "\".\n";
@@ -78,14 +79,18 @@ void RegularFinalStateTransducerBuilder::build()
 			{
 				++pRegExpr;
 			}
-			stack.push_back(FinalStateTransducer(pCurrStart, separatorAt, currLength));
+			TRACE_SCOPE("AddWord");
+			stack.push_back(transducer.AddWord(pCurrStart, separatorAt, currLength));
 		}
 	}
 
 	LogAndAssert(stack.size() == 1,
 		(stack.size() > 1 ? "There are more than one objects left to apply operations to."
 			: "There are no constructed objects."))	;
-	transducer = &stack[0];  // TODO move it here!!!!
+	if (!stack.empty())
+	{
+		transducer.SetStates(stack[0]);
+	}
 
 #if defined(INFO)
 	std::cout << "Done buidling it.\n";
@@ -94,37 +99,41 @@ void RegularFinalStateTransducerBuilder::build()
 
 void RegularFinalStateTransducerBuilder::executeStarOperation()
 {
+	TRACE_SCOPE("CloseStar");
 #if defined(INFO)
 	std::cout << "Maikng a Kleene star." << std::endl;
 #endif
 	assert(stack.size() >= 1);
-	stack.back().CloseStar();
+	transducer.CloseStar(stack.back());
 }
 void RegularFinalStateTransducerBuilder::executePlusOperation()
 {
+	TRACE_SCOPE("ClosePlus");
 #if defined(INFO)
 	std::cout << "Maikng a plus close." << std::endl;
 #endif
 	assert(stack.size() >= 1);
-	stack.back().ClosePlus();
+	transducer.ClosePlus(stack.back());
 }
 void RegularFinalStateTransducerBuilder::executeConcatOperation()
 {
+	TRACE_SCOPE("Concat");
 #if defined(INFO)
 	std::cout << "Maikng a concatenation." << std::endl;
 #endif
 	assert(stack.size() >= 2);
 	auto last = stack.size() - 1;
-	stack[last - 1].Concat(stack[last]);
+	transducer.Concat(stack[last - 1], stack[last]);
 	stack.pop_back();
 }
 void RegularFinalStateTransducerBuilder::executeUnionOperation()
 {
+	TRACE_SCOPE("Union");
 #if defined(INFO)
 	std::cout << "Maikng a union." << std::endl;
 #endif
 	assert(stack.size() >= 2);
 	auto last = stack.size() - 1;
-	stack[last - 1].Union(stack[last]);
+	transducer.Union(stack[last - 1], stack[last]);
 	stack.pop_back();
 }
@@ -21,7 +21,7 @@ public:
 	RegularFinalStateTransducerBuilder(const char* regExpr);
 	~RegularFinalStateTransducerBuilder() { delete regExprHolder; }
 
-	FinalStateTransducer* GetBuildedTransducer() { return transducer; }
+	FinalStateTransducer* GetBuildedTransducer() { return &transducer; }
 private:
 	void build();
 	void executeStarOperation();
@@ -29,8 +29,8 @@ private:
 	void executeConcatOperation();
 	void executeUnionOperation();
 
-	FinalStateTransducer* transducer;
-	std::vector<FinalStateTransducer> stack;
+	FinalStateTransducer transducer; // All the states are added directly here, the stack keeps only the initial and final ones of each operand.
+	std::vector<TransducerFragment> stack;
 	char* regExprHolder;
 private:
 	RegularFinalStateTransducerBuilder(const RegularFinalStateTransducerBuilder& other) = delete;
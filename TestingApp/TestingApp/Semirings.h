@@ -0,0 +1,64 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include "SetOperations.h"
+
+/*
+	The weight policies for FinalStateTransducer::TraverseWithWordIn. Each one has
+	- Weight: the type of the weights,
+	- FromOutput(output): the weight of an output (of a transition, an initial or a final one),
+	- Times(a, b): the weight of a path from the weights of its two parts (the outputs are summed along a path, so it is their '+'),
+	- Plus(a, b): the weight of two outputs of the same word,
+	- Idempotent: true if Plus(a, a) == a.
+	The weight of a word is the Plus of the weights of its distinct outputs, so it does not depend on how many paths have the same output
+	(which is different for the real-time, frozen and subsequential forms of the same transducer).
+	With an idempotent Plus the paths which reach the same state are combined there, i.e. a BFS level has one weight for each state
+	(Plus is commutative and associative and Times distributes over it). The others are found from the outputs of TraverseWithWord.
+
+	The weights of the integer ones are outputs, their sums saturate at the maximal output instead of wrapping
+	(so the minimum or maximum of the state's paths is still the one of the longer paths).
+	The weights only exist during the traversal, the transition tables store the outputs as they are.
+*/
+
+inline Output SaturatingSum(Output a, Output b)
+{
+	return a > std::numeric_limits<Output>::max() - b ? std::numeric_limits<Output>::max() : a + b;
+}
+
+// The minimal output of a word (min, +).
+struct TropicalSemiring
+{
+	typedef Output Weight;
+
+	static Weight FromOutput(Output output) { return output; }
+	static Weight Times(Weight a, Weight b) { return SaturatingSum(a, b); }
+	static Weight Plus(Weight a, Weight b) { return std::min(a, b); }
+	static const bool Idempotent = true;
+};
+
+// The maximal output of a word (max, +).
+struct MaxPlusSemiring
+{
+	typedef Output Weight;
+
+	static Weight FromOutput(Output output) { return output; }
+	static Weight Times(Weight a, Weight b) { return SaturatingSum(a, b); }
+	static Weight Plus(Weight a, Weight b) { return std::max(a, b); }
+	static const bool Idempotent = true;
+};
+
+// The outputs are costs (negative log probabilities), the weight of a word is -log(sum of exp(-cost) of its distinct outputs).
+struct LogSemiring
+{
+	typedef double Weight;
+
+	static Weight FromOutput(Output output) { return (double) output; }
+	static Weight Times(Weight a, Weight b) { return a + b; }
+	static Weight Plus(Weight a, Weight b)
+	{
+		return std::min(a, b) - std::log1p(std::exp(-std::abs(a - b)));
+	}
+	static const bool Idempotent = false;
+};
@@ -1,4 +1,7 @@
 #include <iostream>
+#include <algorithm>
+#include <bitset>
+#include <cstdint>
 #include "SetOperations.h"
 
 
@@ -13,17 +16,18 @@ void TransitiveClosure(SetOfTransitions& r)
 		First devided by the first transition state('a'); second on the level of "connection" (number of states to go through to get to the 'one')
 	*/
 	auto cR = r; // {<a, [b]>}, a map of states 'a' and their destinations, i.e. a set of b's ([b])
+	MonotonicArena arena; // For the sets of each level.
 	auto cnt = 0;
 	for (auto& destinations : cR) // @destinations is a pair <a, [b]> for which the array [b] is all 'b', such that (a, b) belongs to 'cR'
 	{
 		++cnt;
 		//if (cnt % 1000 == 0)
 		//	std::cout << cnt;
-		std::unordered_set<unsigned> currentlyProcessingDestinations = destinations.second;
+		ArenaUnorderedSet<unsigned> currentlyProcessingDestinations(destinations.second.begin(), destinations.second.end(), destinations.second.size(), arena);
 
 		while (currentlyProcessingDestinations.size() > 0)
 		{
-			std::unordered_set<unsigned> newDestinations;
+			ArenaUnorderedSet<unsigned> newDestinations(arena);
 			for (auto b : currentlyProcessingDestinations)
 			{
 				const auto it = r.find(b); // @it is a pair <b, [c]> for which the array [c] is all 'c', such that (b, c) belongs to 'r'
@@ -54,7 +58,260 @@ void TransitiveClosure(SetOfTransitions& r)
 	r = std::move(cR);
 }
 
+// The rows of bits are used for up to that many components (32MB).
+static const unsigned MAX_BITSET_COMPONENTS = 16384;
+
+// Renames the states to 0, 1, ... so a graph over them could be kept in vectors.
+struct DenseStates
+{
+	ArenaVector<unsigned> states; // The original state of each index.
+	ArenaUnorderedMap<unsigned, unsigned> indexOf;
+
+	explicit DenseStates(MonotonicArena& arena)
+		: states(arena)
+		, indexOf(arena)
+	{
+	}
+
+	unsigned GetIndex(unsigned state)
+	{
+		const auto inserted = indexOf.insert({ state, (unsigned) states.size() });
+		if (inserted.second)
+		{
+			states.push_back(state);
+		}
+		return inserted.first->second;
+	}
+};
+
+void TransitiveClosure(SetOfTransitions& r, ClosureAlgorithm algorithm)
+{
+	MonotonicArena arena;
+	TransitiveClosure(r, algorithm, arena);
+}
+
+// The closure of @graph over its strongly connected components: the states reachable from 'a' (with a path of at least one edge)
+// are the @members of the components reachable[component[a]]. It is calculated at least for the states of @sources.
+static void CloseComponents(const ArenaVector<ArenaVector<unsigned>>& graph, const ArenaVector<unsigned>& sources, ClosureAlgorithm algorithm,
+	std::vector<unsigned>& component, ArenaVector<ArenaVector<unsigned>>& members, ArenaVector<ArenaVector<unsigned>>& reachable,
+	MonotonicArena& arena)
+{
+	const ArenaVector<unsigned> emptyList(arena);
+	const auto componentsCount = StronglyConnectedComponents(graph, component);
+
+	// The members, the edges between the components (without duplicates) and whether there is a cycle in each component.
+	members.assign(componentsCount, emptyList);
+	ArenaVector<ArenaVector<unsigned>> successors(componentsCount, emptyList, arena);
+	std::vector<bool> cyclic(componentsCount, false);
+	std::vector<unsigned> lastSeen(componentsCount, unsigned(-1));
+	size_t condensedEdgesCount = 0;
+	for (unsigned a = 0; a < graph.size(); ++a)
+	{
+		members[component[a]].push_back(a);
+	}
+	for (unsigned c = 0; c < componentsCount; ++c)
+	{
+		cyclic[c] = members[c].size() > 1;
+		for (const auto a : members[c])
+		{
+			for (const auto b : graph[a])
+			{
+				const auto d = component[b];
+				if (d == c)
+				{
+					cyclic[c] = true;
+				}
+				else if (lastSeen[d] != c)
+				{
+					lastSeen[d] = c;
+					successors[c].push_back(d);
+					++condensedEdgesCount;
+				}
+			}
+		}
+	}
+
+	if (algorithm == ClosureAlgorithm::Auto)
+	{
+		const bool dense = condensedEdgesCount >= 4 * (size_t) componentsCount;
+		algorithm = componentsCount <= 4096 || (dense && componentsCount <= MAX_BITSET_COMPONENTS)
+			? ClosureAlgorithm::Bitsets
+			: ClosureAlgorithm::Condensation;
+	}
+
+	// The components are in reverse topological order, so all successors of 'c' are before it.
+	// The reachable components of 'c' (with a path of at least one edge) are the successors and their reachable ones, and 'c' itself if it has a cycle.
+	reachable.assign(componentsCount, emptyList);
+	if (algorithm == ClosureAlgorithm::Bitsets)
+	{
+		const size_t wordsPerRow = (componentsCount + 63) / 64;
+		std::vector<uint64_t> rows(wordsPerRow * componentsCount, 0);
+		for (unsigned c = 0; c < componentsCount; ++c)
+		{
+			uint64_t* row = &rows[c * wordsPerRow];
+			if (cyclic[c])
+			{
+				row[c / 64] |= uint64_t(1) << (c % 64);
+			}
+			for (const auto d : successors[c])
+			{
+				row[d / 64] |= uint64_t(1) << (d % 64);
+				const uint64_t* successorRow = &rows[d * wordsPerRow];
+				for (size_t i = 0, bound = d / 64 + 1; i < bound; ++i) // d < c, so the row of 'd' has no bits after the word of 'd'.
+				{
+					row[i] |= successorRow[i];
+				}
+			}
+		}
+
+		// Only the rows of the components of @sources are needed as lists.
+		for (const auto a : sources)
+		{
+			const auto c = component[a];
+			if (!reachable[c].empty())
+			{
+				continue;
+			}
+			const uint64_t* row = &rows[c * wordsPerRow];
+			for (size_t i = 0; i < wordsPerRow; ++i)
+			{
+				for (auto bits = row[i]; bits; bits &= bits - 1)
+				{
+					const auto bit = std::bitset<64>((bits & (~bits + 1)) - 1).count(); // The index of the lowest bit.
+					reachable[c].push_back(unsigned(i * 64 + bit));
+				}
+			}
+		}
+	}
+	else
+	{
+		std::fill(lastSeen.begin(), lastSeen.end(), unsigned(-1));
+		for (unsigned c = 0; c < componentsCount; ++c)
+		{
+			auto& reachableFromC = reachable[c];
+			if (cyclic[c])
+			{
+				lastSeen[c] = c;
+				reachableFromC.push_back(c);
+			}
+			for (const auto d : successors[c])
+			{
+				if (lastSeen[d] != c)
+				{
+					lastSeen[d] = c;
+					reachableFromC.push_back(d);
+				}
+				for (const auto e : reachable[d])
+				{
+					if (lastSeen[e] != c)
+					{
+						lastSeen[e] = c;
+						reachableFromC.push_back(e);
+					}
+				}
+			}
+		}
+	}
+}
+
+void TransitiveClosure(SetOfTransitions& r, ClosureAlgorithm algorithm, MonotonicArena& arena)
+{
+	if (algorithm == ClosureAlgorithm::Reference)
+	{
+		TransitiveClosure(r);
+		return;
+	}
+
+	const ArenaVector<unsigned> emptyList(arena);
+	DenseStates dense(arena);
+	ArenaVector<ArenaVector<unsigned>> graph(arena);
+	ArenaVector<unsigned> sources(arena);
+	for (const auto& destinations : r)
+	{
+		const auto a = dense.GetIndex(destinations.first);
+		sources.push_back(a);
+		for (const auto b : destinations.second)
+		{
+			const auto bIndex = dense.GetIndex(b);
+			if (graph.size() < dense.states.size())
+			{
+				graph.resize(dense.states.size(), emptyList);
+			}
+			graph[a].push_back(bIndex);
+		}
+	}
+	graph.resize(dense.states.size(), emptyList);
+
+	std::vector<unsigned> component;
+	ArenaVector<ArenaVector<unsigned>> members(arena), reachable(arena);
+	CloseComponents(graph, sources, algorithm, component, members, reachable, arena);
+
+	for (auto& destinations : r)
+	{
+		const auto c = component[dense.indexOf[destinations.first]];
+		destinations.second.clear();
+		for (const auto d : reachable[c])
+		{
+			for (const auto b : members[d])
+			{
+				destinations.second.insert(dense.states[b]);
+			}
+		}
+	}
+}
+
+void TransitiveClosure(ArenaVector<ArenaVector<unsigned>>& graph, ClosureAlgorithm algorithm, MonotonicArena& arena)
+{
+	if (algorithm == ClosureAlgorithm::Reference)
+	{
+		SetOfTransitions r;
+		for (unsigned a = 0; a < graph.size(); ++a)
+		{
+			if (!graph[a].empty())
+			{
+				r[a].insert(graph[a].begin(), graph[a].end());
+			}
+		}
+		TransitiveClosure(r);
+		for (const auto& destinations : r)
+		{
+			graph[destinations.first].assign(destinations.second.begin(), destinations.second.end());
+		}
+		return;
+	}
+
+	ArenaVector<unsigned> sources(arena); // The states without edges do not reach any.
+	for (unsigned a = 0; a < graph.size(); ++a)
+	{
+		if (!graph[a].empty())
+		{
+			sources.push_back(a);
+		}
+	}
+
+	std::vector<unsigned> component;
+	ArenaVector<ArenaVector<unsigned>> members(arena), reachable(arena);
+	CloseComponents(graph, sources, algorithm, component, members, reachable, arena);
+
+	for (const auto a : sources)
+	{
+		auto& destinations = graph[a];
+		destinations.clear();
+		for (const auto d : reachable[component[a]])
+		{
+			destinations.insert(destinations.end(), members[d].begin(), members[d].end());
+		}
+	}
+}
+
 void ClosureEpsilon(SetOfTransitionsWithOutputs& r, bool& infinite, std::unordered_set<unsigned>& statesWithEpsilonCycleWithPositiveOutput)
+{
+	MonotonicArena arena;
+	ClosureEpsilon(r, infinite, statesWithEpsilonCycleWithPositiveOutput, arena);
+}
+
+void ClosureEpsilon(SetOfTransitionsWithOutputs& r, bool& infinite, std::unordered_set<unsigned>& statesWithEpsilonCycleWithPositiveOutput,
+	MonotonicArena& arena)
 {
 	statesWithEpsilonCycleWithPositiveOutput.clear();
 	infinite = false;
@@ -64,51 +321,271 @@ void ClosureEpsilon(SetOfTransitionsWithOutputs& r, bool& infinite, std::unorder
 	*/
 	auto cR = r; // { (a, [<b, o>]) }, a map of states 'a' and their destinations, i.e. a set of b's and coresponding outputs 'o' ([<b, o>])
 
+	ArenaUnorderedSet<unsigned> reachedStates(arena); // The states 'b' of the destinations of 'a', so the new ones are found without a search through them.
+	ArenaUnorderedSet<Transition> currentlyProcessingDestinations(arena);
+	ArenaUnorderedSet<Transition> newDestinations(arena);
 	for (auto& destinations : cR) // @destinations is a pair <a, [<b, o>]> for which the array [<b, o>] is all 'b' and its output 'o', such that (a, <b, o>) belongs to 'cR'
 	{
-		std::unordered_set<Transition> currentlyProcessingDestinations = destinations.second;
+		const auto& a = destinations.first;
+		reachedStates.clear();
+		currentlyProcessingDestinations.clear();
+		for (const auto& destination : destinations.second)
+		{
+			reachedStates.insert(destination.state);
+			currentlyProcessingDestinations.insert(destination);
+		}
 
 		while (currentlyProcessingDestinations.size() > 0)
 		{
-			std::unordered_set<Transition> newDestinations;
-			const auto& a = destinations.first;
-			for (auto bAndO : currentlyProcessingDestinations)
+			newDestinations.clear();
+			for (const auto& bAndO : currentlyProcessingDestinations)
 			{
 				const auto it = r.find(bAndO.state); // @it is a pair <b, [<c, o'>]> for which the array [<c, o'>] is all 'c' and its output 'o'', such that (b, <c, o'>) belongs to 'r'
-				if (it != r.end())
+				if (it == r.end())
 				{
-					// Add only the new once, skip the already added!
-					for (const auto& destination : it->second)
+					continue;
+				}
+				// Add only the new once, skip the already added!
+				for (const auto& destination : it->second)
+				{
+					const auto& destinationWithUpdatedOutput = Transition{ destination.state, AddOutputs(destination.output, bAndO.output) };
+					if (destinationWithUpdatedOutput.state == a && destinationWithUpdatedOutput.output > 0)
 					{
-						const auto& destinationWithUpdatedOutput = Transition{ destination.state, destination.output + bAndO.output };
-						if (destinationWithUpdatedOutput.state == a && destinationWithUpdatedOutput.output > 0)
-						{
-							infinite = true;
-							statesWithEpsilonCycleWithPositiveOutput.insert(a);
-						}
-						else if (std::find_if(destinations.second.begin(),
-							destinations.second.end(),
-							[&destinationWithUpdatedOutput](const Transition& o) { return destinationWithUpdatedOutput.state == o.state; }
-										) == destinations.second.end()
-							)
-						{
-							newDestinations.insert(destinationWithUpdatedOutput);
-						}
+						infinite = true;
+						statesWithEpsilonCycleWithPositiveOutput.insert(a);
+					}
+					else if (reachedStates.count(destinationWithUpdatedOutput.state) == 0)
+					{
+						newDestinations.insert(destinationWithUpdatedOutput);
 					}
 				}
 			}
 
 			// Add the currently processed elements to the destinations of 'a'
-			destinations.second.insert(
-				std::make_move_iterator(currentlyProcessingDestinations.begin()),
-				std::make_move_iterator(currentlyProcessingDestinations.end()));
+			for (const auto& destination : currentlyProcessingDestinations)
+			{
+				destinations.second.insert(destination);
+				reachedStates.insert(destination.state);
+			}
 			// Process the newly added elements (so if they are connected to other states they will be added to the destinations of 'a'
-			currentlyProcessingDestinations = std::move(newDestinations);
+			std::swap(currentlyProcessingDestinations, newDestinations);
 		}
 	}
 	r = std::move(cR);
 }
 
+bool ClosureEpsilonWithAllOutputs(SetOfTransitionsWithOutputs& r, bool& infinite, std::unordered_set<unsigned>& statesWithEpsilonCycleWithPositiveOutput,
+	size_t maxPairs)
+{
+	MonotonicArena arena;
+	return ClosureEpsilonWithAllOutputs(r, infinite, statesWithEpsilonCycleWithPositiveOutput, maxPairs, arena);
+}
+
+bool ClosureEpsilonWithAllOutputs(SetOfTransitionsWithOutputs& r, bool& infinite, std::unordered_set<unsigned>& statesWithEpsilonCycleWithPositiveOutput,
+	size_t maxPairs, MonotonicArena& arena)
+{
+	statesWithEpsilonCycleWithPositiveOutput.clear();
+	infinite = false;
+
+	const ArenaVector<unsigned> emptyList(arena);
+	const ArenaVector<Output> emptyOutputsList(arena);
+	DenseStates dense(arena);
+	ArenaVector<ArenaVector<unsigned>> graph(arena);
+	ArenaVector<ArenaVector<Output>> outputs(arena); // outputs[a][k] is the output of the edge (a, graph[a][k]).
+	for (const auto& destinations : r)
+	{
+		const auto a = dense.GetIndex(destinations.first);
+		for (const auto& destination : destinations.second)
+		{
+			const auto b = dense.GetIndex(destination.state);
+			if (graph.size() < dense.states.size())
+			{
+				graph.resize(dense.states.size(), emptyList);
+				outputs.resize(dense.states.size(), emptyOutputsList);
+			}
+			graph[a].push_back(b);
+			outputs[a].push_back(destination.output);
+		}
+	}
+	graph.resize(dense.states.size(), emptyList);
+	outputs.resize(dense.states.size(), emptyOutputsList);
+
+	std::vector<unsigned> component;
+	const auto componentsCount = StronglyConnectedComponents(graph, component);
+	ArenaVector<ArenaVector<unsigned>> members(componentsCount, emptyList, arena);
+	for (unsigned a = 0; a < graph.size(); ++a)
+	{
+		members[component[a]].push_back(a);
+	}
+
+	// Each edge inside a component is on a cycle. If its output is positive, then each state of the component is on a cycle with positive output
+	// (the outputs are not negative).
+	std::vector<bool> cyclic(componentsCount, false), positiveCycle(componentsCount, false);
+	for (unsigned a = 0; a < graph.size(); ++a)
+	{
+		const auto c = component[a];
+		cyclic[c] = cyclic[c] || members[c].size() > 1;
+		for (size_t k = 0; k < graph[a].size(); ++k)
+		{
+			if (component[graph[a][k]] == c)
+			{
+				cyclic[c] = true;
+				positiveCycle[c] = positiveCycle[c] || outputs[a][k] > 0;
+			}
+		}
+	}
+	for (unsigned c = 0; c < componentsCount; ++c)
+	{
+		if (positiveCycle[c])
+		{
+			infinite = true;
+			for (const auto a : members[c])
+			{
+				statesWithEpsilonCycleWithPositiveOutput.insert(dense.states[a]);
+			}
+		}
+	}
+	if (infinite)
+	{
+		return true; // There are infinitely many outputs, @r is left as it is.
+	}
+
+	// All edges inside the components have output 0, so reaching one state of a component with output 'o' means reaching all of its states with 'o'.
+	// reachable[c] are the pairs <component, output> reachable from 'c' with at least one edge. The components are in reverse topological order,
+	// so all successors of 'c' are already calculated.
+	ArenaVector<ArenaVector<Transition>> reachable(componentsCount, ArenaVector<Transition>(arena), arena);
+	ArenaUnorderedSet<Transition> added(arena);
+	size_t pairsCount = 0;
+	for (unsigned c = 0; c < componentsCount; ++c)
+	{
+		auto& reachableFromC = reachable[c];
+		added.clear();
+		auto add = [&reachableFromC, &added, &pairsCount](const Transition& t)
+		{
+			if (added.insert(t).second)
+			{
+				reachableFromC.push_back(t);
+				++pairsCount;
+			}
+		};
+
+		if (cyclic[c])
+		{
+			add(Transition{ c, 0 });
+		}
+		for (const auto a : members[c])
+		{
+			for (size_t k = 0; k < graph[a].size(); ++k)
+			{
+				const auto d = component[graph[a][k]];
+				if (d == c)
+				{
+					continue;
+				}
+				const auto output = outputs[a][k];
+				add(Transition{ d, output });
+				for (const auto& t : reachable[d])
+				{
+					add(Transition{ t.state, AddOutputs(t.output, output) });
+				}
+			}
+		}
+		if (pairsCount > maxPairs)
+		{
+			return false;
+		}
+	}
+
+	for (auto& destinations : r)
+	{
+		const auto c = component[dense.indexOf[destinations.first]];
+		destinations.second.clear();
+		for (const auto& t : reachable[c])
+		{
+			for (const auto b : members[t.state])
+			{
+				destinations.second.insert(Transition{ dense.states[b], t.output });
+			}
+		}
+	}
+	return true;
+}
+
+template<typename Graph>
+static unsigned FindStronglyConnectedComponents(const Graph& graph, std::vector<unsigned>& component)
+{
+	const auto NOT_VISITED = unsigned(-1);
+	const auto verticesCount = (unsigned) graph.size();
+	component.assign(verticesCount, NOT_VISITED);
+	std::vector<unsigned> index(verticesCount, NOT_VISITED), lowLink(verticesCount);
+	std::vector<unsigned> stack; // The vertices which are still not in a component.
+	std::vector<std::pair<unsigned, size_t>> callStack; // <vertex, the next edge to look at>
+	unsigned nextIndex = 0, componentsCount = 0;
+
+	for (unsigned root = 0; root < verticesCount; ++root)
+	{
+		if (index[root] != NOT_VISITED)
+		{
+			continue;
+		}
+
+		callStack.push_back({ root, 0 });
+		index[root] = lowLink[root] = nextIndex++;
+		stack.push_back(root);
+		while (!callStack.empty())
+		{
+			auto& curr = callStack.back();
+			const auto a = curr.first;
+			if (curr.second < graph[a].size())
+			{
+				const auto b = graph[a][curr.second++];
+				if (index[b] == NOT_VISITED)
+				{
+					index[b] = lowLink[b] = nextIndex++;
+					stack.push_back(b);
+					callStack.push_back({ b, 0 }); // @curr is invalidated.
+				}
+				else if (component[b] == NOT_VISITED) // 'b' is on the stack.
+				{
+					lowLink[a] = std::min(lowLink[a], index[b]);
+				}
+				continue;
+			}
+
+			// All edges of 'a' are visited.
+			if (lowLink[a] == index[a])
+			{
+				unsigned b;
+				do
+				{
+					b = stack.back();
+					stack.pop_back();
+					component[b] = componentsCount;
+				} while (b != a);
+				++componentsCount;
+			}
+			callStack.pop_back();
+			if (!callStack.empty())
+			{
+				const auto parent = callStack.back().first;
+				lowLink[parent] = std::min(lowLink[parent], lowLink[a]);
+			}
+		}
+	}
+
+	return componentsCount;
+}
+
+unsigned StronglyConnectedComponents(const std::vector<std::vector<unsigned>>& graph, std::vector<unsigned>& component)
+{
+	return FindStronglyConnectedComponents(graph, component);
+}
+
+unsigned StronglyConnectedComponents(const ArenaVector<ArenaVector<unsigned>>& graph, std::vector<unsigned>& component)
+{
+	return FindStronglyConnectedComponents(graph, component);
+}
+
 void AddIdentity(SetOfTransitions& r)
 {
 	for (auto& transitions : r)
@@ -125,6 +602,47 @@ void AddIdentity(SetOfTransitionsWithOutputs& r, size_t numberOfStates)
 	}
 }
 
+template<typename Relation>
+static ClosureStats GetRelationStats(const Relation& r)
+{
+	ClosureStats stats = { 0, 0, 0 };
+	for (const auto& transitions : r)
+	{
+		if (!transitions.second.empty())
+		{
+			++stats.statesCount;
+			stats.pairsCount += transitions.second.size();
+			stats.maxPairsOfState = std::max(stats.maxPairsOfState, transitions.second.size());
+		}
+	}
+	return stats;
+}
+
+ClosureStats GetClosureStats(const SetOfTransitions& r)
+{
+	return GetRelationStats(r);
+}
+
+ClosureStats GetClosureStats(const SetOfTransitionsWithOutputs& r)
+{
+	return GetRelationStats(r);
+}
+
+ClosureStats GetClosureStats(const ArenaVector<ArenaVector<unsigned>>& graph)
+{
+	ClosureStats stats = { 0, 0, 0 };
+	for (const auto& destinations : graph)
+	{
+		if (!destinations.empty())
+		{
+			++stats.statesCount;
+			stats.pairsCount += destinations.size();
+			stats.maxPairsOfState = std::max(stats.maxPairsOfState, destinations.size());
+		}
+	}
+	return stats;
+}
+
 void Print(const SetOfTransitions& r)
 {
 	for (const auto& transitionAndDestinations : r)
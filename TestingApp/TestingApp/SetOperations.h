@@ -1,13 +1,50 @@
 #pragma once
 
+#include <vector>
+#include <cstdint>
+#include <limits>
 #include <unordered_map>
 #include <unordered_set>
 #include <boost/functional/hash.hpp>
+#include "Arena.h"
+#include "AssertLog.h"
+
+/*
+	The outputs are 32 bits wide, with OUTPUTS_64_BIT they are 64 bits wide (the transitions are 16 bytes instead of 8).
+	They are summed with AddOutputs, which wraps around on an overflow as unsigned numbers do, unless:
+	- SATURATE_OUTPUTS: the sum stops at the maximal output,
+	- CHECK_OUTPUT_OVERFLOW: the sum stops at the maximal output and an overflow is logged and asserted.
+*/
+#if defined(OUTPUTS_64_BIT)
+typedef uint64_t Output;
+#else
+typedef unsigned Output;
+#endif
+
+const Output MAX_OUTPUT = std::numeric_limits<Output>::max();
+
+inline Output AddOutputs(Output left, Output right)
+{
+	const Output sum = left + right;
+#if defined(CHECK_OUTPUT_OVERFLOW)
+	if (sum < left)
+	{
+		LogAndAssert(false, "Output overflow, the sum is more than the maximal output.");
+		return MAX_OUTPUT;
+	}
+#elif defined(SATURATE_OUTPUTS)
+	if (sum < left)
+	{
+		return MAX_OUTPUT;
+	}
+#endif
+	return sum;
+}
 
 struct Transition
 {
 	unsigned state; // The destination state(index in a vector)
-	unsigned output; // Some number which is the output on the second ?strip? of the transducer.
+	Output output; // Some number which is the output on the second ?strip? of the transducer.
 
 	bool operator==(const Transition& right) const
 	{
@@ -27,7 +64,7 @@ template<> struct std::hash<Transition>
 	typedef std::size_t result_type;
 	result_type operator()(argument_type const& s) const noexcept
 	{
-		return boost::hash<std::pair<unsigned, unsigned>>{}({ s.state, s.output }); // reusing the boost hash 
+		return boost::hash<std::pair<unsigned, Output>>{}({ s.state, s.output }); // reusing the boost hash 
 	}
 };
 
@@ -36,14 +73,63 @@ typedef std::unordered_map<unsigned, std::unordered_set<Transition>> SetOfTransi
 
 void TransitiveClosure(SetOfTransitions& r);
 
+enum class ClosureAlgorithm
+{
+	Reference, // The one above, a search from each state through the hash sets.
+	Bitsets, // Over the strongly connected components, the reachable ones of each component are a row of bits.
+	Condensation, // Over the strongly connected components, the reachable ones of each component are a list.
+	Auto, // Bitsets for small or dense graphs, otherwise condensation.
+};
+
+// The same result as TransitiveClosure(@r), computed with @algorithm.
+void TransitiveClosure(SetOfTransitions& r, ClosureAlgorithm algorithm);
+// The same, the temporary containers are in @arena.
+void TransitiveClosure(SetOfTransitions& r, ClosureAlgorithm algorithm, MonotonicArena& arena);
+// The same over the states 0, 1, ..., @graph.size() - 1: @graph[a] are all 'b' such that (a, b) is an edge and it becomes
+// all 'b' reachable from 'a' (without duplicates, in any order). The lists of the components are in @arena.
+void TransitiveClosure(ArenaVector<ArenaVector<unsigned>>& graph, ClosureAlgorithm algorithm, MonotonicArena& arena);
+
 // Very similar to the transitive closure with accumulating outputs
 // Additionaly infinity checking, i.e.
 // if there is a cycle of type (a, <b, o>) ---> (b, <c, o'>) ---> ... ---> (z, <a, o'">)
 // and the sum of all o, o', ... , o'" is not 0 then it is a non-trivial one, there could be infinite many outputs.
+// The states 'a' found on such a cycle are added to @statesWithEpsilonCycleWithPositiveOutput.
+// A search from each state level by level, only the outputs of the shortest paths to each state are kept.
 void ClosureEpsilon(SetOfTransitionsWithOutputs& r, bool& infinite, std::unordered_set<unsigned>& statesWithEpsilonCycleWithPositiveOutput);
+void ClosureEpsilon(SetOfTransitionsWithOutputs& r, bool& infinite, std::unordered_set<unsigned>& statesWithEpsilonCycleWithPositiveOutput,
+	MonotonicArena& arena);
+
+// The same closure, but with every <state, output> pair (ClosureEpsilon keeps only the outputs of the shortest paths to each state),
+// and all states on the cycles with positive output are added to @statesWithEpsilonCycleWithPositiveOutput (@r is not changed then).
+// Works over the strongly connected components: the <component, output> pairs reachable from each component are propagated once
+// through the condensation. A component might have as many pairs as there are distinct outputs of the paths from it, which grows
+// exponentially with the length of a DAG with different outputs on its branches. So the pairs are limited: it returns false (and @r
+// is not changed) if more than @maxPairs are found, a component is finished before that is checked. The time is O(edges * pairs).
+bool ClosureEpsilonWithAllOutputs(SetOfTransitionsWithOutputs& r, bool& infinite, std::unordered_set<unsigned>& statesWithEpsilonCycleWithPositiveOutput,
+	size_t maxPairs);
+bool ClosureEpsilonWithAllOutputs(SetOfTransitionsWithOutputs& r, bool& infinite, std::unordered_set<unsigned>& statesWithEpsilonCycleWithPositiveOutput,
+	size_t maxPairs, MonotonicArena& arena);
+
+// Tarjan's algorithm (without recursion). @graph[a] are all 'b' such that (a, b) is an edge.
+// @component[a] becomes the index of the strongly connected component of 'a'. The components are in reverse topological order,
+// i.e. for each edge (a, b) component[a] >= component[b]. Returns the number of components.
+unsigned StronglyConnectedComponents(const std::vector<std::vector<unsigned>>& graph, std::vector<unsigned>& component);
+unsigned StronglyConnectedComponents(const ArenaVector<ArenaVector<unsigned>>& graph, std::vector<unsigned>& component);
 
 void AddIdentity(SetOfTransitions& r);
 void AddIdentity(SetOfTransitionsWithOutputs& r, size_t numberOfStates);
 
+// The size of a relation, e.g. of a closure.
+struct ClosureStats
+{
+	size_t statesCount; // The states with at least one pair.
+	size_t pairsCount;
+	size_t maxPairsOfState;
+};
+
+ClosureStats GetClosureStats(const SetOfTransitions& r);
+ClosureStats GetClosureStats(const SetOfTransitionsWithOutputs& r);
+ClosureStats GetClosureStats(const ArenaVector<ArenaVector<unsigned>>& graph);
+
 void Print(const SetOfTransitions& r);
 void Print(const SetOfTransitionsWithOutputs& r);
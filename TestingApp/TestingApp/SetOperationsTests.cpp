@@ -1,4 +1,5 @@
 #include <iostream>
+#include <vector>
 #include "SetOperations.h"
 
 typedef std::vector<std::pair<
@@ -11,6 +12,7 @@ struct ClosureEpsilonTestCase
 	SetOfTransitionsWithOutputs input; // The input set.
 	SetOfTransitionsWithOutputs output; // The desired output one.
 	bool inf; // For the infinite state.
+	std::unordered_set<unsigned> statesWithCycle = {}; // The states on a cycle with positive output, checked only when given.
 };
 
 typedef std::vector<ClosureEpsilonTestCase>
@@ -917,6 +919,99 @@ bool equal(const SetOfTransitions& l, const SetOfTransitions& r)
 	//return true;
 }
 
+typedef std::vector<std::pair<
+							  std::vector<std::vector<unsigned>>, // The input graph.
+							  std::vector<unsigned>>> // The desired components (up to renumbering).
+	StronglyConnectedComponentsTestCases;
+
+static StronglyConnectedComponentsTestCases stronglyConnectedComponentsTestCases;
+
+static void PopulateWithStronglyConnectedComponentsTestCases()
+{
+	stronglyConnectedComponentsTestCases = {
+		{
+			{ { 1 }, { 2 }, { 3 }, {} }, // 0-->1 ; 1-->2 ; 2-->3
+			{ 0, 1, 2, 3 },
+		},
+		{
+			{ { 1 }, { 2 }, { 0 }, {} }, // 0-->1 ; 1-->2 ; 2-->0
+			{ 0, 0, 0, 3 },
+		},
+		{
+			{ { 1, 4 }, { 2 }, { 1, 3 }, {}, { 5 }, { 4, 3 }, { 6 } }, // 1, 2 and 4, 5 are cycles ; 6-->6 is a loop
+			{ 0, 1, 1, 3, 4, 4, 6 },
+		},
+		{
+			{},
+			{},
+		},
+	};
+}
+
+// Checks that @component groups the vertices as @expected and is in reverse topological order.
+static bool validComponents(const std::vector<std::vector<unsigned>>& graph, const std::vector<unsigned>& component, const std::vector<unsigned>& expected)
+{
+	if (component.size() != expected.size())
+	{
+		return false;
+	}
+	for (size_t a = 0; a < graph.size(); ++a)
+	{
+		for (size_t b = 0; b < graph.size(); ++b)
+		{
+			if ((component[a] == component[b]) != (expected[a] == expected[b]))
+			{
+				return false;
+			}
+		}
+		for (const auto b : graph[a])
+		{
+			if (component[a] < component[b])
+			{
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+void RunStronglyConnectedComponentsTests()
+{
+	PopulateWithStronglyConnectedComponentsTestCases();
+
+	auto failedTests = 0;
+	std::cout << "RUNNING TESTS WITH " << stronglyConnectedComponentsTestCases.size() << " STRONGLY CONNECTED COMPONENTS TESTS:\n";
+	for (size_t i = 0, bound = stronglyConnectedComponentsTestCases.size(); i < bound; ++i)
+	{
+		std::cout << "\t" << i << ": ";
+		const auto& graph = stronglyConnectedComponentsTestCases[i].first;
+		const auto& expected = stronglyConnectedComponentsTestCases[i].second;
+
+		std::vector<unsigned> component;
+		StronglyConnectedComponents(graph, component);
+
+		if (validComponents(graph, component, expected))
+		{
+			std::cout << "passed\n";
+		}
+		else
+		{
+			std::cout << "failed!\n";
+			++failedTests;
+		}
+	}
+
+	if (failedTests > 0)
+	{
+		std::cout << "Passed " << stronglyConnectedComponentsTestCases.size() - failedTests << " tests.\n";
+		std::cout << "Failed " << failedTests << " tests.\n";
+	}
+	else
+	{
+		std::cout << "Passed all " << stronglyConnectedComponentsTestCases.size() << " tests.\n";
+	}
+}
+
 void RunTransitiveClosureTests()
 {
 	PopulateWithTransitiveClosureTestCases();
@@ -935,7 +1030,7 @@ void RunTransitiveClosureTests()
 
 		if (equal(inputSetClosed, outputSet))
 		{
-			std::cout << "passed\n";
+			std::cout << "passed";
 		}
 		else
 		{
@@ -945,9 +1040,85 @@ void RunTransitiveClosureTests()
 			std::cout << "To be equal to the set:\n";
 			Print(inputSetClosed);
 			++failedTests;
+			continue;
 		}
+
+		for (const auto algorithm : { ClosureAlgorithm::Bitsets, ClosureAlgorithm::Condensation, ClosureAlgorithm::Auto })
+		{
+			auto inputSetClosedWithAlgorithm = inputSet;
+			TransitiveClosure(inputSetClosedWithAlgorithm, algorithm);
+			if (!equal(inputSetClosedWithAlgorithm, outputSet))
+			{
+				std::cout << " but failed with algorithm " << (int) algorithm << ", the result is:\n";
+				Print(inputSetClosedWithAlgorithm);
+				++failedTests;
+				break;
+			}
+		}
+		std::cout << "\n";
 	}
 
+	// Random graphs (from sparse to dense) compared with the reference implementation.
+	std::cout << "\tRandom graphs: ";
+	unsigned seed = 1;
+	auto random = [&seed]()
+	{
+		seed = seed * 1103515245 + 12345;
+		return (seed >> 16) & 0x7fff;
+	};
+	size_t failedRandomTests = 0;
+	for (unsigned statesCount : { 5, 50, 300 })
+	{
+		for (unsigned edgesPerState : { 1, 2, 8 })
+		{
+			SetOfTransitions graph;
+			for (unsigned e = 0; e < statesCount * edgesPerState / 2; ++e)
+			{
+				graph[random() % statesCount].insert(random() % statesCount + (random() % 4 == 0 ? statesCount : 0)); // Some states only as destinations.
+			}
+
+			auto expected = graph;
+			TransitiveClosure(expected);
+			for (const auto algorithm : { ClosureAlgorithm::Bitsets, ClosureAlgorithm::Condensation, ClosureAlgorithm::Auto })
+			{
+				auto closed = graph;
+				TransitiveClosure(closed, algorithm);
+				if (!equal(closed, expected))
+				{
+					std::cout << "\n\t\tfailed with " << statesCount << " states, " << edgesPerState << " edges per state and algorithm " << (int) algorithm;
+					++failedRandomTests;
+				}
+			}
+
+			// The same closure over the lists of a dense graph.
+			for (const auto algorithm : { ClosureAlgorithm::Reference, ClosureAlgorithm::Bitsets, ClosureAlgorithm::Condensation, ClosureAlgorithm::Auto })
+			{
+				MonotonicArena arena;
+				ArenaVector<ArenaVector<unsigned>> lists(2 * statesCount, ArenaVector<unsigned>(arena), arena);
+				for (const auto& destinations : graph)
+				{
+					lists[destinations.first].assign(destinations.second.begin(), destinations.second.end());
+				}
+				TransitiveClosure(lists, algorithm, arena);
+				bool same = true;
+				for (unsigned a = 0; a < lists.size(); ++a)
+				{
+					const auto it = expected.find(a);
+					const std::unordered_set<unsigned> closedFromA(lists[a].begin(), lists[a].end());
+					same = same && closedFromA.size() == lists[a].size() &&
+						(it == expected.end() ? closedFromA.empty() : closedFromA == it->second);
+				}
+				if (!same)
+				{
+					std::cout << "\n\t\tfailed over lists with " << statesCount << " states, " << edgesPerState << " edges per state and algorithm " << (int) algorithm;
+					++failedRandomTests;
+				}
+			}
+		}
+	}
+	std::cout << (failedRandomTests ? "\n" : "passed\n");
+	failedTests += failedRandomTests > 0;
+
 	if (failedTests > 0)
 	{
 		std::cout << "Passed " << transitiveSetTestCases.size() - failedTests << " tests.\n";
@@ -974,13 +1145,15 @@ void RunCloseEpsilonTests()
 		auto inputSetClosed = closureEpsilonTestCases[i].input;
 
 		bool infinite;
-		std::unordered_set<unsigned> statesWithNonTrivialCycle; // TODO check those, too.
+		std::unordered_set<unsigned> statesWithNonTrivialCycle;
 		ClosureEpsilon(inputSetClosed, infinite, statesWithNonTrivialCycle);
 
 		const auto expectedInf = closureEpsilonTestCases[i].inf;
+		const auto& expectedStatesWithCycle = closureEpsilonTestCases[i].statesWithCycle;
 
 		if (infinite == expectedInf &&
-			(infinite || inputSetClosed == outputSet)) // infinite = false => "check the calculated set"
+			(infinite || inputSetClosed == outputSet) && // infinite = false => "check the calculated set"
+			(expectedStatesWithCycle.empty() || statesWithNonTrivialCycle == expectedStatesWithCycle))
 		{
 			std::cout << "passed\n";
 		}
@@ -1048,4 +1221,123 @@ void RunAddIdentityTests()
 	{
 		std::cout << "Passed all " << addIdentityTestCases.size() << " tests.\n";
 	}
-}
\ No newline at end of file
+}
+// @diamondsCount states after the state 0, each one is reached from the previous one with two outputs: 0 and 2^i.
+// So the state i is reached from 0 with 2^i distinct outputs.
+static SetOfTransitionsWithOutputs GetDiamondsChain(unsigned diamondsCount)
+{
+	SetOfTransitionsWithOutputs r;
+	for (unsigned i = 0; i < diamondsCount; ++i)
+	{
+		r[i] = { { i + 1, 0 }, { i + 1, (Output) 1 << i } };
+	}
+	return r;
+}
+
+void RunCloseEpsilonWithAllOutputsTests()
+{
+	const ClosureEpsilonTestCases testCases = {
+		// Paths with different length and output to the same state
+		{
+			{
+				{ 1, { { 2, 1 }, { 3, 5 } } },
+				{ 2, { { 3, 1 } } },
+			},
+			{
+				{ 1, { { 2, 1 }, { 3, 2 }, { 3, 5 } } },
+				{ 2, { { 3, 1 } } },
+			},
+			false
+		},
+		// Cycle with output 0, each of its states reaches all of them with 0
+		{
+			{
+				{ 1, { { 2, 0 } } },
+				{ 2, { { 1, 0 }, { 3, 4 } } },
+			},
+			{
+				{ 1, { { 1, 0 }, { 2, 0 }, { 3, 4 } } },
+				{ 2, { { 1, 0 }, { 2, 0 }, { 3, 4 } } },
+			},
+			false
+		},
+		// Cycle with output 0 and a longer one with positive output through the same states
+		{
+			{
+				{ 1, { { 2, 0 }, { 3, 1 } } },
+				{ 2, { { 1, 0 } } },
+				{ 3, { { 2, 0 } } },
+				{ 4, { { 1, 0 } } },
+			},
+			{
+				// Doesn't matter
+			},
+			true,
+			{ 1, 2, 3 }
+		},
+	};
+	const size_t maxPairs = 1000;
+
+	auto failedTests = 0;
+	const auto testsCount = testCases.size() + 2;
+	std::cout << "RUNNING TESTS WITH " << testsCount << " CLOSURE EPSILON WITH ALL OUTPUTS TESTS:\n";
+	for (size_t i = 0; i < testCases.size(); ++i)
+	{
+		std::cout << "\t" << i << ": ";
+		auto inputSetClosed = testCases[i].input;
+		bool infinite;
+		std::unordered_set<unsigned> statesWithNonTrivialCycle;
+		if (ClosureEpsilonWithAllOutputs(inputSetClosed, infinite, statesWithNonTrivialCycle, maxPairs) &&
+			infinite == testCases[i].inf &&
+			(infinite ? inputSetClosed == testCases[i].input : inputSetClosed == testCases[i].output) &&
+			(testCases[i].statesWithCycle.empty() || statesWithNonTrivialCycle == testCases[i].statesWithCycle))
+		{
+			std::cout << "passed\n";
+		}
+		else
+		{
+			std::cout << "failed!\n";
+			Print(inputSetClosed);
+			++failedTests;
+		}
+	}
+
+	// 2 + 4 + 8 + 16 outputs from the state 0, fewer from the others.
+	std::cout << "\t" << testCases.size() << ": ";
+	auto fewPairs = GetDiamondsChain(4);
+	bool infinite;
+	std::unordered_set<unsigned> statesWithNonTrivialCycle;
+	if (ClosureEpsilonWithAllOutputs(fewPairs, infinite, statesWithNonTrivialCycle, maxPairs) && !infinite && fewPairs[0].size() == 30)
+	{
+		std::cout << "passed\n";
+	}
+	else
+	{
+		std::cout << "failed!\n";
+		++failedTests;
+	}
+
+	// 2^20 outputs from the state 0, the search stops at the limit.
+	std::cout << "\t" << testCases.size() + 1 << ": ";
+	const auto manyPairs = GetDiamondsChain(20);
+	auto manyPairsClosed = manyPairs;
+	if (!ClosureEpsilonWithAllOutputs(manyPairsClosed, infinite, statesWithNonTrivialCycle, maxPairs) && manyPairsClosed == manyPairs)
+	{
+		std::cout << "passed\n";
+	}
+	else
+	{
+		std::cout << "failed!\n";
+		++failedTests;
+	}
+
+	if (failedTests > 0)
+	{
+		std::cout << "Passed " << testsCount - failedTests << " tests.\n";
+		std::cout << "Failed " << failedTests << " tests.\n";
+	}
+	else
+	{
+		std::cout << "Passed all " << testsCount << " tests.\n";
+	}
+}
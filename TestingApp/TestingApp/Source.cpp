@@ -1,15 +1,86 @@
 #include <iostream>
+#include <sstream>
 #include "FinalStateTransducer.h"
 #include "RegularFinalStateTransducerBuilder.h"
 #include "InputValidator.h"
 #include "Tests.h"
 #include "TestCaseGenerator.h"
 #include "CustomTestExecuter.h"
+#include "Benchmarks.h"
 
 const char * regExpr = "a:5 b:100 | c:1 |";
 
-void ProcessCommandLineArguments(int argc, char *argv[])
+/*
+	-benchmark [-warmups N] [-repetitions N] [-maxSeconds S] [-json FILE] [-noGenerated] [-threads N,N,...] [FILE ...]
+	runs the benchmarks (see Benchmarks.h) of the files (the bundled test*.txt and N*.txt without files) and returns true.
+	-threads gives the thread counts of the scaling phases (1,2,4,8 by default, an empty list for none).
+	-generate PREFIX
+	writes the tests of GenerateScalingSuite to PREFIX<name>.txt and returns true.
+	@exitCode is set then, it is 1 if the benchmarks failed or a test could not be written, otherwise 0.
+*/
+bool ProcessCommandLineArguments(int argc, char *argv[], int& exitCode)
 {
+	if (argc > 1 && std::strcmp(argv[1], "-benchmark") == 0)
+	{
+		auto options = GetDefaultBenchmarkOptions();
+		std::vector<std::string> fileNames;
+		for (auto i = 2; i < argc; ++i)
+		{
+			const bool hasValue = i + 1 < argc;
+			if (std::strcmp(argv[i], "-warmups") == 0 && hasValue)
+			{
+				options.warmups = (unsigned) atoi(argv[++i]);
+			}
+			else if (std::strcmp(argv[i], "-repetitions") == 0 && hasValue)
+			{
+				options.repetitions = (unsigned) atoi(argv[++i]);
+			}
+			else if (std::strcmp(argv[i], "-maxSeconds") == 0 && hasValue)
+			{
+				options.maxSecondsPerInput = atof(argv[++i]);
+			}
+			else if (std::strcmp(argv[i], "-json") == 0 && hasValue)
+			{
+				options.jsonFileName = argv[++i];
+			}
+			else if (std::strcmp(argv[i], "-noGenerated") == 0)
+			{
+				options.withGeneratedInputs = false;
+			}
+			else if (std::strcmp(argv[i], "-threads") == 0 && hasValue)
+			{
+				options.threadsCounts.clear();
+				std::stringstream threadsCounts(argv[++i]);
+				std::string threadsCount;
+				while (std::getline(threadsCounts, threadsCount, ','))
+				{
+					options.threadsCounts.push_back((unsigned) atoi(threadsCount.c_str()));
+				}
+			}
+			else
+			{
+				fileNames.push_back(argv[i]);
+			}
+		}
+		exitCode = RunBenchmarks(fileNames.empty() ? GetBundledBenchmarkInputs() : fileNames, options) ? 0 : 1;
+		return true;
+	}
+	if (argc > 2 && std::strcmp(argv[1], "-generate") == 0)
+	{
+		exitCode = 0;
+		for (const auto& test : GenerateScalingSuite())
+		{
+			const auto fileName = argv[2] + test.name + ".txt";
+			const bool written = WriteCustomTestFile(fileName, test);
+			std::cout << (written ? "---Written " : "***Can not write ") << "\"" << fileName << "\".\n";
+			if (!written)
+			{
+				exitCode = 1;
+			}
+		}
+		return true;
+	}
+
 	for (auto i = 1; i < argc; ++i)
 	{
 		if (std::strcmp(argv[i], "-validateInput") == 0)
@@ -21,10 +92,17 @@ void ProcessCommandLineArguments(int argc, char *argv[])
 			//	<< ".\n\n";
 		}
 	}
+	return false;
 }
 
 int main(int argc, char *argv[])
 {
+	int exitCode;
+	if (ProcessCommandLineArguments(argc, argv, exitCode))
+	{
+		return exitCode;
+	}
+
 	//GenerateCustomWordConcatenationsAndIncreasingOutputs(std::string{ "word" }, 2000);
 	//GenerateCustomWordUnionsAndIncreasingOutputs(std::string{ "abc" }, 250);
 	//ExecuteCustomTestFromFile(std::string{ "test1.txt" });
@@ -37,13 +115,21 @@ int main(int argc, char *argv[])
 	ExecuteCustomTestFromFile(std::string{ "N2.txt" });
 	//ExecuteCustomTestFromFile(std::string{ "N3.txt" });
 
-	//ProcessCommandLineArguments(argc, argv);
 	//RunInputValidationTests();
 
 	//RunFinalStateTransducerTests();
+	//RunSubsequentialTests();
+	//RunScanningTests();
+	//RunSemiringTests();
+	//RunOutputOverflowTests();
+	//RunGeneratedTests();
+	//RunStatsTests();
+	//RunTraceTests();
 	//RunTransitiveClosureTests();
 	//RunAddIdentityTests();
 	//RunCloseEpsilonTests();
+	//RunCloseEpsilonWithAllOutputsTests();
+	//RunStronglyConnectedComponentsTests();
 
 	//RegularFinalStateTransducerBuilder builder(regExpr);
 	//FinalStateTransducer* tr = builder.GetBuildedTransducer();
@@ -0,0 +1,517 @@
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <set>
+
+#include "TestCaseGenerator.h"
+#include "AssertLog.h"
+
+void GenerateCustomWordConcatenationsAndIncreasingOutputs(std::string& word, unsigned len)
+{
+	std::cout << "";
+	for (auto i = 1u; i <= len; ++i)
+	{
+		std::cout << word << ":" << i << " ";
+	}
+
+	for (auto i = 1u; i <= len - 1; ++i)
+	{
+		std::cout << ". ";
+	}
+	std::cout << "\n";
+	std::cout << "Expected only word for recognizing:\n";
+	for (auto i = 1u; i <= len; ++i)
+	{
+		std::cout << word;
+	}
+	std::cout << "\n";
+	std::cout << "Expected output value: " << len * (len + 1) / 2 << "\n";
+}
+
+void GenerateCustomWordUnionsAndIncreasingOutputs(std::string& word, unsigned len)
+{
+	std::cout << "";
+	for (auto i = 1u; i <= len; ++i)
+	{
+		std::cout << word << ":" << i << " ";
+	}
+
+	for (auto i = 1u; i <= len - 1; ++i)
+	{
+		std::cout << "| ";
+	}
+	std::cout << "\n";
+	std::cout << "Expected only word for recognizing:\n" << word
+		<< "\n";
+}
+
+typedef std::mt19937 GeneratorEngine;
+
+// [0, @count), the small bias of the modulo does not matter here.
+static unsigned GetRandom(GeneratorEngine& engine, unsigned count)
+{
+	return (unsigned) (engine() % count);
+}
+
+// [0, 1)
+static double GetRandomFraction(GeneratorEngine& engine)
+{
+	return engine() / 4294967296.0;
+}
+
+// The cumulative probabilities of 1 ... @count for P(k) ~ 1 / k^@exponent.
+static std::vector<double> GetZipfianDistribution(unsigned count, double exponent)
+{
+	std::vector<double> cumulative(count);
+	double sum = 0;
+	for (auto k = 1u; k <= count; ++k)
+	{
+		sum += 1 / std::pow(k, exponent);
+		cumulative[k - 1] = sum;
+	}
+	for (auto& probability : cumulative)
+	{
+		probability /= sum;
+	}
+	return cumulative;
+}
+
+// 1 ... cumulative.size()
+static unsigned GetZipfian(GeneratorEngine& engine, const std::vector<double>& cumulative)
+{
+	const auto at = std::upper_bound(cumulative.begin(), cumulative.end(), GetRandomFraction(engine)) - cumulative.begin();
+	return (unsigned) std::min<size_t>(at, cumulative.size() - 1) + 1;
+}
+
+static GeneratedExpression MakeWord(const std::string& word, Output output)
+{
+	return GeneratedExpression{ GeneratedExpression::Word, word, output, {} };
+}
+
+static GeneratedExpression MakeOperation(GeneratedExpression::Kind kind, std::vector<GeneratedExpression> operands)
+{
+	return GeneratedExpression{ kind, std::string{}, 0, std::move(operands) };
+}
+
+static void AppendRegex(const GeneratedExpression& expression, std::string& regex)
+{
+	switch (expression.kind)
+	{
+	case GeneratedExpression::Word:
+		regex += expression.word + ":" + std::to_string(expression.output) + " ";
+		break;
+	case GeneratedExpression::Concat:
+	case GeneratedExpression::Union:
+		for (const auto& operand : expression.operands)
+		{
+			AppendRegex(operand, regex);
+		}
+		for (size_t i = 1; i < expression.operands.size(); ++i)
+		{
+			regex += expression.kind == GeneratedExpression::Concat ? ". " : "| ";
+		}
+		break;
+	case GeneratedExpression::Star:
+	case GeneratedExpression::Plus:
+		AppendRegex(expression.operands[0], regex);
+		regex += expression.kind == GeneratedExpression::Star ? "* " : "+ ";
+		break;
+	}
+}
+
+std::string GetRegex(const GeneratedExpression& expression)
+{
+	std::string regex;
+	AppendRegex(expression, regex);
+	if (!regex.empty())
+	{
+		regex.pop_back();
+	}
+	return regex;
+}
+
+// <the position in the word, the output so far>
+typedef std::set<std::pair<size_t, Output>> PositionsAndOutputs;
+
+static PositionsAndOutputs Match(const GeneratedExpression& expression, const std::string& word, const PositionsAndOutputs& starts);
+
+// The closure of @starts with @body (the starts are included).
+static PositionsAndOutputs MatchStar(const GeneratedExpression& body, const std::string& word, const PositionsAndOutputs& starts)
+{
+	auto result = starts;
+	auto frontier = starts;
+	// Each iteration which finds something new reads a symbol (the bodies recognize the empty word only with 0).
+	for (size_t iteration = 0; !frontier.empty(); ++iteration)
+	{
+		if (iteration > word.size() + 1)
+		{
+			LogAndAssert(false, "A star of a generated expression recognizes the empty word with a non-zero output.");
+			break;
+		}
+
+		PositionsAndOutputs next;
+		for (const auto& reached : Match(body, word, frontier))
+		{
+			if (result.insert(reached).second)
+			{
+				next.insert(reached);
+			}
+		}
+		frontier.swap(next);
+	}
+	return result;
+}
+
+static PositionsAndOutputs Match(const GeneratedExpression& expression, const std::string& word, const PositionsAndOutputs& starts)
+{
+	PositionsAndOutputs result;
+	switch (expression.kind)
+	{
+	case GeneratedExpression::Word:
+		for (const auto& start : starts)
+		{
+			if (word.compare(start.first, expression.word.size(), expression.word) == 0)
+			{
+				result.insert({ start.first + expression.word.size(), AddOutputs(start.second, expression.output) });
+			}
+		}
+		break;
+	case GeneratedExpression::Concat:
+		result = starts;
+		for (const auto& operand : expression.operands)
+		{
+			result = Match(operand, word, result);
+		}
+		break;
+	case GeneratedExpression::Union:
+		for (const auto& operand : expression.operands)
+		{
+			const auto reached = Match(operand, word, starts);
+			result.insert(reached.begin(), reached.end());
+		}
+		break;
+	case GeneratedExpression::Star:
+		result = MatchStar(expression.operands[0], word, starts);
+		break;
+	case GeneratedExpression::Plus:
+		result = MatchStar(expression.operands[0], word, Match(expression.operands[0], word, starts));
+		break;
+	}
+	return result;
+}
+
+std::vector<Output> GetExpectedOutputs(const GeneratedExpression& expression, const std::string& word)
+{
+	std::vector<Output> outputs;
+	for (const auto& reached : Match(expression, word, { { 0, 0 } }))
+	{
+		if (reached.first == word.size())
+		{
+			outputs.push_back(reached.second);
+		}
+	}
+	std::sort(outputs.begin(), outputs.end());
+	outputs.erase(std::unique(outputs.begin(), outputs.end()), outputs.end());
+	return outputs;
+}
+
+// A random word of @expression, the stars and pluses are repeated up to 3 times.
+static void AppendSample(const GeneratedExpression& expression, GeneratorEngine& engine, std::string& word)
+{
+	switch (expression.kind)
+	{
+	case GeneratedExpression::Word:
+		word += expression.word;
+		break;
+	case GeneratedExpression::Concat:
+		for (const auto& operand : expression.operands)
+		{
+			AppendSample(operand, engine, word);
+		}
+		break;
+	case GeneratedExpression::Union:
+		AppendSample(expression.operands[GetRandom(engine, (unsigned) expression.operands.size())], engine, word);
+		break;
+	case GeneratedExpression::Star:
+	case GeneratedExpression::Plus:
+		for (auto i = 0u, count = GetRandom(engine, 4) + (expression.kind == GeneratedExpression::Plus); i < count; ++i)
+		{
+			AppendSample(expression.operands[0], engine, word);
+		}
+		break;
+	}
+}
+
+static void AddSymbols(const GeneratedExpression& expression, std::set<char>& symbols)
+{
+	symbols.insert(expression.word.begin(), expression.word.end());
+	for (const auto& operand : expression.operands)
+	{
+		AddSymbols(operand, symbols);
+	}
+}
+
+// The empty word, @queriesCount / 2 sampled words and the rest of them sampled and then changed by a symbol (replaced, removed or added).
+static GeneratedTest MakeTest(const std::string& name, const GeneratedExpression& expression, unsigned queriesCount, GeneratorEngine& engine)
+{
+	GeneratedTest test;
+	test.name = name;
+	test.regex = GetRegex(expression);
+
+	std::set<char> symbolsSet;
+	AddSymbols(expression, symbolsSet);
+	const std::string symbols(symbolsSet.begin(), symbolsSet.end());
+
+	std::set<std::string> added{ std::string{} };
+	test.words.push_back(std::string{});
+	for (auto attempt = 0u; test.words.size() < queriesCount && attempt < 10 * queriesCount; ++attempt)
+	{
+		std::string word;
+		AppendSample(expression, engine, word);
+		if (test.words.size() > queriesCount / 2 && !symbols.empty())
+		{
+			const auto at = GetRandom(engine, (unsigned) word.size() + 1);
+			const auto symbol = symbols[GetRandom(engine, (unsigned) symbols.size())];
+			const auto change = GetRandom(engine, 3);
+			if (change == 0 && at < word.size())
+			{
+				word[at] = symbol;
+			}
+			else if (change != 2)
+			{
+				word.insert(word.begin() + at, symbol);
+			}
+			else
+			{
+				word.erase(std::min<size_t>(at, word.size()), 1);
+			}
+		}
+		if (added.insert(word).second)
+		{
+			test.words.push_back(word);
+		}
+	}
+
+	for (const auto& word : test.words)
+	{
+		test.expectedOutputs.push_back(GetExpectedOutputs(expression, word));
+	}
+	return test;
+}
+
+static GeneratedExpression MakeIncreasingOutputs(const std::string& word, unsigned count, GeneratedExpression::Kind kind)
+{
+	std::vector<GeneratedExpression> operands;
+	for (auto i = 1u; i <= count; ++i)
+	{
+		operands.push_back(MakeWord(word, i));
+	}
+	return MakeOperation(kind, std::move(operands));
+}
+
+GeneratedTest GenerateWordConcatenations(const std::string& word, unsigned count, unsigned queriesCount, unsigned seed)
+{
+	GeneratorEngine engine(seed);
+	return MakeTest("concatenations_" + std::to_string(count), MakeIncreasingOutputs(word, count, GeneratedExpression::Concat), queriesCount, engine);
+}
+
+GeneratedTest GenerateWordUnions(const std::string& word, unsigned count, unsigned queriesCount, unsigned seed)
+{
+	GeneratorEngine engine(seed);
+	return MakeTest("unions_" + std::to_string(count), MakeIncreasingOutputs(word, count, GeneratedExpression::Union), queriesCount, engine);
+}
+
+// With @distinct the words are different and their outputs are 1, 2, ... (so the dictionary is functional).
+static GeneratedExpression MakeDictionary(unsigned wordsCount, const std::string& alphabet, unsigned maxLength, double exponent,
+	bool distinct, GeneratorEngine& engine)
+{
+	const auto lengths = GetZipfianDistribution(maxLength, exponent);
+	std::set<std::string> added;
+	std::vector<GeneratedExpression> operands;
+	for (auto attempt = 0u; operands.size() < wordsCount && attempt < 10 * wordsCount; ++attempt)
+	{
+		std::string word(GetZipfian(engine, lengths), ' ');
+		for (auto& symbol : word)
+		{
+			symbol = alphabet[GetRandom(engine, (unsigned) alphabet.size())];
+		}
+		if (!distinct)
+		{
+			operands.push_back(MakeWord(word, GetRandom(engine, 1000) + 1));
+		}
+		else if (added.insert(word).second)
+		{
+			operands.push_back(MakeWord(word, (Output) operands.size() + 1));
+		}
+	}
+	return MakeOperation(GeneratedExpression::Union, std::move(operands));
+}
+
+GeneratedTest GenerateZipfianDictionary(unsigned wordsCount, const std::string& alphabet, unsigned maxLength, double exponent,
+	unsigned queriesCount, unsigned seed)
+{
+	GeneratorEngine engine(seed);
+	const auto dictionary = MakeDictionary(wordsCount, alphabet, maxLength, exponent, false, engine);
+	return MakeTest("dictionary_" + std::to_string(wordsCount), dictionary, queriesCount, engine);
+}
+
+GeneratedTest GenerateNestedStars(unsigned depth, bool alternatePlus, bool optionalDelimiters, unsigned queriesCount, unsigned seed)
+{
+	const std::string delimiters = "cdefghijklmnopqrstuvwxyz";
+	LogAndAssert(depth <= delimiters.size(), "The nested stars are at most 24 deep.");
+	depth = std::min<unsigned>(depth, (unsigned) delimiters.size());
+
+	GeneratorEngine engine(seed);
+	auto expression = MakeOperation(GeneratedExpression::Union, { MakeWord("a", 1), MakeWord("b", 2) });
+	for (auto k = 1u; k <= depth; ++k)
+	{
+		auto delimiter = MakeWord(std::string(1, delimiters[k - 1]), k + 2);
+		if (optionalDelimiters)
+		{
+			delimiter = MakeOperation(GeneratedExpression::Union, { MakeWord("", 0), delimiter });
+		}
+		const auto kind = alternatePlus && k % 2 ? GeneratedExpression::Plus : GeneratedExpression::Star;
+		expression = MakeOperation(kind, { MakeOperation(GeneratedExpression::Concat, { expression, delimiter }) });
+	}
+	return MakeTest("nested_stars_" + std::to_string(depth) + (optionalDelimiters ? "_epsilons" : ""), expression, queriesCount, engine);
+}
+
+GeneratedTest GenerateRomanNumerals(unsigned digitsCount, unsigned repeats, bool starOnTop, unsigned queriesCount, unsigned seed)
+{
+	// One, five and ten of each digit, the highest digit has only the numerals 1 ... 3 (as M, MM, MMM).
+	const std::string letters = "IVXLCDMNOPQRSTUWY";
+	const char* const numerals[] = { "1", "11", "111", "15", "5", "51", "511", "5111", "1X" };
+	LogAndAssert(digitsCount >= 1 && digitsCount <= 9, "The Roman numerals have 1 ... 9 digits.");
+	digitsCount = std::max(1u, std::min(digitsCount, 9u));
+
+	GeneratorEngine engine(seed);
+	std::vector<GeneratedExpression> digits;
+	Output value = 1;
+	for (auto digit = 0u; digit < digitsCount; ++digit, value *= 10)
+	{
+		const bool highest = digit + 1 == digitsCount;
+		std::vector<GeneratedExpression> operands;
+		for (auto n = 1u; n <= (highest ? 3u : 9u); ++n)
+		{
+			std::string numeral;
+			for (auto p = numerals[n - 1]; *p; ++p)
+			{
+				numeral += letters[2 * digit + (*p == '1' ? 0 : *p == '5' ? 1 : 2)];
+			}
+			operands.push_back(MakeWord(numeral, n * value));
+		}
+		if (highest && starOnTop)
+		{
+			digits.push_back(MakeOperation(GeneratedExpression::Star, { MakeOperation(GeneratedExpression::Union, std::move(operands)) }));
+			continue;
+		}
+
+		operands.insert(operands.begin(), MakeWord("", 0));
+		for (auto i = 0u; i < std::max(repeats, 1u); ++i)
+		{
+			digits.push_back(MakeOperation(GeneratedExpression::Union, operands));
+		}
+	}
+	std::reverse(digits.begin(), digits.end());
+	return MakeTest("roman_" + std::to_string(digitsCount) + "_x" + std::to_string(repeats) + (starOnTop ? "_star" : ""),
+		MakeOperation(GeneratedExpression::Concat, std::move(digits)), queriesCount, engine);
+}
+
+GeneratedTest GenerateAmbiguousUnions(unsigned groupsCount, unsigned width, unsigned queriesCount, unsigned seed)
+{
+	GeneratorEngine engine(seed);
+	std::vector<GeneratedExpression> groups;
+	for (auto i = 0u; i < groupsCount; ++i)
+	{
+		std::vector<GeneratedExpression> operands;
+		for (auto length = 1u; length <= width; ++length)
+		{
+			operands.push_back(MakeWord(std::string(length, 'a'), GetRandom(engine, 10)));
+		}
+		groups.push_back(MakeOperation(GeneratedExpression::Union, std::move(operands)));
+	}
+	return MakeTest("ambiguous_" + std::to_string(groupsCount) + "x" + std::to_string(width),
+		MakeOperation(GeneratedExpression::Concat, std::move(groups)), queriesCount, engine);
+}
+
+GeneratedTest GenerateLargeAlphabet(unsigned alphabetSize, unsigned wordsCount, unsigned maxLength, unsigned queriesCount, unsigned seed)
+{
+	// The printable bytes without ' ' (between the tokens), ':' (before the output) and '!' (after each word).
+	std::string alphabet;
+	for (auto symbol = 34u; symbol < 256 && alphabet.size() < alphabetSize; ++symbol)
+	{
+		if (symbol != ':' && (symbol < 127 || symbol > 160))
+		{
+			alphabet += (char) symbol;
+		}
+	}
+
+	GeneratorEngine engine(seed);
+	const auto dictionary = MakeDictionary(wordsCount, alphabet, maxLength, 1, true, engine);
+	const auto delimitedWord = MakeOperation(GeneratedExpression::Concat, { dictionary, MakeWord("!", 0) });
+	return MakeTest("alphabet_" + std::to_string(alphabet.size()), MakeOperation(GeneratedExpression::Star, { delimitedWord }), queriesCount, engine);
+}
+
+std::vector<GeneratedTest> GenerateScalingSuite()
+{
+	const unsigned queriesCount = 20;
+	std::vector<GeneratedTest> tests;
+	for (auto count : { 125u, 250u, 500u, 1000u })
+	{
+		tests.push_back(GenerateWordConcatenations("word", count, queriesCount, count));
+	}
+	for (auto count : { 50u, 100u, 200u, 400u })
+	{
+		tests.push_back(GenerateWordUnions("abc", count, queriesCount, count));
+	}
+	for (auto count : { 250u, 500u, 1000u })
+	{
+		tests.push_back(GenerateZipfianDictionary(count, "abcdefghijklmnopqrstuvwxyz", 12, 1, queriesCount, count));
+	}
+	for (auto depth : { 2u, 4u, 8u })
+	{
+		tests.push_back(GenerateNestedStars(depth, true, false, queriesCount, depth));
+		tests.push_back(GenerateNestedStars(depth, true, true, queriesCount, depth));
+	}
+	for (auto digits : { 3u, 4u, 5u })
+	{
+		tests.push_back(GenerateRomanNumerals(digits, 1, false, queriesCount, digits));
+		tests.push_back(GenerateRomanNumerals(digits, 2, true, queriesCount, digits));
+	}
+	for (auto groups : { 2u, 4u, 8u })
+	{
+		tests.push_back(GenerateAmbiguousUnions(groups, 4, queriesCount, groups));
+	}
+	for (auto alphabetSize : { 16u, 64u, 187u })
+	{
+		tests.push_back(GenerateLargeAlphabet(alphabetSize, 500, 6, queriesCount, alphabetSize));
+	}
+	return tests;
+}
+
+bool WriteCustomTestFile(const std::string& fileName, const GeneratedTest& test)
+{
+	std::ofstream f(fileName, std::ios::binary);
+	if (!f)
+	{
+		return false;
+	}
+
+	f << test.regex << "\n" << test.words.size() << "\n";
+	for (const auto& word : test.words)
+	{
+		f << word << "\n";
+	}
+	f << "Expected outputs:\n";
+	for (const auto& outputs : test.expectedOutputs)
+	{
+		for (size_t i = 0; i < outputs.size(); ++i)
+		{
+			f << (i ? " " : "") << outputs[i];
+		}
+		f << "\n";
+	}
+	return (bool) f;
+}
@@ -1,43 +1,81 @@
 #pragma once
 
-#include <iostream>
 #include <string>
+#include <vector>
+#include "SetOperations.h"
 
-void GenerateCustomWordConcatenationsAndIncreasingOutputs(std::string& word, unsigned len)
+// Print the regex and the expected word and output to the standard output.
+void GenerateCustomWordConcatenationsAndIncreasingOutputs(std::string& word, unsigned len);
+void GenerateCustomWordUnionsAndIncreasingOutputs(std::string& word, unsigned len);
+
+/*
+	Families of generated tests with parameters for scaling them. Each test has the regex, the words for traversing
+	(some sampled from the expression, some of them changed by a symbol, so they might not be recognized, and the empty word)
+	and the expected outputs of each word. The expected outputs are found by matching the word against the expression
+	itself (not with a transducer), so they check the whole construction.
+
+	The random choices are made with std::mt19937 and without the standard distributions (which differ between the
+	standard libraries), so the same parameters and seed give the same test everywhere.
+*/
+
+// The expression of a generated test. The stars and pluses never have a body which recognizes the empty word with a non-zero output.
+struct GeneratedExpression
 {
-	std::cout << "";
-	for (auto i = 1u; i <= len; ++i)
+	enum Kind
 	{
-		std::cout << word << ":" << i << " ";
-	}
+		Word, // @word:@output, the empty word for an epsilon output.
+		Concat,
+		Union,
+		Star,
+		Plus,
+	};
 
-	for (auto i = 1u; i <= len - 1; ++i)
-	{
-		std::cout << ". ";
-	}
-	std::cout << "\n";
-	std::cout << "Expected only word for recognizing:\n";
-	for (auto i = 1u; i <= len; ++i)
-	{
-		std::cout << word;
-	}
-	std::cout << "\n";
-	std::cout << "Expected output value: " << len * (len + 1) / 2 << "\n";
-}
+	Kind kind;
+	std::string word;
+	Output output;
+	std::vector<GeneratedExpression> operands; // One for a star and a plus.
+};
 
-void GenerateCustomWordUnionsAndIncreasingOutputs(std::string& word, unsigned len)
+struct GeneratedTest
 {
-	std::cout << "";
-	for (auto i = 1u; i <= len; ++i)
-	{
-		std::cout << word << ":" << i << " ";
-	}
+	std::string name;
+	std::string regex;
+	std::vector<std::string> words;
+	std::vector<std::vector<Output>> expectedOutputs; // Sorted, for each word.
+};
 
-	for (auto i = 1u; i <= len - 1; ++i)
-	{
-		std::cout << "| ";
-	}
-	std::cout << "\n";
-	std::cout << "Expected only word for recognizing:\n" << word
-		<< "\n";
-}
\ No newline at end of file
+// The regex in the input format (the n-ary concatenations and unions as the operands followed by n - 1 operators).
+std::string GetRegex(const GeneratedExpression& expression);
+
+// The outputs of the paths of @expression with @word, sorted and unique.
+std::vector<Output> GetExpectedOutputs(const GeneratedExpression& expression, const std::string& word);
+
+// word:1 word:2 ... word:count . . . (the same as GenerateCustomWordConcatenationsAndIncreasingOutputs).
+GeneratedTest GenerateWordConcatenations(const std::string& word, unsigned count, unsigned queriesCount, unsigned seed);
+// word:1 word:2 ... word:count | | | (the same as GenerateCustomWordUnionsAndIncreasingOutputs).
+GeneratedTest GenerateWordUnions(const std::string& word, unsigned count, unsigned queriesCount, unsigned seed);
+// A union of @wordsCount random words over @alphabet, the lengths are 1 ... @maxLength with a Zipfian distribution (P(k) ~ 1 / k^@exponent).
+// The short words repeat with different outputs.
+GeneratedTest GenerateZipfianDictionary(unsigned wordsCount, const std::string& alphabet, unsigned maxLength, double exponent,
+	unsigned queriesCount, unsigned seed);
+// E(0) = a:1 | b:2, E(k) = (E(k - 1) c(k):k+2)* (a plus for the odd k with @alternatePlus). With @optionalDelimiters c(k) is in a union
+// with :0, so most of the transitions of the built transducer are epsilon transitions and the words have many paths.
+GeneratedTest GenerateNestedStars(unsigned depth, bool alternatePlus, bool optionalDelimiters, unsigned queriesCount, unsigned seed);
+// Roman numerals of @digitsCount (1 ... 9) digits as N.txt: a union of :0 and the 9 numerals for each digit, concatenated.
+// Each digit is repeated @repeats times as the hundreds in N1.txt (the words have more paths) and with @starOnTop
+// the highest digit is closed with a star as the thousands in N2.txt (the transducer is infinite).
+GeneratedTest GenerateRomanNumerals(unsigned digitsCount, unsigned repeats, bool starOnTop, unsigned queriesCount, unsigned seed);
+// A concatenation of @groupsCount unions of a:x a^2:x ... a^@width:x with random outputs 'x', a^n has a path for each composition of n.
+GeneratedTest GenerateAmbiguousUnions(unsigned groupsCount, unsigned width, unsigned queriesCount, unsigned seed);
+// (w1:1 | w2:2 | ... !:0 .)* for different random words over the first @alphabetSize (up to 187) printable bytes,
+// so the states have many symbols.
+GeneratedTest GenerateLargeAlphabet(unsigned alphabetSize, unsigned wordsCount, unsigned maxLength, unsigned queriesCount, unsigned seed);
+
+// The families at a few scales each, for curves of the states, the epsilon transitions and the ambiguity.
+std::vector<GeneratedTest> GenerateScalingSuite();
+
+/*
+	Writes @test in the CustomTestExecuter format, with the expected outputs after the words. Returns false if the file
+	can not be written.
+*/
+bool WriteCustomTestFile(const std::string& fileName, const GeneratedTest& test);
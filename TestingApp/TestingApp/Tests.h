@@ -2,6 +2,15 @@
 
 void RunInputValidationTests();
 void RunFinalStateTransducerTests();
+void RunSubsequentialTests();
+void RunScanningTests();
+void RunSemiringTests();
+void RunOutputOverflowTests();
+void RunGeneratedTests();
+void RunStatsTests();
+void RunTraceTests();
 void RunTransitiveClosureTests();
 void RunAddIdentityTests();
-void RunCloseEpsilonTests();
\ No newline at end of file
+void RunCloseEpsilonTests();
+void RunCloseEpsilonWithAllOutputsTests();
+void RunStronglyConnectedComponentsTests();
\ No newline at end of file
@@ -0,0 +1,126 @@
+#include <atomic>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "Trace.h"
+
+typedef std::chrono::steady_clock TraceClock;
+
+struct TraceEvent
+{
+	const char* name;
+	char phase; // 'X' for a scoped event, 'C' for a counter.
+	unsigned thread;
+	TraceClock::time_point start;
+	TraceClock::duration duration;
+	size_t value; // Of a counter.
+};
+
+static std::atomic<bool> Tracing(false);
+static std::mutex TraceMutex; // For all below.
+static TraceClock::time_point TraceStart;
+static std::vector<TraceEvent> TraceEvents;
+static std::map<std::thread::id, unsigned> TraceThreads; // The track of each thread, in the order of their first events.
+
+// Must be called with a locked TraceMutex.
+static unsigned GetTraceThread()
+{
+	return TraceThreads.emplace(std::this_thread::get_id(), (unsigned) TraceThreads.size() + 1).first->second;
+}
+
+void StartTrace()
+{
+	std::lock_guard<std::mutex> lock(TraceMutex);
+	TraceEvents.clear();
+	TraceThreads.clear();
+	TraceStart = TraceClock::now();
+	Tracing = true;
+}
+
+void StopTrace()
+{
+	Tracing = false;
+}
+
+bool IsTracing()
+{
+	return Tracing;
+}
+
+void AddTraceCounter(const char* name, size_t value)
+{
+	if (!Tracing)
+	{
+		return;
+	}
+
+	const auto now = TraceClock::now();
+	std::lock_guard<std::mutex> lock(TraceMutex);
+	TraceEvents.push_back(TraceEvent{ name, 'C', GetTraceThread(), now, TraceClock::duration::zero(), value });
+}
+
+ScopedTraceEvent::ScopedTraceEvent(const char* name)
+	: Name(name)
+	, Start(TraceClock::now())
+{
+}
+
+ScopedTraceEvent::~ScopedTraceEvent()
+{
+	if (!Tracing)
+	{
+		return;
+	}
+
+	const auto end = TraceClock::now();
+	std::lock_guard<std::mutex> lock(TraceMutex);
+	if (Start < TraceStart)
+	{
+		return; // Started before the trace.
+	}
+	TraceEvents.push_back(TraceEvent{ Name, 'X', GetTraceThread(), Start, end - Start, 0 });
+}
+
+// The trace format has the times in microseconds.
+static double ToMicroseconds(TraceClock::duration duration)
+{
+	return std::chrono::duration<double, std::micro>(duration).count();
+}
+
+bool WriteTrace(const std::string& fileName)
+{
+	std::ofstream f(fileName);
+	if (!f)
+	{
+		return false;
+	}
+
+	std::lock_guard<std::mutex> lock(TraceMutex);
+	f.precision(3);
+	f << std::fixed;
+	f << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+	f << "  {\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1, \"args\": {\"name\": \"FinalStateTransducer\"}}";
+	for (const auto& thread : TraceThreads)
+	{
+		f << ",\n  {\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << thread.second
+			<< ", \"args\": {\"name\": \"thread " << thread.second << "\"}}";
+	}
+	for (const auto& event : TraceEvents)
+	{
+		// The names are the literals of TRACE_SCOPE and TRACE_COUNTER, they need no escaping.
+		f << ",\n  {\"name\": \"" << event.name << "\", \"ph\": \"" << event.phase << "\", \"pid\": 1, \"tid\": " << event.thread
+			<< ", \"ts\": " << ToMicroseconds(event.start - TraceStart);
+		if (event.phase == 'X')
+		{
+			f << ", \"dur\": " << ToMicroseconds(event.duration) << "}";
+		}
+		else
+		{
+			f << ", \"args\": {\"value\": " << event.value << "}}";
+		}
+	}
+	f << "\n]}\n";
+	return !!f;
+}
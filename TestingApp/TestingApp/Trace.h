@@ -0,0 +1,47 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <string>
+
+/*
+	A timeline of the construction in the Chrome trace event format, which can be opened with chrome://tracing or
+	https://ui.perfetto.dev. The stages (MakeRealTime, RemoveEpsilon, Expand, ..., and each operation of the regex
+	in RegularFinalStateTransducerBuilder) are scoped events with TRACE_SCOPE and the sizes (the states, the bytes of
+	the arenas) are counters with TRACE_COUNTER, so the viewer shows where the time and the memory go.
+
+	The macros are compiled only when TRACE is defined and the events are recorded only between StartTrace and StopTrace.
+	The recording is thread-safe, the events of each thread are on their own track.
+*/
+
+// Clears the recorded events and starts recording, the times are from now.
+void StartTrace();
+void StopTrace();
+bool IsTracing();
+// Writes the recorded events as JSON. Returns false if the file can not be written.
+bool WriteTrace(const std::string& fileName);
+
+// @name should be a string literal (it is kept until the trace is written).
+void AddTraceCounter(const char* name, size_t value);
+
+// Records an event from its construction until its destruction.
+class ScopedTraceEvent
+{
+public:
+	explicit ScopedTraceEvent(const char* name);
+	~ScopedTraceEvent();
+
+	ScopedTraceEvent(const ScopedTraceEvent&) = delete;
+	ScopedTraceEvent& operator=(const ScopedTraceEvent&) = delete;
+private:
+	const char* Name;
+	std::chrono::steady_clock::time_point Start;
+};
+
+#if defined(TRACE)
+#define TRACE_SCOPE(name) ScopedTraceEvent scopedTraceEvent(name)
+#define TRACE_COUNTER(name, value) AddTraceCounter(name, value)
+#else
+#define TRACE_SCOPE(name)
+#define TRACE_COUNTER(name, value)
+#endif